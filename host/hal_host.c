@@ -0,0 +1,988 @@
+/*
+Linux implementation of the pico-sdk subset used by the firmware.
+
+- time : CLOCK_MONOTONIC, origin at process start ("boot")
+- UART : a tty given by environment variable PM_UART0 / PM_UART1, usually
+         the pty created by jsy_sim. Without variable the UART is silent.
+         The tty takes the place of the TX FIFO.
+- IRQ  : one thread polls the UART ttys and stdin and runs the registered
+         handlers. Handlers and save_and_disable_interrupts() share a
+         recursive mutex, so a handler never runs inside a critical section.
+         Each handler call wakes the cores from __wfe().
+- timer : one thread runs the hardware alarm callbacks, like IRQs.
+- wfe  : one event register per core thread, set by __sev() and IRQs.
+- DMA  : transfers complete immediately when triggered, completion IRQ
+         handlers are called from the triggering thread.
+- I2C  : writes are accepted and counted, there is no display.
+- RTC  : host local time plus the offset set by rtc_set_datetime().
+- core1 : a thread. Lockout is not emulated, core1 keeps running.
+- GPIO  : output levels are kept in the file given by PM_GPIO, mapped
+          shared, so jsy_sim can simulate the load driven by an output.
+- PIO   : no PIO program runs, a thread models the timing of the triac
+          programs : a zero crossing every half period of PM_MAINS_HZ
+          (default 50) with +/-10 us jitter, the period pushed like
+          triac_zero_cross does, and a gate pulse on the side-set pin after
+          the delay queued for triac_fire.
+- flash : a 0xFF filled array, loaded from and written back to the file
+          given by PM_FLASH so the log survives a restart.
+- stdio : stdout and non blocking stdin, '\n' is delivered as '\r'. Once a
+          chars available callback is set, stdin is read by the IRQ thread
+          and the callback runs like the USB IRQ.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+#include "pico/multicore.h"
+#include "pico/util/datetime.h"
+#include "hardware/rtc.h"
+#include "hardware/i2c.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
+#include "hardware/watchdog.h"
+#include "hardware/flash.h"
+#include "hardware/pio.h"
+#include "hardware/timer.h"
+#include "hardware/sync.h"
+#include "triac.pio.h"
+#include "host_gpio.h"
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+#define HOST_NB_IRQ 32
+#define HOST_NB_SHARED_HANDLER 4
+#define HOST_NB_DMA_CHANNEL 12
+#define HOST_NB_ALARM 4
+#define HOST_STDIN_BUF_SIZE 256
+#define HOST_UART_FIFO_SIZE 32
+// nominal RP2040 clk_sys, only used to convert durations to cycles
+#define HOST_CLK_SYS_HZ 125000000
+#define HOST_NB_SM 4
+#define HOST_PIO_FIFO_SIZE 4
+// both FIFOs of a state machine joined in one direction
+#define HOST_PIO_JOINED_FIFO_SIZE (2 * HOST_PIO_FIFO_SIZE)
+#define HOST_PIO_JITTER_US 10
+// gate pulse of triac_fire, in cycles
+#define HOST_PIO_PULSE_CYCLES 97
+
+/*****************************************************************************/
+/*            PRIVATE TYPE                                                   */
+/*****************************************************************************/
+struct uart_inst {
+    int fd;
+    unsigned int baudrate;
+    bool b_rx_irq;
+    // bytes read from tty but not yet read by firmware, like the hardware FIFO
+    uint8_t fifo[HOST_UART_FIFO_SIZE];
+    uint32_t u32_fifo_len;
+    uint32_t u32_fifo_pos;
+};
+
+struct i2c_inst {
+    i2c_hw_t hw;
+    uint32_t u32_bytes;
+};
+
+typedef struct
+{
+    bool b_claimed;
+    bool b_irq0_enabled;
+    bool b_irq0_status;
+    dma_channel_config config;
+    volatile void *write_addr;
+}t_host_dma;
+
+typedef struct
+{
+    bool b_enabled;
+    pio_sm_config config;
+    uint32_t rx_fifo[HOST_PIO_JOINED_FIFO_SIZE];
+    uint32_t u32_rx_head;
+    uint32_t u32_rx_tail;
+    uint32_t tx_fifo[HOST_PIO_JOINED_FIFO_SIZE];
+    uint32_t u32_tx_head;
+    uint32_t u32_tx_tail;
+    uint32_t u32_x;
+}t_host_sm;
+
+struct pio_inst {
+    t_host_sm sm[HOST_NB_SM];
+    uint32_t u32_program_end;
+    bool b_mains_thread;
+};
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static struct uart_inst uart_inst[2] = { { .fd = -1 }, { .fd = -1 } };
+uart_inst_t *uart0 = &uart_inst[0];
+uart_inst_t *uart1 = &uart_inst[1];
+
+static struct i2c_inst i2c_inst[2] = {
+    { .hw = { .status = I2C_IC_STATUS_TFE_BITS } },
+    { .hw = { .status = I2C_IC_STATUS_TFE_BITS } }
+};
+i2c_inst_t *i2c0 = &i2c_inst[0];
+i2c_inst_t *i2c1 = &i2c_inst[1];
+
+struct stdio_driver {
+    bool b_crlf;
+};
+stdio_driver_t stdio_usb = { .b_crlf = true };
+
+static pthread_mutex_t irq_mutex;
+static pthread_once_t irq_once = PTHREAD_ONCE_INIT;
+static pthread_t irq_thread;
+static irq_handler_t irq_handlers[HOST_NB_IRQ][HOST_NB_SHARED_HANDLER];
+static volatile bool irq_enabled[HOST_NB_IRQ];
+
+static t_host_dma host_dma[HOST_NB_DMA_CHANNEL];
+
+static __thread unsigned int host_core_num = 0;
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static bool host_event[2];
+
+static pthread_mutex_t alarm_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t alarm_cond;
+static pthread_once_t alarm_once = PTHREAD_ONCE_INIT;
+static hardware_alarm_callback_t alarm_callbacks[HOST_NB_ALARM];
+static bool alarm_armed[HOST_NB_ALARM];
+static uint64_t alarm_target_us[HOST_NB_ALARM];
+
+static void (*chars_available_cb)(void*) = NULL;
+static void *chars_available_param = NULL;
+static uint8_t stdin_buf[HOST_STDIN_BUF_SIZE];
+static volatile uint32_t u32_stdin_head = 0;
+static volatile uint32_t u32_stdin_tail = 0;
+static bool b_stdin_eof = false;
+
+static struct pio_inst pio_inst[2];
+PIO pio0 = &pio_inst[0];
+PIO pio1 = &pio_inst[1];
+static pthread_mutex_t pio_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+uint8_t host_flash[PICO_FLASH_SIZE_BYTES];
+static int flash_fd = -1;
+static void host_flash_sync(uint32_t flash_offs, size_t count);
+
+static t_host_gpio host_gpio_local[HOST_GPIO_NB];
+static t_host_gpio *host_gpio = host_gpio_local;
+
+static struct timespec boot_time;
+static time_t rtc_offset_s = 0;
+
+/*****************************************************************************/
+/*            TIME                                                           */
+/*****************************************************************************/
+static void __attribute__((constructor)) host_boot(void) {
+    clock_gettime(CLOCK_MONOTONIC, &boot_time);
+
+    memset(host_flash, 0xFF, sizeof(host_flash));
+    const char *p_file = getenv("PM_FLASH");
+    if( p_file != NULL ) {
+        flash_fd = open(p_file, O_RDWR | O_CREAT, 0644);
+        ssize_t len = (flash_fd < 0) ? -1 : pread(flash_fd, host_flash, sizeof(host_flash), 0);
+        if( len < 0 ) {
+            fprintf(stderr, "host: can't use flash file %s: %s\n", p_file, strerror(errno));
+        } else if( len < (ssize_t)sizeof(host_flash) ) {
+            // new file, erased flash
+            memset(&host_flash[len], 0xFF, sizeof(host_flash) - len);
+            host_flash_sync(0, sizeof(host_flash));
+        }
+    }
+
+    p_file = getenv("PM_GPIO");
+    if( p_file != NULL ) {
+        int fd = open(p_file, O_RDWR | O_CREAT, 0644);
+        void *p_map = MAP_FAILED;
+        if( (fd >= 0) && (ftruncate(fd, sizeof(host_gpio_local)) == 0) ) {
+            p_map = mmap(NULL, sizeof(host_gpio_local), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if( p_map == MAP_FAILED ) {
+            fprintf(stderr, "host: can't use gpio file %s: %s\n", p_file, strerror(errno));
+        } else {
+            host_gpio = p_map;
+            memset(host_gpio, 0, sizeof(host_gpio_local));
+        }
+        if( fd >= 0 ) {
+            close(fd);
+        }
+    }
+}
+
+uint64_t time_us_64(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - boot_time.tv_sec) * 1000000u + (now.tv_nsec - boot_time.tv_nsec) / 1000;
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t)time_us_64();
+}
+
+absolute_time_t get_absolute_time(void) {
+    return time_us_64();
+}
+
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) {
+    return (int64_t)(to - from);
+}
+
+void sleep_us(uint64_t us) {
+    struct timespec ts = { .tv_sec = us / 1000000u, .tv_nsec = (us % 1000000u) * 1000 };
+    while( nanosleep(&ts, &ts) != 0 && errno == EINTR ) {
+    }
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_us((uint64_t)ms * 1000);
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index) {
+    return HOST_CLK_SYS_HZ;
+}
+
+/*****************************************************************************/
+/*            IRQ                                                            */
+/*****************************************************************************/
+static void host_irq_call(unsigned int num) {
+    for(int i=0; i<HOST_NB_SHARED_HANDLER; i++) {
+        if( irq_handlers[num][i] ) {
+            irq_handlers[num][i]();
+        }
+    }
+    // taking an interrupt wakes the core
+    __sev();
+}
+
+// stdin to the console buffer, then the chars available callback
+static void host_stdin_read(void) {
+    uint32_t u32_room = HOST_STDIN_BUF_SIZE - (u32_stdin_head - u32_stdin_tail);
+    uint32_t u32_head = u32_stdin_head;
+    while( u32_room > 0 ) {
+        char c;
+        ssize_t len = read(STDIN_FILENO, &c, 1);
+        if( len == 0 ) {
+            // end of input, console is just quiet
+            b_stdin_eof = true;
+            break;
+        }
+        if( len < 0 ) {
+            break;
+        }
+        stdin_buf[u32_head % HOST_STDIN_BUF_SIZE] = (uint8_t)c;
+        u32_head++;
+        u32_room--;
+    }
+    __sync_synchronize();
+    u32_stdin_head = u32_head;
+    pthread_mutex_lock(&irq_mutex);
+    chars_available_cb(chars_available_param);
+    pthread_mutex_unlock(&irq_mutex);
+    __sev();
+}
+
+static bool host_uart_rx_pending(struct uart_inst *uart) {
+    struct pollfd pfd = { .fd = uart->fd, .events = POLLIN };
+    return (uart->u32_fifo_pos < uart->u32_fifo_len) || (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN));
+}
+
+static void *host_irq_thread(void *arg) {
+    while( true ) {
+        struct pollfd pfd[3];
+        int nb = 0;
+        for(int i=0; i<2; i++) {
+            if( (uart_inst[i].fd >= 0) && uart_inst[i].b_rx_irq ) {
+                pfd[nb].fd = uart_inst[i].fd;
+                pfd[nb].events = POLLIN;
+                nb++;
+            }
+        }
+        bool b_stdin = (chars_available_cb != NULL) && !b_stdin_eof
+                    && ((u32_stdin_head - u32_stdin_tail) < HOST_STDIN_BUF_SIZE);
+        if( b_stdin ) {
+            pfd[nb].fd = STDIN_FILENO;
+            pfd[nb].events = POLLIN;
+            nb++;
+        }
+        if( nb == 0 || poll(pfd, nb, 1) <= 0 ) {
+            if( nb == 0 ) {
+                sleep_ms(1);
+            }
+            continue;
+        }
+        if( b_stdin && (pfd[nb-1].revents & (POLLIN | POLLHUP)) ) {
+            host_stdin_read();
+        }
+        for(int i=0; i<2; i++) {
+            unsigned int num = (i == 0) ? UART0_IRQ : UART1_IRQ;
+            if( (uart_inst[i].fd >= 0) && uart_inst[i].b_rx_irq && irq_enabled[num] && host_uart_rx_pending(&uart_inst[i]) ) {
+                pthread_mutex_lock(&irq_mutex);
+                host_irq_call(num);
+                pthread_mutex_unlock(&irq_mutex);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void host_irq_init(void) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&irq_mutex, &attr);
+    pthread_create(&irq_thread, NULL, host_irq_thread, NULL);
+}
+
+void irq_set_exclusive_handler(unsigned int num, irq_handler_t handler) {
+    irq_handlers[num][0] = handler;
+}
+
+void irq_add_shared_handler(unsigned int num, irq_handler_t handler, uint8_t order_priority) {
+    for(int i=0; i<HOST_NB_SHARED_HANDLER; i++) {
+        if( irq_handlers[num][i] == NULL ) {
+            irq_handlers[num][i] = handler;
+            return;
+        }
+    }
+    fprintf(stderr, "host: too many handlers on irq %u\n", num);
+    abort();
+}
+
+void irq_set_enabled(unsigned int num, bool enabled) {
+    pthread_once(&irq_once, host_irq_init);
+    irq_enabled[num] = enabled;
+}
+
+uint32_t save_and_disable_interrupts(void) {
+    pthread_once(&irq_once, host_irq_init);
+    pthread_mutex_lock(&irq_mutex);
+    return 0;
+}
+
+void restore_interrupts(uint32_t status) {
+    pthread_mutex_unlock(&irq_mutex);
+}
+
+/*****************************************************************************/
+/*            GPIO                                                           */
+/*****************************************************************************/
+void gpio_init(unsigned int gpio) {
+}
+
+void gpio_set_dir(unsigned int gpio, bool out) {
+}
+
+void gpio_put(unsigned int gpio, bool value) {
+    t_host_gpio *p_gpio = &host_gpio[gpio % HOST_GPIO_NB];
+    if( p_gpio->u32_level == value ) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t u64_now_us = (uint64_t)now.tv_sec * 1000000u + now.tv_nsec / 1000;
+    // seqlock, readers retry while the count is odd
+    p_gpio->u32_seq++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if( p_gpio->u32_level ) {
+        p_gpio->u64_high_us += u64_now_us - p_gpio->u64_change_us;
+    }
+    p_gpio->u64_change_us = u64_now_us;
+    p_gpio->u32_level = value;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    p_gpio->u32_seq++;
+}
+
+void gpio_set_function(unsigned int gpio, enum gpio_function fn) {
+}
+
+void gpio_pull_up(unsigned int gpio) {
+}
+
+/*****************************************************************************/
+/*            UART                                                           */
+/*****************************************************************************/
+static speed_t host_uart_speed(unsigned int baudrate) {
+    switch( baudrate ) {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        default: return B115200;
+    }
+}
+
+unsigned int uart_set_baudrate(uart_inst_t *uart, unsigned int baudrate) {
+    uart->baudrate = baudrate;
+    if( uart->fd >= 0 ) {
+        // the simulator reads the speed back from the pty to pace its answers
+        struct termios tio;
+        tcgetattr(uart->fd, &tio);
+        cfsetispeed(&tio, host_uart_speed(baudrate));
+        cfsetospeed(&tio, host_uart_speed(baudrate));
+        tcsetattr(uart->fd, TCSANOW, &tio);
+    }
+    return baudrate;
+}
+
+unsigned int uart_init(uart_inst_t *uart, unsigned int baudrate) {
+    const char *p_dev = getenv((uart == uart0) ? "PM_UART0" : "PM_UART1");
+    if( (p_dev != NULL) && (uart->fd < 0) ) {
+        uart->fd = open(p_dev, O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if( uart->fd < 0 ) {
+            fprintf(stderr, "host: can't open %s: %s\n", p_dev, strerror(errno));
+        } else {
+            struct termios tio;
+            tcgetattr(uart->fd, &tio);
+            cfmakeraw(&tio);
+            tcsetattr(uart->fd, TCSANOW, &tio);
+        }
+    }
+    return uart_set_baudrate(uart, baudrate);
+}
+
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts) {
+}
+
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled) {
+}
+
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data) {
+    uart->b_rx_irq = rx_has_data;
+}
+
+bool uart_is_readable(uart_inst_t *uart) {
+    if( uart->u32_fifo_pos < uart->u32_fifo_len ) {
+        return true;
+    }
+    if( uart->fd < 0 ) {
+        return false;
+    }
+    ssize_t len = read(uart->fd, uart->fifo, sizeof(uart->fifo));
+    uart->u32_fifo_pos = 0;
+    uart->u32_fifo_len = (len > 0) ? (uint32_t)len : 0;
+    return uart->u32_fifo_len > 0;
+}
+
+char uart_getc(uart_inst_t *uart) {
+    while( !uart_is_readable(uart) ) {
+        sleep_us(100);
+    }
+    return (char)uart->fifo[uart->u32_fifo_pos++];
+}
+
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len) {
+    while( (uart->fd >= 0) && (len > 0) ) {
+        ssize_t written = write(uart->fd, src, len);
+        if( written < 0 ) {
+            if( errno != EAGAIN ) {
+                return;
+            }
+            sleep_us(100);
+            continue;
+        }
+        src += written;
+        len -= written;
+    }
+}
+
+// the tty takes the place of the TX FIFO
+bool uart_is_writable(uart_inst_t *uart) {
+    struct pollfd pfd = { .fd = uart->fd, .events = POLLOUT };
+    return (uart->fd < 0) || ((poll(&pfd, 1, 0) > 0) && (pfd.revents & POLLOUT));
+}
+
+void uart_putc_raw(uart_inst_t *uart, char c) {
+    uart_write_blocking(uart, (const uint8_t*)&c, 1);
+}
+
+void uart_tx_wait_blocking(uart_inst_t *uart) {
+    if( uart->fd >= 0 ) {
+        tcdrain(uart->fd);
+    }
+}
+
+/*****************************************************************************/
+/*            I2C                                                            */
+/*****************************************************************************/
+unsigned int i2c_init(i2c_inst_t *i2c, unsigned int baudrate) {
+    return baudrate;
+}
+
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop) {
+    i2c->u32_bytes += len;
+    return (int)len;
+}
+
+i2c_hw_t *i2c_get_hw(i2c_inst_t *i2c) {
+    return &i2c->hw;
+}
+
+unsigned int i2c_get_dreq(i2c_inst_t *i2c, bool is_tx) {
+    return 0;
+}
+
+/*****************************************************************************/
+/*            DMA                                                            */
+/*****************************************************************************/
+int dma_claim_unused_channel(bool required) {
+    for(int i=0; i<HOST_NB_DMA_CHANNEL; i++) {
+        if( !host_dma[i].b_claimed ) {
+            host_dma[i].b_claimed = true;
+            return i;
+        }
+    }
+    if( required ) {
+        fprintf(stderr, "host: no free DMA channel\n");
+        abort();
+    }
+    return -1;
+}
+
+dma_channel_config dma_channel_get_default_config(unsigned int channel) {
+    dma_channel_config c = { .size = DMA_SIZE_32, .read_incr = true, .write_incr = false };
+    return c;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) {
+    c->size = size;
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr) {
+    c->read_incr = incr;
+}
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr) {
+    c->write_incr = incr;
+}
+
+void channel_config_set_dreq(dma_channel_config *c, unsigned int dreq) {
+    c->dreq = dreq;
+}
+
+void dma_channel_configure(unsigned int channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, unsigned int transfer_count, bool trigger) {
+    host_dma[channel].config = *config;
+    host_dma[channel].write_addr = write_addr;
+    if( trigger ) {
+        dma_channel_transfer_from_buffer_now(channel, read_addr, transfer_count);
+    }
+}
+
+void dma_channel_transfer_from_buffer_now(unsigned int channel, const volatile void *read_addr, uint32_t transfer_count) {
+    t_host_dma *p_dma = &host_dma[channel];
+    for(int i=0; i<2; i++) {
+        if( p_dma->write_addr == &i2c_inst[i].hw.data_cmd ) {
+            i2c_inst[i].u32_bytes += transfer_count;
+        }
+    }
+    // transfer is immediately complete
+    p_dma->b_irq0_status = true;
+    if( p_dma->b_irq0_enabled && irq_enabled[DMA_IRQ_0] ) {
+        pthread_mutex_lock(&irq_mutex);
+        host_irq_call(DMA_IRQ_0);
+        pthread_mutex_unlock(&irq_mutex);
+    }
+}
+
+bool dma_channel_is_busy(unsigned int channel) {
+    return false;
+}
+
+void dma_channel_abort(unsigned int channel) {
+}
+
+void dma_channel_set_irq0_enabled(unsigned int channel, bool enabled) {
+    host_dma[channel].b_irq0_enabled = enabled;
+}
+
+bool dma_channel_get_irq0_status(unsigned int channel) {
+    return host_dma[channel].b_irq0_status;
+}
+
+void dma_channel_acknowledge_irq0(unsigned int channel) {
+    host_dma[channel].b_irq0_status = false;
+}
+
+/*****************************************************************************/
+/*            RTC                                                            */
+/*****************************************************************************/
+void rtc_init(void) {
+    rtc_offset_s = 0;
+}
+
+bool rtc_set_datetime(datetime_t *t) {
+    struct tm tm = {
+        .tm_year = t->year - 1900, .tm_mon = t->month - 1, .tm_mday = t->day,
+        .tm_hour = t->hour, .tm_min = t->min, .tm_sec = t->sec, .tm_isdst = -1
+    };
+    rtc_offset_s = mktime(&tm) - time(NULL);
+    return true;
+}
+
+bool rtc_get_datetime(datetime_t *t) {
+    time_t now = time(NULL) + rtc_offset_s;
+    struct tm tm;
+    localtime_r(&now, &tm);
+    t->year = tm.tm_year + 1900;
+    t->month = tm.tm_mon + 1;
+    t->day = tm.tm_mday;
+    t->dotw = tm.tm_wday;
+    t->hour = tm.tm_hour;
+    t->min = tm.tm_min;
+    t->sec = tm.tm_sec;
+    return true;
+}
+
+void datetime_to_str(char *buf, unsigned int buf_size, const datetime_t *t) {
+    static const char *DATETIME_DOTWS[7] = { "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday" };
+    static const char *DATETIME_MONTHS[12] = { "January", "February", "March", "April", "May", "June", "July",
+                                               "August", "September", "October", "November", "December" };
+    snprintf(buf, buf_size, "%s %d %s %d:%02d:%02d %d", DATETIME_DOTWS[t->dotw % 7], t->day,
+             DATETIME_MONTHS[(t->month - 1) % 12], t->hour, t->min, t->sec, t->year);
+}
+
+/*****************************************************************************/
+/*            PIO                                                            */
+/*****************************************************************************/
+static uint64_t host_monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static void host_sleep_until_ns(uint64_t u64_ns) {
+    struct timespec ts = { .tv_sec = u64_ns / 1000000000u, .tv_nsec = u64_ns % 1000000000u };
+    while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR ) {
+    }
+}
+
+// entries of a FIFO in direction join (PIO_FIFO_JOIN_RX or PIO_FIFO_JOIN_TX)
+static uint32_t host_pio_fifo_depth(const t_host_sm *p_sm, enum pio_fifo_join join) {
+    if( p_sm->config.fifo_join == PIO_FIFO_JOIN_NONE ) {
+        return HOST_PIO_FIFO_SIZE;
+    }
+    return (p_sm->config.fifo_join == join) ? HOST_PIO_JOINED_FIFO_SIZE : 0;
+}
+
+// mains seen by the zero-cross detector and the firing state machines of one PIO
+static void *host_pio_mains_thread(void *arg) {
+    PIO pio = arg;
+    const char *p_hz = getenv("PM_MAINS_HZ");
+    double mains_hz = (p_hz != NULL) ? atof(p_hz) : 50.0;
+    uint64_t u64_half_ns = (uint64_t)(1e9 / (2.0 * mains_hz));
+    uint64_t u64_zc_ns = host_monotonic_ns();
+
+    while( true ) {
+        uint64_t u64_prev_ns = u64_zc_ns;
+        u64_zc_ns += u64_half_ns + (int64_t)((rand() % (2 * HOST_PIO_JITTER_US + 1)) - HOST_PIO_JITTER_US) * 1000;
+        host_sleep_until_ns(u64_zc_ns);
+
+        uint64_t u64_fire_ns = 0;
+        uint32_t u32_gate = 0;
+        double cycle_ns = 1.0;
+        pthread_mutex_lock(&pio_mutex);
+        for(int i=0; i<HOST_NB_SM; i++) {
+            t_host_sm *p_sm = &pio->sm[i];
+            if( !p_sm->b_enabled ) {
+                continue;
+            }
+            cycle_ns = 1e9 * p_sm->config.clkdiv / HOST_CLK_SYS_HZ;
+            if( p_sm->config.host_program == HOST_PIO_TRIAC_ZERO_CROSS ) {
+                // push noblock : dropped when the FIFO is full
+                uint32_t u32_cycles = (uint32_t)((u64_zc_ns - u64_prev_ns) / cycle_ns);
+                if( (p_sm->u32_rx_head - p_sm->u32_rx_tail) < host_pio_fifo_depth(p_sm, PIO_FIFO_JOIN_RX) ) {
+                    p_sm->rx_fifo[p_sm->u32_rx_head++ % HOST_PIO_JOINED_FIFO_SIZE] = (u32_cycles - triac_zero_cross_OVERHEAD_CYCLES) / 2;
+                }
+            } else if( p_sm->config.host_program == HOST_PIO_TRIAC_FIRE ) {
+                // pull noblock : x again when the FIFO is empty
+                if( p_sm->u32_tx_head != p_sm->u32_tx_tail ) {
+                    p_sm->u32_x = p_sm->tx_fifo[p_sm->u32_tx_tail++ % HOST_PIO_JOINED_FIFO_SIZE];
+                }
+                if( p_sm->u32_x != 0 ) {
+                    u64_fire_ns = u64_zc_ns + (uint64_t)((p_sm->u32_x + triac_fire_OVERHEAD_CYCLES) * cycle_ns);
+                    u32_gate = p_sm->config.sideset_base;
+                }
+            }
+        }
+        pthread_mutex_unlock(&pio_mutex);
+
+        if( u64_fire_ns != 0 ) {
+            host_sleep_until_ns(u64_fire_ns);
+            gpio_put(u32_gate, true);
+            host_sleep_until_ns(u64_fire_ns + (uint64_t)(HOST_PIO_PULSE_CYCLES * cycle_ns));
+            gpio_put(u32_gate, false);
+        }
+    }
+    return NULL;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program) {
+    uint offset = pio->u32_program_end;
+    pio->u32_program_end += program->length;
+    return offset;
+}
+
+void pio_sm_claim(PIO pio, uint sm) {
+}
+
+void pio_gpio_init(PIO pio, uint pin) {
+}
+
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out) {
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config) {
+    pthread_mutex_lock(&pio_mutex);
+    memset(&pio->sm[sm], 0, sizeof(pio->sm[sm]));
+    pio->sm[sm].config = *config;
+    pthread_mutex_unlock(&pio_mutex);
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    pthread_mutex_lock(&pio_mutex);
+    pio->sm[sm].b_enabled = enabled;
+    bool b_start = enabled && !pio->b_mains_thread && (pio->sm[sm].config.host_program == HOST_PIO_TRIAC_ZERO_CROSS);
+    pio->b_mains_thread |= b_start;
+    pthread_mutex_unlock(&pio_mutex);
+    if( b_start ) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, host_pio_mains_thread, pio);
+    }
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+    pthread_mutex_lock(&pio_mutex);
+    t_host_sm *p_sm = &pio->sm[sm];
+    // like the hardware, a write to a full FIFO is lost
+    if( (p_sm->u32_tx_head - p_sm->u32_tx_tail) < host_pio_fifo_depth(p_sm, PIO_FIFO_JOIN_TX) ) {
+        p_sm->tx_fifo[p_sm->u32_tx_head++ % HOST_PIO_JOINED_FIFO_SIZE] = data;
+    }
+    pthread_mutex_unlock(&pio_mutex);
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm) {
+    pthread_mutex_lock(&pio_mutex);
+    t_host_sm *p_sm = &pio->sm[sm];
+    uint32_t u32_data = (p_sm->u32_rx_head != p_sm->u32_rx_tail) ? p_sm->rx_fifo[p_sm->u32_rx_tail++ % HOST_PIO_JOINED_FIFO_SIZE] : 0;
+    pthread_mutex_unlock(&pio_mutex);
+    return u32_data;
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+    pthread_mutex_lock(&pio_mutex);
+    bool b_empty = pio->sm[sm].u32_rx_head == pio->sm[sm].u32_rx_tail;
+    pthread_mutex_unlock(&pio_mutex);
+    return b_empty;
+}
+
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm) {
+    pthread_mutex_lock(&pio_mutex);
+    uint level = pio->sm[sm].u32_tx_head - pio->sm[sm].u32_tx_tail;
+    pthread_mutex_unlock(&pio_mutex);
+    return level;
+}
+
+void __sev(void) {
+    pthread_mutex_lock(&event_mutex);
+    host_event[0] = true;
+    host_event[1] = true;
+    pthread_cond_broadcast(&event_cond);
+    pthread_mutex_unlock(&event_mutex);
+}
+
+void __wfe(void) {
+    pthread_mutex_lock(&event_mutex);
+    while( !host_event[host_core_num] ) {
+        pthread_cond_wait(&event_cond, &event_mutex);
+    }
+    host_event[host_core_num] = false;
+    pthread_mutex_unlock(&event_mutex);
+}
+
+/*****************************************************************************/
+/*            TIMER                                                          */
+/*****************************************************************************/
+static void *host_alarm_thread(void *arg) {
+    pthread_mutex_lock(&alarm_mutex);
+    while( true ) {
+        int next = -1;
+        for(int i=0; i<HOST_NB_ALARM; i++) {
+            if( alarm_armed[i] && ((next < 0) || (alarm_target_us[i] < alarm_target_us[next])) ) {
+                next = i;
+            }
+        }
+        if( next < 0 ) {
+            pthread_cond_wait(&alarm_cond, &alarm_mutex);
+            continue;
+        }
+        if( alarm_target_us[next] > time_us_64() ) {
+            uint64_t u64_ns = (uint64_t)boot_time.tv_sec * 1000000000u + boot_time.tv_nsec + alarm_target_us[next] * 1000;
+            struct timespec ts = { .tv_sec = u64_ns / 1000000000u, .tv_nsec = u64_ns % 1000000000u };
+            pthread_cond_timedwait(&alarm_cond, &alarm_mutex, &ts);
+            continue;
+        }
+        alarm_armed[next] = false;
+        hardware_alarm_callback_t callback = alarm_callbacks[next];
+        pthread_mutex_unlock(&alarm_mutex);
+        if( callback != NULL ) {
+            pthread_mutex_lock(&irq_mutex);
+            callback(next);
+            pthread_mutex_unlock(&irq_mutex);
+        }
+        __sev();
+        pthread_mutex_lock(&alarm_mutex);
+    }
+    return NULL;
+}
+
+static void host_alarm_init(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&alarm_cond, &attr);
+    pthread_t thread;
+    pthread_create(&thread, NULL, host_alarm_thread, NULL);
+}
+
+void hardware_alarm_claim(uint alarm_num) {
+    pthread_once(&irq_once, host_irq_init);
+    pthread_once(&alarm_once, host_alarm_init);
+}
+
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback) {
+    pthread_mutex_lock(&alarm_mutex);
+    alarm_callbacks[alarm_num] = callback;
+    pthread_mutex_unlock(&alarm_mutex);
+}
+
+// true when the target is already past, the alarm is then not armed
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t) {
+    if( to_us_since_boot(t) <= time_us_64() ) {
+        return true;
+    }
+    pthread_mutex_lock(&alarm_mutex);
+    alarm_target_us[alarm_num] = to_us_since_boot(t);
+    alarm_armed[alarm_num] = true;
+    pthread_cond_signal(&alarm_cond);
+    pthread_mutex_unlock(&alarm_mutex);
+    return false;
+}
+
+/*****************************************************************************/
+/*            WATCHDOG / MULTICORE                                           */
+/*****************************************************************************/
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug) {
+    // a reset ends the host process
+    sleep_ms(delay_ms);
+    fflush(stdout);
+    exit(0);
+}
+
+static void *host_core1_thread(void *arg) {
+    host_core_num = 1;
+    ((void (*)(void))arg)();
+    return NULL;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, host_core1_thread, (void *)entry);
+}
+
+void multicore_lockout_victim_init(void) {
+}
+
+void multicore_lockout_start_blocking(void) {
+}
+
+void multicore_lockout_end_blocking(void) {
+}
+
+/*****************************************************************************/
+/*            FLASH                                                          */
+/*****************************************************************************/
+static void host_flash_sync(uint32_t flash_offs, size_t count) {
+    if( (flash_fd >= 0) && (pwrite(flash_fd, &host_flash[flash_offs], count, flash_offs) != (ssize_t)count) ) {
+        fprintf(stderr, "host: flash file write failed: %s\n", strerror(errno));
+    }
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    memset(&host_flash[flash_offs], 0xFF, count);
+    host_flash_sync(flash_offs, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    // NOR flash : programming only clears bits
+    for(size_t i=0; i<count; i++) {
+        host_flash[flash_offs + i] &= data[i];
+    }
+    host_flash_sync(flash_offs, count);
+}
+
+/*****************************************************************************/
+/*            STDIO                                                          */
+/*****************************************************************************/
+bool stdio_init_all(void) {
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+bool stdio_usb_connected(void) {
+    return true;
+}
+
+void stdio_set_translate_crlf(stdio_driver_t *driver, bool translate) {
+    driver->b_crlf = translate;
+}
+
+void stdio_set_chars_available_callback(void (*fn)(void*), void *param) {
+    chars_available_param = param;
+    chars_available_cb = fn;
+    pthread_once(&irq_once, host_irq_init);
+}
+
+int getchar_timeout_us(uint32_t timeout_us) {
+    if( chars_available_cb != NULL ) {
+        // stdin belongs to the IRQ thread
+        uint64_t u64_end_us = time_us_64() + timeout_us;
+        while( u32_stdin_head == u32_stdin_tail ) {
+            if( time_us_64() >= u64_end_us ) {
+                return PICO_ERROR_TIMEOUT;
+            }
+            sleep_us(1000);
+        }
+        char c = (char)stdin_buf[u32_stdin_tail % HOST_STDIN_BUF_SIZE];
+        u32_stdin_tail++;
+        return (c == '\n') ? '\r' : c;
+    }
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    if( poll(&pfd, 1, (int)(timeout_us / 1000)) <= 0 ) {
+        return PICO_ERROR_TIMEOUT;
+    }
+    char c;
+    if( read(STDIN_FILENO, &c, 1) != 1 ) {
+        // end of input, console is just quiet
+        return PICO_ERROR_TIMEOUT;
+    }
+    // console commands end with '\r' like on a serial terminal
+    return (c == '\n') ? '\r' : c;
+}
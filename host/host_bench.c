@@ -0,0 +1,288 @@
+/*
+Host benchmark and regression runner of the firmware hot paths.
+
+Each bench first checks the firmware code against the recorded input, then
+is timed : the operation count is doubled until a run lasts
+HOST_BENCH_CALIBRATE_NS, scaled to HOST_BENCH_RUN_NS, and the fastest of
+HOST_BENCH_NB_RUN runs is kept, it is the least disturbed by the host.
+
+Times are divided by the time of a fixed reference kernel, so the baseline
+holds host independent costs. Runs of the bench and of the reference
+alternate, both see the same host clock and load. A bench slower than its
+baseline by more than the tolerance is measured again after a pause, up to
+HOST_BENCH_NB_CONFIRM times : a regression is slow every time, a burst of
+host load is not.
+
+Baseline lines are "name ratio [tolerance_pct]", the tolerance of a bench
+defaults to the -t one and is kept by -u.
+
+    host_bench [-b baseline] [-u] [-t tolerance_pct] [name...]
+    -b : baseline file, compared with when given
+    -u : write the measures to the baseline file
+    -t : allowed slowdown in percent, default HOST_BENCH_DEFAULT_TOLERANCE
+    name : run only the benches whose name starts with one of them
+
+Exit code is 1 on a failed check or a regression.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "host_bench.h"
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+#define HOST_BENCH_CALIBRATE_NS         (2 * 1000 * 1000)
+#define HOST_BENCH_RUN_NS               (10 * 1000 * 1000)
+#define HOST_BENCH_NB_RUN               7
+#define HOST_BENCH_DEFAULT_TOLERANCE    20
+#define HOST_BENCH_NB_CONFIRM           4
+#define HOST_BENCH_CONFIRM_PAUSE_US     (50 * 1000)
+#define HOST_BENCH_MAX_BENCH            32
+#define HOST_BENCH_NAME_LEN             32
+// xorshift steps of one reference operation
+#define HOST_BENCH_REF_STEPS            64
+
+/*****************************************************************************/
+/*            PRIVATE TYPE                                                   */
+/*****************************************************************************/
+typedef struct
+{
+    char name[HOST_BENCH_NAME_LEN];
+    double ratio;
+    uint32_t u32_tolerance; // percent, 0 for the default one
+}t_host_baseline;
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+volatile uint32_t host_bench_sink = 0;
+
+static t_host_baseline baselines[HOST_BENCH_MAX_BENCH];
+static uint32_t u32_nb_baseline = 0;
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+static uint64_t host_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// fixed dependent chain, the unit of the baseline
+static void __attribute__((noinline)) bench_reference(uint32_t u32_nb_op) {
+    uint32_t x = host_bench_sink | 1;
+    for(uint32_t i=0; i<u32_nb_op; i++) {
+        for(uint32_t s=0; s<HOST_BENCH_REF_STEPS; s++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+        }
+    }
+    host_bench_sink = x;
+}
+
+static uint64_t host_bench_run_ns(void (*p_run)(uint32_t), uint32_t u32_nb_op) {
+    uint64_t u64_start_ns = host_now_ns();
+    p_run(u32_nb_op);
+    return host_now_ns() - u64_start_ns;
+}
+
+// operations of one run
+static uint32_t host_bench_calibrate(void (*p_run)(uint32_t)) {
+    uint32_t u32_nb_op = 1;
+    uint64_t u64_ns = host_bench_run_ns(p_run, u32_nb_op);
+    while( (u64_ns < HOST_BENCH_CALIBRATE_NS) && (u32_nb_op < (1u << 30)) ) {
+        u32_nb_op *= 2;
+        u64_ns = host_bench_run_ns(p_run, u32_nb_op);
+    }
+    return (uint32_t)(((uint64_t)u32_nb_op * HOST_BENCH_RUN_NS) / (u64_ns + 1)) + 1;
+}
+
+// best ns per operation of the bench and of the reference, runs alternate
+static void host_bench_measure(void (*p_run)(uint32_t), double* p_ns, double* p_ref_ns) {
+    uint32_t u32_nb_op = host_bench_calibrate(p_run);
+    uint32_t u32_nb_ref = host_bench_calibrate(bench_reference);
+    for(uint32_t r=0; r<HOST_BENCH_NB_RUN; r++) {
+        double ref_ns = (double)host_bench_run_ns(bench_reference, u32_nb_ref) / u32_nb_ref;
+        double ns = (double)host_bench_run_ns(p_run, u32_nb_op) / u32_nb_op;
+        if( (r == 0) || (ref_ns < *p_ref_ns) ) {
+            *p_ref_ns = ref_ns;
+        }
+        if( (r == 0) || (ns < *p_ns) ) {
+            *p_ns = ns;
+        }
+    }
+}
+
+static bool host_baseline_load(const char* p_path) {
+    FILE* f = fopen(p_path, "r");
+    if( f == NULL ) {
+        return false;
+    }
+    char line[128];
+    while( fgets(line, sizeof(line), f) != NULL ) {
+        t_host_baseline* p_base = &baselines[u32_nb_baseline];
+        if( (line[0] == '#') || (u32_nb_baseline >= HOST_BENCH_MAX_BENCH) ) {
+            continue;
+        }
+        p_base->u32_tolerance = 0;
+        if( sscanf(line, "%31s %lf %u", p_base->name, &p_base->ratio, &p_base->u32_tolerance) >= 2 ) {
+            u32_nb_baseline++;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+static const t_host_baseline* host_baseline_find(const char* p_name) {
+    for(uint32_t i=0; i<u32_nb_baseline; i++) {
+        if( strcmp(baselines[i].name, p_name) == 0 ) {
+            return &baselines[i];
+        }
+    }
+    return NULL;
+}
+
+static bool host_bench_selected(const char* p_name, int argc, char** argv) {
+    if( argc == 0 ) {
+        return true;
+    }
+    for(int i=0; i<argc; i++) {
+        if( strncmp(p_name, argv[i], strlen(argv[i])) == 0 ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    const char* p_baseline_path = NULL;
+    bool b_update = false;
+    uint32_t u32_tolerance = HOST_BENCH_DEFAULT_TOLERANCE;
+    int opt;
+    while( (opt = getopt(argc, argv, "b:ut:")) != -1 ) {
+        switch( opt ) {
+            case 'b':
+                p_baseline_path = optarg;
+                break;
+            case 'u':
+                b_update = true;
+                break;
+            case 't':
+            {
+                char* p_end;
+                long l_tolerance = strtol(optarg, &p_end, 10);
+                if( (*p_end != '\0') || (l_tolerance < 0) ) {
+                    fprintf(stderr, "bad tolerance %s\n", optarg);
+                    return 2;
+                }
+                u32_tolerance = (uint32_t)l_tolerance;
+                break;
+            }
+            default:
+                fprintf(stderr, "usage: %s [-b baseline] [-u] [-t tolerance_pct] [name...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if( b_update && (p_baseline_path == NULL) ) {
+        fprintf(stderr, "-u needs a baseline file\n");
+        return 2;
+    }
+    // an update keeps the tolerances of the current file, if any
+    if( (p_baseline_path != NULL) && !host_baseline_load(p_baseline_path) && !b_update ) {
+        fprintf(stderr, "no baseline %s\n", p_baseline_path);
+        return 2;
+    }
+
+    host_bench_modbus_init();
+    host_bench_display_init();
+    const t_host_bench* benches[HOST_BENCH_MAX_BENCH];
+    uint32_t u32_nb_bench = 0;
+    uint32_t u32_nb;
+    const t_host_bench* p_list = host_bench_modbus(&u32_nb);
+    for(uint32_t i=0; i<u32_nb; i++) {
+        benches[u32_nb_bench++] = &p_list[i];
+    }
+    p_list = host_bench_display(&u32_nb);
+    for(uint32_t i=0; i<u32_nb; i++) {
+        benches[u32_nb_bench++] = &p_list[i];
+    }
+
+    // results are only worth timing when right
+    bool b_fail = false;
+    for(uint32_t i=0; i<u32_nb_bench; i++) {
+        if( host_bench_selected(benches[i]->p_name, argc - optind, &argv[optind]) && !benches[i]->p_check() ) {
+            printf("%-16s CHECK FAILED\n", benches[i]->p_name);
+            b_fail = true;
+        }
+    }
+    if( b_fail ) {
+        return 1;
+    }
+
+    FILE* f_update = NULL;
+    if( b_update ) {
+        f_update = fopen(p_baseline_path, "w");
+        if( f_update == NULL ) {
+            fprintf(stderr, "can't write %s\n", p_baseline_path);
+            return 2;
+        }
+        fprintf(f_update, "# host_bench baseline : cost of each bench in reference operations\n");
+        fprintf(f_update, "# (%u xorshift steps), update with host_bench -u -b <this file>\n", HOST_BENCH_REF_STEPS);
+        fprintf(f_update, "# optional third column : allowed slowdown in percent\n");
+    }
+    for(uint32_t i=0; i<u32_nb_bench; i++) {
+        const t_host_bench* p_bench = benches[i];
+        if( !host_bench_selected(p_bench->p_name, argc - optind, &argv[optind]) ) {
+            continue;
+        }
+        double ns, ref_ns;
+        host_bench_measure(p_bench->p_run, &ns, &ref_ns);
+        double ratio = ns / ref_ns;
+        const t_host_baseline* p_base = host_baseline_find(p_bench->p_name);
+        uint32_t u32_bench_tolerance = ((p_base != NULL) && (p_base->u32_tolerance != 0)) ? p_base->u32_tolerance : u32_tolerance;
+        double change_pct = 0;
+        bool b_compare = (f_update == NULL) && (p_base != NULL);
+        if( b_compare ) {
+            change_pct = (ratio / p_base->ratio - 1.0) * 100.0;
+            for(uint32_t c=0; (c<HOST_BENCH_NB_CONFIRM) && (change_pct > u32_bench_tolerance); c++) {
+                usleep(HOST_BENCH_CONFIRM_PAUSE_US);
+                double confirm_ns, confirm_ref_ns;
+                host_bench_measure(p_bench->p_run, &confirm_ns, &confirm_ref_ns);
+                if( (confirm_ns / confirm_ref_ns) < ratio ) {
+                    ns = confirm_ns;
+                    ref_ns = confirm_ref_ns;
+                    ratio = ns / ref_ns;
+                    change_pct = (ratio / p_base->ratio - 1.0) * 100.0;
+                }
+            }
+        }
+
+        printf("%-16s %9.1f ns/op %8.3f ref", p_bench->p_name, ns, ratio);
+        if( f_update != NULL ) {
+            if( (p_base != NULL) && (p_base->u32_tolerance != 0) ) {
+                fprintf(f_update, "%-16s %.4f %u\n", p_bench->p_name, ratio, p_base->u32_tolerance);
+            } else {
+                fprintf(f_update, "%-16s %.4f\n", p_bench->p_name, ratio);
+            }
+        } else if( b_compare ) {
+            printf("  %+6.1f%% (max %u%%)", change_pct, u32_bench_tolerance);
+            if( change_pct > u32_bench_tolerance ) {
+                printf(" REGRESSION");
+                b_fail = true;
+            }
+        } else if( p_baseline_path != NULL ) {
+            printf("  no baseline");
+        }
+        printf("\n");
+    }
+    if( f_update != NULL ) {
+        fclose(f_update);
+    }
+    return b_fail ? 1 : 0;
+}
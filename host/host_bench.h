@@ -0,0 +1,23 @@
+#ifndef HOST_BENCH_H__
+#define HOST_BENCH_H__
+#include <stdint.h>
+#include <stdbool.h>
+
+// one hot path : p_run does u32_nb_op operations, p_check runs the firmware
+// code once on the recorded input and compares its result with the known one
+typedef struct
+{
+    const char* p_name;
+    void (*p_run)(uint32_t u32_nb_op);
+    bool (*p_check)(void);
+}t_host_bench;
+
+// results are stored here so loops are not optimized out
+extern volatile uint32_t host_bench_sink;
+
+void host_bench_modbus_init(void);
+const t_host_bench* host_bench_modbus(uint32_t* p_nb_bench);
+void host_bench_display_init(void);
+const t_host_bench* host_bench_display(uint32_t* p_nb_bench);
+
+#endif // HOST_BENCH_H__
@@ -0,0 +1,103 @@
+/*
+Host benchmarks of the display : composition of a whole frame from a sample
+and text rendering with each font.
+
+ssd1306_i2c.c is included so its private composer and frames can be driven
+without I2C. Results are checked by a CRC of the frame buffer, the date line
+of a composed frame is left out as it follows the host clock.
+*/
+#include "../src/ssd1306_i2c/ssd1306_i2c.c"
+#include "modbus_crc.h"
+#include "host_bench.h"
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+static const t_power_data bench_power_data = {
+    .u32_index = 42,
+    .tension_mv = 228913,
+    .frequence_mhz = 49960,
+    .voie = {
+        { .courant_ma = 10147, .puissance_active_mw = -2206701, .energie_wh = 12345, .facteur_puissance = 950 },
+        { .courant_ma = 2280, .puissance_active_mw = 469767, .energie_wh = 678, .facteur_puissance = 900 },
+    }
+};
+// CRC of the frames below, update when the layout or a font changes
+#define HOST_BENCH_COMPOSE_CRC  0x3396
+#define HOST_BENCH_TEXT_CRC     0x7DDE
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static t_gfx_frame text_frame;
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+void host_bench_display_init(void) {
+    gfx_init();
+}
+
+static uint16_t frame_crc(const uint8_t* p_buf, uint32_t u32_len) {
+    return modbus_crc16_update_table8(MODBUS_CRC_INIT, p_buf, u32_len);
+}
+
+// back frame is free again each time, as if the previous one was sent
+static void bench_compose(uint32_t u32_nb_op) {
+    t_power_data data = bench_power_data;
+    for(uint32_t i=0; i<u32_nb_op; i++) {
+        b_back_ready = false;
+        data.voie[0].puissance_active_mw = bench_power_data.voie[0].puissance_active_mw + (int32_t)((i & 7) * 1000);
+        SSD1306_compose(&data);
+        host_bench_sink += frames[u8_front ^ 1].dirty_end_col[3];
+    }
+    b_back_ready = false;
+}
+
+static bool check_compose(void) {
+    memset(frames, 0, sizeof(frames));
+    b_back_ready = false;
+    SSD1306_compose(&bench_power_data);
+    b_back_ready = false;
+    uint16_t u16_crc = frame_crc(&frames[u8_front ^ 1].buf[SSD1306_WIDTH], SSD1306_BUF_LEN - SSD1306_WIDTH);
+    if( u16_crc != HOST_BENCH_COMPOSE_CRC ) {
+        printf("compose crc %04X\n", u16_crc);
+        return false;
+    }
+    return true;
+}
+
+static void text_draw(void) {
+    gfx_draw_string(&text_frame, &gfx_font_8x8, 0, 0, "Routeur 12.5A");
+    gfx_draw_string(&text_frame, &gfx_font_prop, 3, 11, "230.1V 49.98Hz -1234W");
+    gfx_draw_string(&text_frame, &gfx_font_digits_16x24, 0, 21, "-2206");
+    gfx_draw_string(&text_frame, &gfx_font_prop, 2, 53, "12345Wh 0.950");
+}
+
+static void bench_text(uint32_t u32_nb_op) {
+    for(uint32_t i=0; i<u32_nb_op; i++) {
+        text_draw();
+        host_bench_sink += text_frame.buf[i & (SSD1306_BUF_LEN-1)];
+    }
+}
+
+static bool check_text(void) {
+    memset(&text_frame, 0, sizeof(text_frame));
+    text_draw();
+    uint16_t u16_crc = frame_crc(text_frame.buf, SSD1306_BUF_LEN);
+    if( u16_crc != HOST_BENCH_TEXT_CRC ) {
+        printf("text crc %04X\n", u16_crc);
+        return false;
+    }
+    return true;
+}
+
+static const t_host_bench host_bench_display_list[] = {
+    { "display_compose", bench_compose, check_compose },
+    { "display_text", bench_text, check_text },
+};
+
+const t_host_bench* host_bench_display(uint32_t* p_nb_bench) {
+    *p_nb_bench = count_of(host_bench_display_list);
+    return host_bench_display_list;
+}
@@ -0,0 +1,277 @@
+/*
+Host benchmarks of the acquisition path : CRC, register decoding, the RX
+state machine fed from recorded byte streams, the answer callback and the
+json telemetry line.
+
+modbus.c is included so its private state machine and slave table can be
+driven directly, without UART or scheduler.
+
+The answers were recorded from jsy_sim at 4800 baud.
+*/
+#include "../src/modbus.c"
+#include "data.h"
+#include "host_bench.h"
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+// 0x0048 block, channel 1 exporting
+static const uint8_t rec_block_a[] = {
+    0x01, 0x03, 0x38, 0x00, 0x22, 0xED, 0xF0, 0x00, 0x01, 0x8C, 0x60, 0x01, 0x50, 0xB7, 0x47, 0x00,
+    0x01, 0xE2, 0x3A, 0x00, 0x00, 0x03, 0xB6, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x13, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x59, 0x11, 0x00, 0x47, 0xAE, 0x49, 0x00,
+    0x00, 0x1A, 0x7C, 0x00, 0x00, 0x03, 0x84, 0x00, 0x00, 0x00, 0x00, 0xB4, 0x83
+};
+static const uint8_t rec_block_b[] = {
+    0x01, 0x03, 0x38, 0x00, 0x23, 0x01, 0x09, 0x00, 0x01, 0x6D, 0x61, 0x01, 0x37, 0x0C, 0x10, 0x00,
+    0x01, 0xE2, 0x43, 0x00, 0x00, 0x03, 0xB6, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x13, 0x86, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x38, 0x73, 0x00, 0x2D, 0x87, 0x04, 0x00,
+    0x00, 0x1A, 0x7D, 0x00, 0x00, 0x03, 0x84, 0x00, 0x00, 0x00, 0x00, 0x7A, 0x7F
+};
+// model registers 0x0000
+static const uint8_t rec_model[] = {
+    0x01, 0x03, 0x08, 0x01, 0x94, 0x00, 0x00, 0x00, 0xFA, 0x02, 0x58, 0xA1, 0x79
+};
+#define HOST_BENCH_NB_SEGMENT 6
+#define HOST_BENCH_TRUNCATED_LEN 30
+// every byte of the noise, the corrupted and the truncated answers is tried
+// as a frame start, each attempt ends on a bad header or CRC or a line idle
+#define HOST_BENCH_NOISY_CRC_ERROR 60
+#define HOST_BENCH_NOISY_TRUNCATED 32
+// decodes of one meter_decode operation, a single one is a few ns, below the timer noise
+#define HOST_BENCH_DECODE_BATCH 256
+
+// rec_block_a decoded
+static const t_power_data rec_block_a_data = {
+    .tension_mv = 228913,
+    .frequence_mhz = 49960,
+    .voie = {
+        { .courant_ma = 10147, .puissance_active_mw = -2206701, .energie_wh = 12345, .facteur_puissance = 950 },
+        { .courant_ma = 2280, .puissance_active_mw = 469767, .energie_wh = 678, .facteur_puissance = 900 },
+    }
+};
+static const datetime_t rec_time = { .year = 2023, .month = 6, .day = 21, .hour = 13, .min = 37, .sec = 42 };
+static const char rec_block_a_json[] = "{\"idx\":42,\"time\":\"2023-06-21T13:37:42\",\"V\":228.913,\"F\":49.960,"
+    "\"I1\":10.147,\"P1\":-2206.701,\"E1\":12345,\"fp1\":0.950,\"I2\":2.280,\"P2\":469.767,\"E2\":678,\"fp2\":0.900}\n";
+
+/*****************************************************************************/
+/*            PRIVATE TYPE                                                   */
+/*****************************************************************************/
+// byte stream as read by the UART IRQ, a segment starts after a line idle time
+typedef struct
+{
+    uint8_t bytes[MODBUS_RX_RING_SIZE];
+    uint32_t u32_len;
+    uint32_t segments[HOST_BENCH_NB_SEGMENT];
+    uint32_t u32_nb_segment;
+}t_host_stream;
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static t_host_stream stream_clean;
+static t_host_stream stream_noisy;
+static t_mb_ctx bench_ctx;
+static uint32_t u32_rx_frames;
+static uint8_t bench_frame_a[sizeof(rec_block_a)];
+static char bench_json[DATA_JSON_MAX_LEN];
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+static void host_stream_add(t_host_stream* p_stream, const uint8_t* p_bytes, uint32_t u32_len) {
+    p_stream->segments[p_stream->u32_nb_segment++] = p_stream->u32_len;
+    memcpy(&p_stream->bytes[p_stream->u32_len], p_bytes, u32_len);
+    p_stream->u32_len += u32_len;
+}
+
+static void host_rx_cb(uint8_t* pbuf, uint8_t size) {
+    u32_rx_frames++;
+    host_bench_sink += pbuf[size - 1];
+}
+
+// whole stream in the ring, line idle since long
+static void host_rx_parse(const t_host_stream* p_stream) {
+    bench_ctx.state = MODBUS_WAIT_SOF;
+    bench_ctx.u8_frame_size = 0;
+    bench_ctx.u32_rx_tail = 0;
+    bench_ctx.u32_rx_pos = 0;
+    bench_ctx.u32_rx_head = p_stream->u32_len;
+    memcpy(bench_ctx.rx_boundary, p_stream->segments, sizeof(p_stream->segments));
+    bench_ctx.u32_boundary_tail = 0;
+    bench_ctx.u32_boundary_head = p_stream->u32_nb_segment;
+    bench_ctx.u32_rx_time_us = time_us_32() - 1000000;
+    memcpy(bench_ctx.rx_ring, p_stream->bytes, p_stream->u32_len);
+    modbus_rx_loop(&bench_ctx);
+}
+
+void host_bench_modbus_init(void) {
+    modbus_crc_init();
+    data_init();
+    memcpy(bench_frame_a, rec_block_a, sizeof(rec_block_a));
+
+    memset(&bench_ctx, 0, sizeof(bench_ctx));
+    bench_ctx.rx_cb = host_rx_cb;
+    bench_ctx.u32_idle_us = (MODBUS_IDLE_CHARS * 10 * 1000000) / 4800;
+
+    // answers as polled
+    memset(&stream_clean, 0, sizeof(stream_clean));
+    host_stream_add(&stream_clean, rec_model, sizeof(rec_model));
+    host_stream_add(&stream_clean, rec_block_a, sizeof(rec_block_a));
+    host_stream_add(&stream_clean, rec_block_b, sizeof(rec_block_b));
+
+    // line noise, a corrupted answer and a truncated one before good answers
+    static const uint8_t noise[] = { 0x55 };
+    uint8_t corrupted[sizeof(rec_block_a)];
+    memcpy(corrupted, rec_block_a, sizeof(corrupted));
+    corrupted[20] ^= 0x10;
+    memset(&stream_noisy, 0, sizeof(stream_noisy));
+    host_stream_add(&stream_noisy, noise, sizeof(noise));
+    host_stream_add(&stream_noisy, corrupted, sizeof(corrupted));
+    host_stream_add(&stream_noisy, rec_block_b, HOST_BENCH_TRUNCATED_LEN);
+    host_stream_add(&stream_noisy, rec_model, sizeof(rec_model));
+    host_stream_add(&stream_noisy, rec_block_a, sizeof(rec_block_a));
+    host_stream_add(&stream_noisy, rec_block_b, sizeof(rec_block_b));
+}
+
+static void bench_crc_table8(uint32_t u32_nb_op) {
+    for(uint32_t i=0; i<u32_nb_op; i++) {
+        host_bench_sink += modbus_crc16_update_table8(MODBUS_CRC_INIT, bench_frame_a, sizeof(bench_frame_a));
+    }
+}
+
+static void bench_crc_slice4(uint32_t u32_nb_op) {
+    for(uint32_t i=0; i<u32_nb_op; i++) {
+        host_bench_sink += modbus_crc16_update_slice4(MODBUS_CRC_INIT, bench_frame_a, sizeof(bench_frame_a));
+    }
+}
+
+// a valid frame has a CRC of 0 over its data and CRC
+static bool check_crc(void) {
+    return (modbus_crc16_update_table8(MODBUS_CRC_INIT, rec_block_a, sizeof(rec_block_a)) == 0)
+        && (modbus_crc16_update_slice4(MODBUS_CRC_INIT, rec_block_a, sizeof(rec_block_a)) == 0)
+        && (modbus_crc16_update_slice4(MODBUS_CRC_INIT, rec_block_a, 20) == modbus_crc16_update_table8(MODBUS_CRC_INIT, rec_block_a, 20));
+}
+
+// fields from tension_mv on, index, time and latency stamps set by the caller
+static bool check_power_data(const t_power_data* p_data, const t_power_data* p_expected) {
+    return (p_data->tension_mv == p_expected->tension_mv) && (p_data->frequence_mhz == p_expected->frequence_mhz)
+        && (memcmp(p_data->voie, p_expected->voie, sizeof(p_data->voie)) == 0);
+}
+
+// register map decoding, replaces the former bytes_to_uint32() calls
+static void bench_decode(uint32_t u32_nb_op) {
+    t_power_data data;
+    for(uint32_t i=0; i<u32_nb_op; i++) {
+        for(uint32_t j=0; j<HOST_BENCH_DECODE_BATCH; j++) {
+            bench_frame_a[27] = (uint8_t)(j & 1);
+            meter_jsy_mk194.decode(&bench_frame_a[3], &data);
+            host_bench_sink += data.voie[0].puissance_active_mw;
+        }
+    }
+    bench_frame_a[27] = rec_block_a[27];
+}
+
+static bool check_decode(void) {
+    t_power_data data;
+    memset(&data, 0, sizeof(data));
+    meter_jsy_mk194.decode(&rec_block_a[3], &data);
+    return check_power_data(&data, &rec_block_a_data);
+}
+
+static void bench_rx_clean(uint32_t u32_nb_op) {
+    for(uint32_t i=0; i<u32_nb_op; i++) {
+        host_rx_parse(&stream_clean);
+    }
+}
+
+static void bench_rx_noisy(uint32_t u32_nb_op) {
+    for(uint32_t i=0; i<u32_nb_op; i++) {
+        host_rx_parse(&stream_noisy);
+    }
+}
+
+static void host_rx_counts_reset(void) {
+    u32_rx_frames = 0;
+    bench_ctx.u32_rx_crc_error = 0;
+    bench_ctx.u32_rx_truncated = 0;
+    bench_ctx.u32_rx_skipped = 0;
+}
+
+// every answer found, noise and damaged answers counted
+static bool check_rx(void) {
+    host_rx_counts_reset();
+    host_rx_parse(&stream_clean);
+    bool b_clean = (u32_rx_frames == 3) && (bench_ctx.u32_rx_crc_error == 0)
+        && (bench_ctx.u32_rx_truncated == 0) && (bench_ctx.u32_rx_skipped == 0)
+        && (memcmp(bench_ctx.mb_frame, rec_block_b, sizeof(rec_block_b)) == 0);
+
+    host_rx_counts_reset();
+    host_rx_parse(&stream_noisy);
+    bool b_noisy = (u32_rx_frames == 3) && (bench_ctx.u32_rx_crc_error == HOST_BENCH_NOISY_CRC_ERROR)
+        && (bench_ctx.u32_rx_truncated == HOST_BENCH_NOISY_TRUNCATED)
+        && (bench_ctx.u32_rx_skipped == (1 + sizeof(rec_block_a) + HOST_BENCH_TRUNCATED_LEN))
+        && (memcmp(bench_ctx.mb_frame, rec_block_b, sizeof(rec_block_b)) == 0);
+    if( !b_clean || !b_noisy ) {
+        printf("noisy rx frames %u crc %u truncated %u skipped %u\n", u32_rx_frames, bench_ctx.u32_rx_crc_error,
+                bench_ctx.u32_rx_truncated, bench_ctx.u32_rx_skipped);
+    }
+    return b_clean && b_noisy;
+}
+
+// answer of the main meter to the outstanding request, decoded in its queue
+static void host_rx_cb_one(void) {
+    p_wait_slave = &mb_slaves[0];
+    modbus_client_rx_cb(bench_frame_a, sizeof(bench_frame_a));
+}
+
+static void bench_rx_cb(uint32_t u32_nb_op) {
+    t_power_data data;
+    for(uint32_t i=0; i<u32_nb_op; i++) {
+        host_rx_cb_one();
+        modbus_pop_power_data(&data);
+        host_bench_sink += data.voie[0].puissance_active_mw;
+    }
+}
+
+static bool check_rx_cb(void) {
+    t_power_data data;
+    while( modbus_pop_power_data(&data) ) {
+    }
+    host_rx_cb_one();
+    return modbus_pop_power_data(&data) && (p_wait_slave == NULL) && check_power_data(&data, &rec_block_a_data);
+}
+
+static void bench_json_line(uint32_t u32_nb_op) {
+    t_power_data data = rec_block_a_data;
+    data.u32_index = 42;
+    for(uint32_t i=0; i<u32_nb_op; i++) {
+        host_bench_sink += data_format_json(bench_json, &data, &rec_time);
+    }
+}
+
+static bool check_json_line(void) {
+    t_power_data data = rec_block_a_data;
+    data.u32_index = 42;
+    uint32_t u32_len = data_format_json(bench_json, &data, &rec_time);
+    if( (u32_len != strlen(rec_block_a_json)) || (strcmp(bench_json, rec_block_a_json) != 0) ) {
+        printf("json %s", bench_json);
+        return false;
+    }
+    return true;
+}
+
+static const t_host_bench host_bench_modbus_list[] = {
+    { "crc16_table8", bench_crc_table8, check_crc },
+    { "crc16_slice4", bench_crc_slice4, check_crc },
+    { "meter_decode", bench_decode, check_decode },
+    { "rx_loop_clean", bench_rx_clean, check_rx },
+    { "rx_loop_noisy", bench_rx_noisy, check_rx },
+    { "client_rx_cb", bench_rx_cb, check_rx_cb },
+    { "json_line", bench_json_line, check_json_line },
+};
+
+const t_host_bench* host_bench_modbus(uint32_t* p_nb_bench) {
+    *p_nb_bench = count_of(host_bench_modbus_list);
+    return host_bench_modbus_list;
+}
@@ -0,0 +1,7 @@
+/* Host stand-in for pico-sdk hardware/clocks.h, only what the firmware uses */
+#ifndef HOST_HARDWARE_CLOCKS_H__
+#define HOST_HARDWARE_CLOCKS_H__
+#include "pico.h"
+enum clock_index { clk_gpout0 = 0, clk_ref = 4, clk_sys = 5, clk_peri = 6 };
+uint32_t clock_get_hz(enum clock_index clk_index);
+#endif
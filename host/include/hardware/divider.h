@@ -0,0 +1,11 @@
+/* Host stand-in for pico-sdk hardware/divider.h, only what the firmware uses */
+#ifndef HOST_HARDWARE_DIVIDER_H__
+#define HOST_HARDWARE_DIVIDER_H__
+#include "pico.h"
+typedef uint64_t divmod_result_t;
+static inline divmod_result_t hw_divider_divmod_u32(uint32_t a, uint32_t b) {
+    return ((uint64_t)(a % b) << 32) | (a / b);
+}
+static inline uint32_t to_quotient_u32(divmod_result_t r) { return (uint32_t)r; }
+static inline uint32_t to_remainder_u32(divmod_result_t r) { return (uint32_t)(r >> 32); }
+#endif
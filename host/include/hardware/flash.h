@@ -0,0 +1,15 @@
+/* Host stand-in for pico-sdk hardware/flash.h, only what the firmware uses */
+#ifndef HOST_HARDWARE_FLASH_H__
+#define HOST_HARDWARE_FLASH_H__
+#include "pico.h"
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#endif
+// flash content is a host array, kept in the file given by PM_FLASH
+extern uint8_t host_flash[PICO_FLASH_SIZE_BYTES];
+#define XIP_BASE ((uintptr_t)host_flash)
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+#endif
@@ -0,0 +1,13 @@
+/* Host stand-in for pico-sdk hardware/gpio.h, only what the firmware uses */
+#ifndef HOST_HARDWARE_GPIO_H__
+#define HOST_HARDWARE_GPIO_H__
+#include "pico.h"
+#define GPIO_OUT 1
+#define GPIO_IN 0
+enum gpio_function { GPIO_FUNC_UART, GPIO_FUNC_I2C, GPIO_FUNC_PIO0, GPIO_FUNC_SIO };
+void gpio_init(unsigned int gpio);
+void gpio_set_dir(unsigned int gpio, bool out);
+void gpio_put(unsigned int gpio, bool value);
+void gpio_set_function(unsigned int gpio, enum gpio_function fn);
+void gpio_pull_up(unsigned int gpio);
+#endif
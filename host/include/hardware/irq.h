@@ -0,0 +1,18 @@
+/* Host stand-in for pico-sdk hardware/irq.h, only what the firmware uses */
+#ifndef HOST_HARDWARE_IRQ_H__
+#define HOST_HARDWARE_IRQ_H__
+#include "pico.h"
+typedef void (*irq_handler_t)(void);
+#define UART0_IRQ 20
+#define UART1_IRQ 21
+#define DMA_IRQ_0 11
+#define DMA_IRQ_1 12
+#define PIO0_IRQ_0 7
+#define TIMER_IRQ_0 0
+void irq_set_exclusive_handler(unsigned int num, irq_handler_t handler);
+void irq_set_enabled(unsigned int num, bool enabled);
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+void irq_add_shared_handler(unsigned int num, irq_handler_t handler, uint8_t order_priority);
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+#endif
@@ -0,0 +1,48 @@
+/* Host stand-in for pico-sdk hardware/pio.h, only what the firmware uses.
+   Programs are not executed, hal_host.c runs a timing model of each one,
+   selected by the host_program field the generated header stand-in sets. */
+#ifndef HOST_HARDWARE_PIO_H__
+#define HOST_HARDWARE_PIO_H__
+#include "pico.h"
+#include "hardware/gpio.h"
+typedef struct pio_inst *PIO;
+extern PIO pio0;
+extern PIO pio1;
+typedef struct pio_program {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+enum pio_fifo_join {
+    PIO_FIFO_JOIN_NONE = 0,
+    PIO_FIFO_JOIN_TX = 1,
+    PIO_FIFO_JOIN_RX = 2,
+};
+typedef struct {
+    float clkdiv;
+    uint jmp_pin;
+    uint sideset_base;
+    enum pio_fifo_join fifo_join;
+    int host_program;
+} pio_sm_config;
+static inline pio_sm_config pio_get_default_sm_config(void) {
+    pio_sm_config c = { .clkdiv = 1.0f };
+    return c;
+}
+static inline void sm_config_set_jmp_pin(pio_sm_config *c, uint pin) { c->jmp_pin = pin; }
+static inline void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base) { c->sideset_base = sideset_base; }
+static inline void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs) {}
+static inline void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap) {}
+static inline void sm_config_set_clkdiv(pio_sm_config *c, float div) { c->clkdiv = div; }
+static inline void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join) { c->fifo_join = join; }
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_sm_claim(PIO pio, uint sm);
+void pio_gpio_init(PIO pio, uint pin);
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+uint32_t pio_sm_get(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm);
+#endif
@@ -0,0 +1,9 @@
+/* Host stand-in for pico-sdk hardware/rtc.h, only what the firmware uses */
+#ifndef HOST_HARDWARE_RTC_H__
+#define HOST_HARDWARE_RTC_H__
+#include "pico.h"
+#include "pico/util/datetime.h"
+void rtc_init(void);
+bool rtc_set_datetime(datetime_t *t);
+bool rtc_get_datetime(datetime_t *t);
+#endif
@@ -0,0 +1,11 @@
+/* Host stand-in for pico-sdk hardware/sync.h, only what the firmware uses */
+#ifndef HOST_HARDWARE_SYNC_H__
+#define HOST_HARDWARE_SYNC_H__
+#include "pico.h"
+static inline void __dmb(void) { __sync_synchronize(); }
+// per core event register, see hal_host.c
+void __wfe(void);
+void __sev(void);
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+#endif
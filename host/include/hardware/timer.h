@@ -0,0 +1,10 @@
+/* Host stand-in for pico-sdk hardware/timer.h, only what the firmware uses */
+#ifndef HOST_HARDWARE_TIMER_H__
+#define HOST_HARDWARE_TIMER_H__
+#include "pico.h"
+#include "pico/time.h"
+typedef void (*hardware_alarm_callback_t)(uint alarm_num);
+void hardware_alarm_claim(uint alarm_num);
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback);
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t);
+#endif
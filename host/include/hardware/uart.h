@@ -0,0 +1,20 @@
+/* Host stand-in for pico-sdk hardware/uart.h, only what the firmware uses */
+#ifndef HOST_HARDWARE_UART_H__
+#define HOST_HARDWARE_UART_H__
+#include "pico.h"
+typedef struct uart_inst uart_inst_t;
+extern uart_inst_t *uart0;
+extern uart_inst_t *uart1;
+unsigned int uart_init(uart_inst_t *uart, unsigned int baudrate);
+unsigned int uart_set_baudrate(uart_inst_t *uart, unsigned int baudrate);
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts);
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled);
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data);
+bool uart_is_readable(uart_inst_t *uart);
+char uart_getc(uart_inst_t *uart);
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len);
+bool uart_is_writable(uart_inst_t *uart);
+void uart_putc_raw(uart_inst_t *uart, char c);
+void uart_tx_wait_blocking(uart_inst_t *uart);
+static inline unsigned int uart_get_index(uart_inst_t *uart) { return uart == uart1 ? 1 : 0; }
+#endif
@@ -0,0 +1,6 @@
+/* Host stand-in for pico-sdk hardware/watchdog.h, only what the firmware uses */
+#ifndef HOST_HARDWARE_WATCHDOG_H__
+#define HOST_HARDWARE_WATCHDOG_H__
+#include "pico.h"
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+#endif
@@ -0,0 +1,36 @@
+/*
+GPIO outputs of the host firmware, shared with the simulators through the
+file given by PM_GPIO (mapped by both processes). Times are CLOCK_MONOTONIC
+in us, so a simulator can integrate how long an output was high.
+*/
+#ifndef HOST_GPIO_H__
+#define HOST_GPIO_H__
+#include <stdint.h>
+
+#define HOST_GPIO_NB 30
+
+typedef struct
+{
+    volatile uint32_t u32_seq;  // odd while the writer updates the entry
+    volatile uint32_t u32_level;
+    volatile uint64_t u64_change_us; // last level change
+    volatile uint64_t u64_high_us;   // total time high before the last change
+}t_host_gpio;
+
+// total time high up to u64_now_us, consistent snapshot of a writer in another process
+static inline uint64_t host_gpio_high_us(const t_host_gpio* p_gpio, uint64_t u64_now_us) {
+    uint32_t u32_seq;
+    uint64_t u64_high_us;
+    do {
+        u32_seq = p_gpio->u32_seq;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        u64_high_us = p_gpio->u64_high_us;
+        if( p_gpio->u32_level && (u64_now_us > p_gpio->u64_change_us) ) {
+            u64_high_us += u64_now_us - p_gpio->u64_change_us;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while( (u32_seq & 1) || (u32_seq != p_gpio->u32_seq) );
+    return u64_high_us;
+}
+
+#endif // HOST_GPIO_H__
@@ -0,0 +1,15 @@
+/* Host stand-in for pico-sdk pico.h, only what the firmware uses */
+#ifndef HOST_PICO_H__
+#define HOST_PICO_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+typedef unsigned int uint;
+#define _u(x) x ## u
+#define count_of(a) (sizeof(a)/sizeof((a)[0]))
+#define __not_in_flash_func(f) f
+#define __time_critical_func(f) f
+#define __compiler_memory_barrier() __asm__ volatile ("" ::: "memory")
+static inline void tight_loop_contents(void) {}
+#define PICO_ERROR_TIMEOUT -1
+#endif
@@ -0,0 +1,4 @@
+/* Host stand-in for pico-sdk pico/binary_info.h, only what the firmware uses */
+#ifndef HOST_PICO_BINARY_INFO_H__
+#define HOST_PICO_BINARY_INFO_H__
+#endif
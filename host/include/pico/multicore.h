@@ -0,0 +1,9 @@
+/* Host stand-in for pico-sdk pico/multicore.h, only what the firmware uses */
+#ifndef HOST_PICO_MULTICORE_H__
+#define HOST_PICO_MULTICORE_H__
+#include "pico.h"
+void multicore_launch_core1(void (*entry)(void));
+void multicore_lockout_victim_init(void);
+void multicore_lockout_start_blocking(void);
+void multicore_lockout_end_blocking(void);
+#endif
@@ -0,0 +1,9 @@
+/* Host stand-in for pico-sdk pico/stdio.h, only what the firmware uses */
+#ifndef HOST_PICO_STDIO_H__
+#define HOST_PICO_STDIO_H__
+#include "pico.h"
+bool stdio_init_all(void);
+bool stdio_usb_connected(void);
+int getchar_timeout_us(uint32_t timeout_us);
+void stdio_set_chars_available_callback(void (*fn)(void*), void *param);
+#endif
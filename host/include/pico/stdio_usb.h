@@ -0,0 +1,8 @@
+/* Host stand-in for pico-sdk pico/stdio_usb.h, only what the firmware uses */
+#ifndef HOST_PICO_STDIO_USB_H__
+#define HOST_PICO_STDIO_USB_H__
+#include "pico.h"
+typedef struct stdio_driver stdio_driver_t;
+extern stdio_driver_t stdio_usb;
+void stdio_set_translate_crlf(stdio_driver_t *driver, bool translate);
+#endif
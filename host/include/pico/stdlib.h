@@ -0,0 +1,14 @@
+/* Host stand-in for pico-sdk pico/stdlib.h, only what the firmware uses */
+#ifndef HOST_PICO_STDLIB_H__
+#define HOST_PICO_STDLIB_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <assert.h>
+#include "pico.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+#include "hardware/uart.h"
+#include "hardware/irq.h"
+#include "pico/stdio.h"
+#endif
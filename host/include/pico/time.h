@@ -0,0 +1,15 @@
+/* Host stand-in for pico-sdk pico/time.h, only what the firmware uses */
+#ifndef HOST_PICO_TIME_H__
+#define HOST_PICO_TIME_H__
+#include "pico.h"
+typedef uint64_t absolute_time_t;
+absolute_time_t get_absolute_time(void);
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to);
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+static inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) { return t + us; }
+#endif
@@ -0,0 +1,15 @@
+/* Host stand-in for pico-sdk pico/util/datetime.h, only what the firmware uses */
+#ifndef HOST_PICO_UTIL_DATETIME_H__
+#define HOST_PICO_UTIL_DATETIME_H__
+#include "pico.h"
+typedef struct {
+    int16_t year;
+    int8_t month;
+    int8_t day;
+    int8_t dotw;
+    int8_t hour;
+    int8_t min;
+    int8_t sec;
+} datetime_t;
+void datetime_to_str(char *buf, unsigned int buf_size, const datetime_t *t);
+#endif
@@ -0,0 +1,31 @@
+/* Host stand-in for the header pioasm generates from src/triac.pio, keep the
+   public defines in sync. hal_host.c models the timing of both programs. */
+#ifndef HOST_TRIAC_PIO_H__
+#define HOST_TRIAC_PIO_H__
+#include "hardware/pio.h"
+
+enum host_pio_program {
+    HOST_PIO_NONE = 0,
+    HOST_PIO_TRIAC_ZERO_CROSS,
+    HOST_PIO_TRIAC_FIRE
+};
+
+#define triac_zero_cross_OVERHEAD_CYCLES 7
+#define triac_fire_OVERHEAD_CYCLES 10
+
+static const struct pio_program triac_zero_cross_program = { .instructions = NULL, .length = 8, .origin = -1 };
+static const struct pio_program triac_fire_program = { .instructions = NULL, .length = 10, .origin = -1 };
+
+static inline pio_sm_config triac_zero_cross_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    c.host_program = HOST_PIO_TRIAC_ZERO_CROSS;
+    return c;
+}
+
+static inline pio_sm_config triac_fire_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_sideset(&c, 2, true, false);
+    c.host_program = HOST_PIO_TRIAC_FIRE;
+    return c;
+}
+#endif
@@ -0,0 +1,403 @@
+/*
+JSY-MK-194 (2 channels) simulator answering on a pseudo terminal.
+
+    jsy_sim [-a address]... [-b baudrate] [-g gpio file] [-l link] [-n percent] [-p pin] [-L load W] [-v]
+
+Simulates one meter per -a option (default address 0x01) sharing the bus.
+Creates a pty, prints the slave device path and, with -l, makes a symlink
+to it so the host firmware can be started with PM_UART0=<link>.
+
+Answers function 0x03 on :
+- 0x0000 (4 registers) : model, reserved, voltage range, current range
+- 0x0004 (1 register) : address and baudrate code
+- 0x0048 (14 registers) : measures, with the layout decoded by modbus.c
+
+and function 0x10 on 0x0004 to change the baudrate (4800, 9600 or 19200,
+default 4800). The write is acknowledged at the old speed, then requests
+are only answered when the firmware set the pty to the new speed, like a
+real line where the meter would see garbage.
+
+With -n, the given percentage of answers is damaged like on a noisy line :
+a garbage byte sent just before the frame, one byte flipped, or the frame
+cut before its end.
+
+With -g, the first meter measures a house with solar panels instead :
+channel 1 is the grid (house + diverted load - PV, negative when
+exporting) and channel 2 the diverted load. The load is on while the SSR
+output of the host firmware (-p pin, default 2, levels shared through
+the PM_GPIO file) is high, and the meter reports its average power since
+the previous measure, like the real meter.
+
+Answers are delayed by the time the request and the response take on the
+wire at the baudrate the firmware set on the pty, plus a turnaround time.
+Measures follow slow sine waves so values change on every sample, and the
+power of channel 1 is negative (export) part of the time.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "modbus_crc.h"
+#include "host_gpio.h"
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+#define SIM_FRAME_SIZE 256
+// time for the meter to process a request
+#define SIM_TURNAROUND_US 2000
+// silence after which a partial request is dropped
+#define SIM_FRAME_TIMEOUT_US 20000
+#define SIM_MAX_METER 4
+
+/*****************************************************************************/
+/*            PRIVATE TYPE                                                   */
+/*****************************************************************************/
+typedef struct
+{
+    uint8_t u8_address;
+    double energy_wh[2];
+    uint64_t u64_last_measure_us;
+    uint64_t u64_last_high_us; // SSR high time at last measure
+}t_sim_meter;
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static t_sim_meter meters[SIM_MAX_METER];
+static uint32_t u32_nb_meter = 0;
+static unsigned int sim_line_baudrate = 4800;
+static bool b_verbose = false;
+static unsigned int u32_noise_percent = 0;
+static uint32_t u32_nb_request = 0;
+static const t_host_gpio *p_ssr_gpio = NULL;
+static double sim_load_w = 2000.0;
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+static uint64_t sim_time_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000u + now.tv_nsec / 1000;
+}
+
+static unsigned int sim_baudrate(int fd) {
+    struct termios tio;
+    if( tcgetattr(fd, &tio) != 0 ) {
+        return 9600;
+    }
+    switch( cfgetospeed(&tio) ) {
+        case B1200: return 1200;
+        case B2400: return 2400;
+        case B4800: return 4800;
+        case B9600: return 9600;
+        case B19200: return 19200;
+        case B38400: return 38400;
+        case B57600: return 57600;
+        default: return 115200;
+    }
+}
+
+// register 0x0004 baudrate code, 0 if not supported
+static uint8_t sim_baud_code(unsigned int baudrate) {
+    switch( baudrate ) {
+        case 4800: return 5;
+        case 9600: return 6;
+        case 19200: return 7;
+        default: return 0;
+    }
+}
+
+static void put_u16(uint8_t *p, uint16_t val) {
+    p[0] = (uint8_t)(val >> 8);
+    p[1] = (uint8_t)val;
+}
+
+static void put_u32(uint8_t *p, uint32_t val) {
+    p[0] = (uint8_t)(val >> 24);
+    p[1] = (uint8_t)(val >> 16);
+    p[2] = (uint8_t)(val >> 8);
+    p[3] = (uint8_t)val;
+}
+
+// fill the 0x0048 block, see modbus_client_rx_cb() for the layout
+static void sim_measures(t_sim_meter *p_meter, uint8_t *p_data) {
+    uint64_t u64_now = sim_time_us();
+    // each meter sees a different load
+    double t = u64_now / 1e6 + p_meter->u8_address * 10.0;
+    double dt_h = p_meter->u64_last_measure_us ? (u64_now - p_meter->u64_last_measure_us) / 3600e6 : 0;
+    p_meter->u64_last_measure_us = u64_now;
+
+    double tension_v = 230.0 + 3.0 * sin(t / 10.0);
+    double courant_a[2] = { 6.0 + 5.0 * sin(t / 7.0), 2.0 + 1.5 * sin(t / 3.0) };
+    double pf[2] = { 0.95, 0.90 };
+    // channel 1 is the grid : export when PV production is high
+    double sign[2] = { (sin(t / 30.0) < -0.3) ? -1.0 : 1.0, 1.0 };
+
+    if( (p_ssr_gpio != NULL) && (p_meter == &meters[0]) ) {
+        // house with PV and diverted load, average load since previous measure
+        uint64_t u64_high_us = host_gpio_high_us(p_ssr_gpio, u64_now);
+        double on = (dt_h > 0) ? (u64_high_us - p_meter->u64_last_high_us) / (dt_h * 3600e6) : 0;
+        p_meter->u64_last_high_us = u64_high_us;
+        double pv_w = 1500.0 + 1500.0 * sin(t / 40.0);
+        double house_w = 500.0 + 200.0 * sin(t / 7.0);
+        double load_w = sim_load_w * ((on > 1.0) ? 1.0 : on);
+        double grid_w = house_w + load_w - pv_w;
+        pf[0] = 1.0;
+        pf[1] = 1.0;
+        sign[0] = (grid_w < 0) ? -1.0 : 1.0;
+        courant_a[0] = fabs(grid_w) / tension_v;
+        courant_a[1] = load_w / tension_v;
+    }
+
+    memset(p_data, 0, 56);
+    put_u32(&p_data[0], (uint32_t)(tension_v * 10000));
+    for(int i=0; i<2; i++) {
+        double puissance_w = tension_v * courant_a[i] * pf[i];
+        p_meter->energy_wh[i] += puissance_w * dt_h;
+        uint8_t *p_voie = &p_data[(i == 0) ? 4 : 36];
+        put_u32(&p_voie[0], (uint32_t)(courant_a[i] * 10000));
+        put_u32(&p_voie[4], (uint32_t)(puissance_w * 10000));
+        put_u32(&p_voie[8], (uint32_t)(p_meter->energy_wh[i] * 10));
+        put_u32(&p_voie[12], (uint32_t)(pf[i] * 1000));
+        p_data[24 + i] = (sign[i] < 0) ? 1 : 0;
+    }
+    put_u32(&p_data[28], (uint32_t)((50.0 + 0.05 * sin(t / 5.0)) * 100));
+}
+
+static void sim_answer(int fd, uint8_t *p_resp, uint32_t u32_len, uint32_t u32_req_len) {
+    uint16_t crc = modbus_crc16(p_resp, u32_len);
+    p_resp[u32_len++] = (uint8_t)(crc >> 8);
+    p_resp[u32_len++] = (uint8_t)crc;
+
+    // wire time of request and response at current baudrate
+    unsigned int baudrate = sim_baudrate(fd);
+    uint64_t u64_wire_us = (uint64_t)(u32_req_len + u32_len) * 10 * 1000000u / baudrate;
+    usleep(SIM_TURNAROUND_US + u64_wire_us);
+
+    uint8_t frame[SIM_FRAME_SIZE + 1];
+    uint8_t *p_frame = frame;
+    memcpy(&frame[1], p_resp, u32_len);
+    p_frame++;
+    if( (unsigned int)(rand() % 100) < u32_noise_percent ) {
+        switch( rand() % 3 ) {
+            case 0:
+                p_frame--;
+                p_frame[0] = (uint8_t)rand();
+                u32_len++;
+                break;
+            case 1:
+                p_frame[rand() % u32_len] ^= (uint8_t)(1 + rand() % 255);
+                break;
+            default:
+                u32_len = 1 + rand() % (u32_len - 1);
+                break;
+        }
+    }
+
+    if( write(fd, p_frame, u32_len) != (ssize_t)u32_len ) {
+        perror("jsy_sim: write");
+    }
+}
+
+static void sim_request(int fd, t_sim_meter *p_meter, uint8_t *p_req, uint32_t u32_len) {
+    uint8_t resp[SIM_FRAME_SIZE];
+    uint16_t u16_reg = (p_req[2] << 8) | p_req[3];
+    uint16_t u16_nb = (p_req[4] << 8) | p_req[5];
+
+    u32_nb_request++;
+    resp[0] = p_meter->u8_address;
+    resp[1] = p_req[1];
+    if( (p_req[1] == 0x03) && (u16_reg == 0x0048) && (u16_nb == 0x000E) ) {
+        resp[2] = 56;
+        sim_measures(p_meter, &resp[3]);
+        sim_answer(fd, resp, 3 + 56, u32_len);
+    } else if( (p_req[1] == 0x03) && (u16_reg == 0x0000) && (u16_nb == 4) ) {
+        resp[2] = 8;
+        put_u16(&resp[3], 0x0194);
+        put_u16(&resp[5], 0x0000);
+        put_u16(&resp[7], 250);
+        put_u16(&resp[9], 600);
+        sim_answer(fd, resp, 3 + 8, u32_len);
+    } else if( (p_req[1] == 0x03) && (u16_reg == 0x0004) && (u16_nb == 1) ) {
+        resp[2] = 2;
+        resp[3] = p_meter->u8_address;
+        resp[4] = sim_baud_code(sim_line_baudrate);
+        sim_answer(fd, resp, 3 + 2, u32_len);
+    } else if( (p_req[1] == 0x10) && (u16_reg == 0x0004) && (u16_nb == 1) ) {
+        static const unsigned int baudrates[] = { 4800, 9600, 19200 };
+        uint8_t u8_code = p_req[8];
+        if( (u8_code < 5) || (u8_code > 7) ) {
+            // illegal data value
+            resp[1] |= 0x80;
+            resp[2] = 0x03;
+            sim_answer(fd, resp, 3, u32_len);
+            return;
+        }
+        // acknowledge at current speed then switch
+        memcpy(&resp[2], &p_req[2], 4);
+        sim_answer(fd, resp, 6, u32_len);
+        sim_line_baudrate = baudrates[u8_code - 5];
+        if( b_verbose ) {
+            fprintf(stderr, "jsy_sim: baudrate %u\n", sim_line_baudrate);
+        }
+    } else {
+        // illegal data address
+        resp[1] |= 0x80;
+        resp[2] = 0x02;
+        sim_answer(fd, resp, 3, u32_len);
+    }
+}
+
+// length of the request starting at p_req, 0 if not known yet
+static uint32_t sim_request_len(uint8_t *p_req, uint32_t u32_len) {
+    if( u32_len < 2 ) {
+        return 0;
+    }
+    switch( p_req[1] ) {
+        case 0x03:
+            return 8;
+        case 0x10:
+            return (u32_len < 7) ? 0 : 9 + p_req[6];
+        default:
+            // unsupported function, resync on next byte
+            return 1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *p_link = NULL;
+    const char *p_gpio_file = NULL;
+    unsigned int u32_ssr_pin = 2;
+    int opt;
+    while( (opt = getopt(argc, argv, "a:b:g:l:n:p:L:v")) != -1 ) {
+        switch( opt ) {
+            case 'a':
+                if( u32_nb_meter < SIM_MAX_METER ) {
+                    meters[u32_nb_meter++].u8_address = (uint8_t)strtoul(optarg, NULL, 0);
+                }
+                break;
+            case 'b': sim_line_baudrate = (unsigned int)strtoul(optarg, NULL, 0); break;
+            case 'g': p_gpio_file = optarg; break;
+            case 'l': p_link = optarg; break;
+            case 'n': u32_noise_percent = (unsigned int)strtoul(optarg, NULL, 0); break;
+            case 'p': u32_ssr_pin = (unsigned int)strtoul(optarg, NULL, 0) % HOST_GPIO_NB; break;
+            case 'L': sim_load_w = strtod(optarg, NULL); break;
+            case 'v': b_verbose = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-a address]... [-b baudrate] [-g gpio file] [-l link] [-n percent] [-p pin] [-L load W] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if( u32_nb_meter == 0 ) {
+        meters[u32_nb_meter++].u8_address = 0x01;
+    }
+    for(uint32_t i=0; i<u32_nb_meter; i++) {
+        meters[i].energy_wh[0] = 12345.0;
+        meters[i].energy_wh[1] = 678.0;
+    }
+
+    if( p_gpio_file != NULL ) {
+        // same file as PM_GPIO of the host firmware, whichever starts first creates it
+        int gpio_fd = open(p_gpio_file, O_RDWR | O_CREAT, 0644);
+        void *p_map = MAP_FAILED;
+        if( (gpio_fd >= 0) && (ftruncate(gpio_fd, HOST_GPIO_NB * sizeof(t_host_gpio)) == 0) ) {
+            p_map = mmap(NULL, HOST_GPIO_NB * sizeof(t_host_gpio), PROT_READ, MAP_SHARED, gpio_fd, 0);
+        }
+        if( p_map == MAP_FAILED ) {
+            perror("jsy_sim: gpio file");
+            return 1;
+        }
+        p_ssr_gpio = &((const t_host_gpio *)p_map)[u32_ssr_pin];
+        close(gpio_fd);
+    }
+
+    modbus_crc_init();
+
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if( (fd < 0) || (grantpt(fd) != 0) || (unlockpt(fd) != 0) ) {
+        perror("jsy_sim: pty");
+        return 1;
+    }
+    struct termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+
+    const char *p_slave = ptsname(fd);
+    // keep slave side open so reads don't fail before the firmware opens it
+    int slave_fd = open(p_slave, O_RDWR | O_NOCTTY);
+    if( p_link != NULL ) {
+        unlink(p_link);
+        if( symlink(p_slave, p_link) != 0 ) {
+            perror("jsy_sim: symlink");
+            return 1;
+        }
+    }
+    printf("%s\n", p_slave);
+    fflush(stdout);
+
+    uint8_t frame[SIM_FRAME_SIZE];
+    uint32_t u32_frame_len = 0;
+    uint64_t u64_last_rx_us = 0;
+    while( true ) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if( poll(&pfd, 1, 10) <= 0 ) {
+            if( (u32_frame_len > 0) && (sim_time_us() - u64_last_rx_us > SIM_FRAME_TIMEOUT_US) ) {
+                u32_frame_len = 0;
+            }
+            continue;
+        }
+        ssize_t len = read(fd, &frame[u32_frame_len], sizeof(frame) - u32_frame_len);
+        if( len <= 0 ) {
+            continue;
+        }
+        u32_frame_len += len;
+        u64_last_rx_us = sim_time_us();
+
+        // process complete requests
+        uint32_t u32_req_len;
+        while( (u32_req_len = sim_request_len(frame, u32_frame_len)) != 0 && (u32_req_len <= u32_frame_len) ) {
+            bool b_valid = (u32_req_len >= 4) && (modbus_crc16_update(MODBUS_CRC_INIT, frame, u32_req_len) == 0);
+            if( !b_valid ) {
+                // drop one byte and look for a request further
+                u32_req_len = 1;
+            } else if( sim_baudrate(fd) != sim_line_baudrate ) {
+                // firmware and meter speeds differ, the meter only sees noise
+                if( b_verbose ) {
+                    fprintf(stderr, "jsy_sim: request at %u baud ignored\n", sim_baudrate(fd));
+                }
+            } else {
+                for(uint32_t i=0; i<u32_nb_meter; i++) {
+                    if( frame[0] == meters[i].u8_address ) {
+                        if( b_verbose ) {
+                            fprintf(stderr, "jsy_sim: request @%02X fc=%02X reg=%02X%02X\n", frame[0], frame[1], frame[2], frame[3]);
+                        }
+                        sim_request(fd, &meters[i], frame, u32_req_len);
+                    }
+                }
+            }
+            memmove(frame, &frame[u32_req_len], u32_frame_len - u32_req_len);
+            u32_frame_len -= u32_req_len;
+        }
+        if( u32_frame_len >= sizeof(frame) ) {
+            u32_frame_len = 0;
+        }
+    }
+
+    close(slave_fd);
+    return 0;
+}
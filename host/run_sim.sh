@@ -0,0 +1,26 @@
+#!/bin/sh
+# End to end run of the host firmware against the meter simulator.
+#   run_sim.sh <build dir> [duration s] [console commands...]
+# Prints the firmware output and the number of samples received.
+# JSY_SIM_ARGS is passed to the simulator, e.g. "-a 1 -a 2" for two meters.
+# Diverter against the simulated house : PM_GPIO=/tmp/gpio JSY_SIM_ARGS="-g /tmp/gpio"
+BUILD_DIR=${1:?build dir}
+DURATION=${2:-10}
+shift 2 2>/dev/null
+
+LINK=$(mktemp -u /tmp/jsy.XXXXXX)
+OUT=$(mktemp /tmp/app_host.XXXXXX)
+
+"$BUILD_DIR/jsy_sim" $JSY_SIM_ARGS -l "$LINK" > /dev/null &
+SIM_PID=$!
+while [ ! -e "$LINK" ]; do sleep 0.1; done
+
+# console commands are sent once the firmware is up
+( sleep 3; for cmd in "$@"; do printf '%s\n' "$cmd"; sleep 0.5; done; sleep "$DURATION" ) \
+    | PM_UART0="$LINK" timeout "$((DURATION + 3 + $#))" "$BUILD_DIR/app_host" > "$OUT"
+
+kill $SIM_PID
+rm -f "$LINK"
+cat "$OUT"
+echo "samples: $(grep -c '"idx"' "$OUT") in ${DURATION}s"
+rm -f "$OUT"
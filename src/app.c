@@ -5,16 +5,28 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
 #include "hardware/rtc.h"
 #include "hardware/watchdog.h"
 #include "hardware/i2c.h"
 #include "pico/util/datetime.h"
 
 #include "modbus.h"
+#include "modbus_crc.h"
 #include "data.h"
+#include "bench.h"
+#include "history.h"
+#include "energy.h"
+#include "flash_log.h"
+#include "diverter.h"
+#include "triac.h"
+#include "latency.h"
+#include "profiler.h"
+#include "scheduler.h"
 #include "ssd1306_i2c.h"
 
 #define VERSION 0x0001
@@ -22,7 +34,14 @@
 /* configuration
 
 UART0 (GP0, GP1) => modbus client RTU
+UART1 (GP8, GP9) => modbus server RTU, measures for a PLC or home automation
 USB CDC => console
+core0 => console, telemetry, display
+core1 => modbus acquisition, diverter control
+each core runs its tasks from a scheduler and sleeps when idle (scheduler.c)
+GP2 => SSR of the diverted load
+GP3 => mains zero-cross detector (PIO0 SM0)
+GP4 => triac gate (PIO0 SM1)
 I2C1 (GP14, GP15) => oled display
 GP25 => led
 
@@ -30,6 +49,8 @@ GP25 => led
 
 #define UART0_TX_PIN 0
 #define UART0_RX_PIN 1
+#define UART1_TX_PIN 8
+#define UART1_RX_PIN 9
 
 
 #define I2C1_SDA_PIN 14
@@ -55,10 +76,17 @@ void hardware_init()
     // Set up UART0
     gpio_set_function(UART0_TX_PIN, GPIO_FUNC_UART);
     gpio_set_function(UART0_RX_PIN, GPIO_FUNC_UART);
-    uart_init(uart0, 4800);
+    uart_init(uart0, MODBUS_CLIENT_DEFAULT_BAUDRATE);
     uart_set_hw_flow(uart0, false, false);
     uart_set_fifo_enabled (uart0, true);
 
+    // Set up UART1
+    gpio_set_function(UART1_TX_PIN, GPIO_FUNC_UART);
+    gpio_set_function(UART1_RX_PIN, GPIO_FUNC_UART);
+    uart_init(uart1, MODBUS_SERVER_BAUDRATE);
+    uart_set_hw_flow(uart1, false, false);
+    uart_set_fifo_enabled (uart1, true);
+
     // set up I2C
     // I2C is "open drain", pull ups to keep signal high when no data is being
     // sent
@@ -82,10 +110,410 @@ void blink_led(void) {
         blink_time = cur_time;
         gpio_put(LED_PIN, b_led_state);
         b_led_state = !b_led_state;
+        blink_diff_us = 0;
     }
+    sched_wake_in_us(SCHED_TASK_BLINK, (uint32_t)(blink_period_us - blink_diff_us) + 1);
+}
+
+
+
+// core1 : acquisition and control, samples are sent to core0 through modbus queue
+void core1_entry(void) {
+    // core0 stops this core while it writes the flash log
+    multicore_lockout_victim_init();
+    // control runs here, next to the acquisition, away from core0 console and display
+    diverter_init();
+    triac_init();
+    modbus_client_set_sample_cb(diverter_sample);
+    // UART IRQ is registered on the calling core
+    modbus_client_init();
+    modbus_server_init();
+
+    sched_add(SCHED_TASK_MODBUS, modbus_client_loop);
+    sched_add(SCHED_TASK_MODBUS_SERVER, modbus_server_loop);
+    sched_add(SCHED_TASK_DIVERTER, diverter_loop);
+    sched_add(SCHED_TASK_TRIAC, triac_loop);
+    sched_run(SCHED_CORE1);
+}
+
+// core0 : every sample of the meters
+static void sync_sample(uint8_t u8_slave, const t_power_data* p_data) {
+    history_add(u8_slave, p_data);
+    energy_add(u8_slave, p_data);
+    if( u8_slave == 0 ) {
+        // registers served to home automation, main meter
+        uint8_t regs[2 * DATA_NB_REGISTER];
+        datetime_t t;
+        rtc_get_datetime(&t);
+        modbus_server_publish(regs, data_format_registers(regs, p_data, &t));
+    }
+}
+
+// core0 : new samples from core1, then the tasks that use them.
+// The bus is idle until the next poll, the time the flash log waits for.
+static void sync_loop(void) {
+    modbus_sync_power_data(sync_sample);
+    sched_post(SCHED_TASK_FLASH_LOG);
+    sched_post(SCHED_TASK_DATA);
+    sched_post(SCHED_TASK_DISPLAY);
 }
 
+// core0 : console task, woken by USB when characters are received
+static void console_loop(void) {
+    int val;
+    while( (val = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT ) {
+        char c = (char)val;
+        if (c == '\r' ) {
+            char* p_cmd = cmd_buf;
+            // execute command
+            cmd_buf[u32_char_count] = '\0';
+            // get command
+            char * p_first_space = strchr(cmd_buf, ' ');
+            if(p_first_space != NULL) {
+                *p_first_space = '\0';
+            }
+            if( 0 == strcmp("reset", cmd_buf)) {
+                flash_log_flush();
+                printf("Enable watchdog\n");
+                watchdog_enable(100,1);
+            } else if( 0 == strcmp("simu", cmd_buf)) {
+                data_toggle_simu();
+            } else if( 0 == strcmp("bench", cmd_buf)) {
+                bench_run();
+            } else if( 0 == strcmp("poll", cmd_buf)) {
+                // optional argument is poll period in ms, 0 = as fast as possible
+                if(NULL != p_first_space) {
+                    modbus_client_set_period_us(atoi(p_first_space+1) * 1000);
+                }
+                uint32_t u32_sps_x100 = modbus_client_get_sps_x100();
+                printf("poll period %u ms (cycle %u ms at %u baud), %u.%02u samples/s\n",
+                        modbus_client_get_period_us() / 1000, modbus_client_get_min_period_us() / 1000,
+                        modbus_client_get_baudrate(), u32_sps_x100 / 100, u32_sps_x100 % 100);
+                uint32_t u32_crc_error, u32_truncated, u32_skipped;
+                modbus_get_rx_errors(&u32_crc_error, &u32_truncated, &u32_skipped);
+                printf("rx crc error %u truncated %u skipped %u overrun %u\n",
+                        u32_crc_error, u32_truncated, u32_skipped, modbus_get_rx_overrun());
+            } else if( 0 == strcmp("baud", cmd_buf)) {
+                // argument is new meter baudrate : 4800, 9600 or 19200, result of the last change when none
+                if(NULL == p_first_space) {
+                    static const char* result_names[] = { "none", "pending", "ok", "failed", "not supported" };
+                    t_mb_baud_status baud_status;
+                    modbus_client_get_baud_status(&baud_status);
+                    printf("modbus baudrate %u, last change to %u %s (%u/%u meters), no answer fallbacks %u\n",
+                            modbus_client_get_baudrate(), baud_status.u32_baud, result_names[baud_status.result],
+                            baud_status.u8_nb_ok, baud_status.u8_nb_enabled, baud_status.u32_fallback);
+                    for(uint8_t i=0; i<MODBUS_CLIENT_NB_SLAVE; i++) {
+                        if( baud_status.u32_stranded_mask & (1u << i) ) {
+                            t_mb_slave_info info;
+                            modbus_slave_get_info(i, &info);
+                            printf("slave %s may be left at %u baud\n", info.p_name, baud_status.u32_baud);
+                        }
+                    }
+                    printf("Usage: baud 4800|9600|19200\n");
+                } else {
+                    modbus_client_request_baudrate(atoi(p_first_space+1));
+                }
+            } else if( 0 == strcmp("mbserver", cmd_buf)) {
+                t_mb_server_stats server_stats;
+                modbus_server_get_stats(&server_stats);
+                printf("server @%02X req %u other %u exc %u crc %u image %u retry %u turnaround %u/%u us (t3.5 %u us)\n",
+                        MODBUS_SERVER_ADDRESS, server_stats.u32_request, server_stats.u32_other,
+                        server_stats.u32_exception, server_stats.u32_crc_error, server_stats.u32_image,
+                        server_stats.u32_image_retry, server_stats.u32_turnaround_us,
+                        server_stats.u32_turnaround_max_us, server_stats.u32_t35_us);
+            } else if( 0 == strcmp("slave", cmd_buf)) {
+                // arguments are slave index and on, off or poll period in ms
+                char* p_arg = (NULL == p_first_space) ? "" : p_first_space+1;
+                unsigned int u32_slave;
+                char setting[8];
+                if( 2 == sscanf(p_arg, "%u %7s", &u32_slave, setting) && (u32_slave < MODBUS_CLIENT_NB_SLAVE) ) {
+                    if( 0 == strcmp("on", setting)) {
+                        modbus_slave_enable(u32_slave, true);
+                    } else if( 0 == strcmp("off", setting)) {
+                        modbus_slave_enable(u32_slave, false);
+                    } else {
+                        modbus_slave_set_period_us(u32_slave, atoi(setting) * 1000);
+                    }
+                } else if( 0 != strlen(p_arg)) {
+                    printf("Usage: slave [<index> on|off|<period ms>]\n");
+                } else {
+                    // no argument print per slave counters
+                    for(uint8_t i=0; i<MODBUS_CLIENT_NB_SLAVE; i++) {
+                        t_mb_slave_info info;
+                        modbus_slave_get_info(i, &info);
+                        uint32_t u32_avg_us = info.stats.u32_response ? (uint32_t)(info.stats.u64_latency_sum_us / info.stats.u32_response) : 0;
+                        uint32_t u32_min_us = info.stats.u32_response ? info.stats.u32_latency_min_us : 0;
+                        char model[16] = "model ----"; // not found or disabled at init
+                        if( info.b_found ) {
+                            snprintf(model, sizeof(model), "model %04X", info.u16_model);
+                        }
+                        printf("%u %-6s @%02X %s %s prio %u period %u ms req %u rsp %u miss %u exc %u drop %u latency %u/%u/%u us\n",
+                                i, info.p_name, info.u8_address, info.b_enabled ? "on " : "off", model, info.u8_priority,
+                                info.u32_period_us / 1000, info.stats.u32_request, info.stats.u32_response,
+                                info.stats.u32_miss, info.stats.u32_exception, info.stats.u32_drop,
+                                u32_min_us, u32_avg_us, info.stats.u32_latency_max_us);
+                    }
+                }
+            } else if( 0 == strcmp("history", cmd_buf)) {
+                // arguments are level (1s, 1m or 15m) and last seconds or time range on the log time line
+                char* p_arg = (NULL == p_first_space) ? "" : p_first_space+1;
+                char level_name[4];
+                unsigned int u32_from_s, u32_to_s;
+                uint32_t u32_now_s = history_now_s();
+                int nb_found = sscanf(p_arg, "%3s %u %u", level_name, &u32_from_s, &u32_to_s);
+                enum history_level level = HISTORY_NB_LEVEL;
+                if( nb_found >= 1 ) {
+                    if( 0 == strcmp("1s", level_name)) {
+                        level = HISTORY_LEVEL_1S;
+                    } else if( 0 == strcmp("1m", level_name)) {
+                        level = HISTORY_LEVEL_1MIN;
+                    } else if( 0 == strcmp("15m", level_name)) {
+                        level = HISTORY_LEVEL_15MIN;
+                    }
+                }
+                if( level == HISTORY_NB_LEVEL ) {
+                    printf("Usage: history 1s|1m|15m [<last s> | <from s> <to s>]\n");
+                } else {
+                    if( nb_found == 1 ) {
+                        // last 10 periods
+                        u32_from_s = 10 * history_get_period_s(level);
+                    }
+                    if( nb_found < 3 ) {
+                        u32_from_s = (u32_from_s < u32_now_s) ? u32_now_s - u32_from_s : 0;
+                        u32_to_s = u32_now_s;
+                    }
+                    history_print(level, u32_from_s, u32_to_s);
+                }
+            } else if( 0 == strcmp("energy", cmd_buf)) {
+                // totals and meter check, "energy hours [n]" last hourly buckets
+                char* p_arg = (NULL == p_first_space) ? "" : p_first_space+1;
+                if( 0 == strncmp("hours", p_arg, 5) ) {
+                    int nb_hour = atoi(p_arg+5);
+                    energy_print_hours((nb_hour > 0) ? (uint32_t)nb_hour : 24);
+                } else {
+                    energy_print();
+                }
+            } else if( 0 == strcmp("divert", cmd_buf)) {
+                // arguments : on, off, target <W>, pi <kp x256> <ki x256 per s>, status when none
+                char* p_arg = (NULL == p_first_space) ? "" : p_first_space+1;
+                int i32_target_w;
+                unsigned int u32_kp, u32_ki;
+                if( 0 == strcmp("on", p_arg)) {
+                    diverter_enable(true);
+                } else if( 0 == strcmp("off", p_arg)) {
+                    diverter_enable(false);
+                } else if( 1 == sscanf(p_arg, "target %d", &i32_target_w)) {
+                    diverter_set_target_mw(i32_target_w * 1000);
+                } else if( 2 == sscanf(p_arg, "pi %u %u", &u32_kp, &u32_ki)) {
+                    diverter_set_gains(u32_kp, u32_ki);
+                } else if( 0 == strcmp("output ssr", p_arg)) {
+                    diverter_set_output(DIVERTER_OUTPUT_SSR);
+                } else if( 0 == strcmp("output phase", p_arg)) {
+                    diverter_set_output(DIVERTER_OUTPUT_PHASE);
+                } else if( 0 == strcmp("output cycle", p_arg)) {
+                    diverter_set_output(DIVERTER_OUTPUT_CYCLE);
+                } else if( 0 != strlen(p_arg)) {
+                    printf("Usage: divert [on|off|target <W>|pi <kp x256> <ki x256>|output ssr|phase|cycle]\n");
+                }
+                t_diverter_status status;
+                diverter_get_status(&status);
+                t_diverter_stats* p_stats = &status.stats;
+                uint32_t u32_avg_us = (p_stats->u32_update > 0) ? (uint32_t)(p_stats->u64_latency_sum_us / p_stats->u32_update) : 0;
+                uint32_t u32_min_us = (p_stats->u32_update > 0) ? p_stats->u32_latency_min_us : 0;
+                static const char* output_names[] = { "ssr", "phase", "cycle" };
+                printf("divert %s %s target %d W kp %u ki %u grid %d W load %d W duty %u.%u%%\n",
+                        status.b_enabled ? "on" : "off", output_names[status.output], status.i32_target_mw / 1000, status.u32_kp_x256, status.u32_ki_x256,
+                        status.i32_grid_mw / 1000, status.i32_load_mw / 1000,
+                        status.u32_duty * 100 / DIVERTER_DUTY_ONE, (status.u32_duty * 1000 / DIVERTER_DUTY_ONE) % 10);
+                // latency to the duty update, then to the SSR input
+                uint32_t u32_output_avg_us = (p_stats->u32_output > 0) ? (uint32_t)(p_stats->u64_output_latency_sum_us / p_stats->u32_output) : 0;
+                uint32_t u32_output_min_us = (p_stats->u32_output > 0) ? p_stats->u32_output_latency_min_us : 0;
+                printf("updates %u timeouts %u cycles %u on %u latency %u/%u/%u us output %u/%u/%u us\n",
+                        p_stats->u32_update, p_stats->u32_timeout, p_stats->u32_cycle, p_stats->u32_cycle_on,
+                        u32_min_us, u32_avg_us, p_stats->u32_latency_max_us,
+                        u32_output_min_us, u32_output_avg_us, p_stats->u32_output_latency_max_us);
+            } else if( 0 == strcmp("triac", cmd_buf)) {
+                // arguments : off, phase <%>, cycle <%> for tests when the diverter uses the SSR, status when none
+                char* p_arg = (NULL == p_first_space) ? "" : p_first_space+1;
+                unsigned int u32_percent;
+                if( 0 == strcmp("off", p_arg)) {
+                    triac_set(TRIAC_MODE_OFF, 0);
+                } else if( 1 == sscanf(p_arg, "phase %u", &u32_percent)) {
+                    triac_set(TRIAC_MODE_PHASE, u32_percent * TRIAC_POWER_ONE / 100);
+                } else if( 1 == sscanf(p_arg, "cycle %u", &u32_percent)) {
+                    triac_set(TRIAC_MODE_CYCLE, u32_percent * TRIAC_POWER_ONE / 100);
+                } else if( 0 != strlen(p_arg)) {
+                    printf("Usage: triac [off|phase <%%>|cycle <%%>]\n");
+                }
+                static const char* mode_names[] = { "off", "phase", "cycle" };
+                t_triac_status status;
+                triac_get_status(&status);
+                uint32_t u32_meter_mhz = modbus_get_power_data()->frequence_mhz;
+                printf("triac %s power %u%% delay %u us, mains %s half period %u us %u.%03u Hz (meter %u.%03u Hz)\n",
+                        mode_names[status.mode], status.u32_power * 100 / TRIAC_POWER_ONE, status.u32_delay_us,
+                        status.b_mains_ok ? "ok" : "lost", status.u32_half_period_us,
+                        status.u32_mains_mhz / 1000, status.u32_mains_mhz % 1000, u32_meter_mhz / 1000, u32_meter_mhz % 1000);
+                printf("zero crossings %u glitches %u lost %u last at %llu us\n",
+                        status.u32_zero_cross, status.u32_glitch, status.u32_lost, (unsigned long long)status.u64_zero_cross_us);
+            } else if( 0 == strcmp("display", cmd_buf)) {
+                t_ssd1306_stats display_stats;
+                SSD1306_get_stats(&display_stats);
+                printf("frames composed %u sent %u dropped %u\n", display_stats.u32_frame_composed,
+                        display_stats.u32_frame_sent, display_stats.u32_frame_dropped);
+            } else if( 0 == strcmp("flog", cmd_buf)) {
+                // no argument print status, else last records
+                if(NULL == p_first_space) {
+                    flash_log_print_status();
+                } else {
+                    flash_log_print_last(atoi(p_first_space+1));
+                }
+            } else if( 0 == strcmp("stats", cmd_buf)) {
+                // per stage latency of the samples, "stats reset" clears them
+                if( (NULL != p_first_space) && (0 == strcmp("reset", p_first_space+1)) ) {
+                    latency_reset();
+                } else {
+                    latency_print();
+                }
+            } else if( 0 == strcmp("prof", cmd_buf)) {
+                // superloop tasks cost, "prof reset" clears it
+                if( (NULL != p_first_space) && (0 == strcmp("reset", p_first_space+1)) ) {
+                    profiler_reset();
+                } else {
+                    profiler_print();
+                }
+            } else if( 0 == strcmp("telemetry", cmd_buf)) {
+                // argument is output format : json or bin
+                char* p_arg = (NULL == p_first_space) ? "" : p_first_space+1;
+                if( 0 == strcmp("bin", p_arg)) {
+                    data_set_mode(DATA_MODE_BINARY);
+                } else if( 0 == strcmp("json", p_arg)) {
+                    data_set_mode(DATA_MODE_JSON);
+                } else {
+                    printf("Usage: telemetry json|bin\n");
+                }
+            } else if( 0 == strcmp("subscribe", cmd_buf)) {
+                // subscribe [fields <f1,f2..>|all] [every <n>] [min <ms>] [json|bin], no argument print it
+                t_data_subscription sub;
+                data_get_subscription(&sub);
+                bool b_ok = true;
+                if( NULL != p_first_space ) {
+                    char* p_save;
+                    char* p_token = strtok_r(p_first_space+1, " ", &p_save);
+                    while( b_ok && (NULL != p_token) ) {
+                        char* p_value = NULL;
+                        if( (0 == strcmp("fields", p_token)) || (0 == strcmp("every", p_token)) || (0 == strcmp("min", p_token)) ) {
+                            p_value = strtok_r(NULL, " ", &p_save);
+                            b_ok = (NULL != p_value);
+                        }
+                        if( !b_ok ) {
+                            break;
+                        } else if( 0 == strcmp("fields", p_token)) {
+                            if( 0 == strcmp("all", p_value)) {
+                                sub.u32_fields = DATA_FIELDS_ALL;
+                            } else {
+                                b_ok = data_parse_fields(p_value, &sub.u32_fields);
+                            }
+                        } else if( 0 == strcmp("every", p_token)) {
+                            sub.u32_decimation = atoi(p_value);
+                        } else if( 0 == strcmp("min", p_token)) {
+                            sub.u32_min_interval_ms = atoi(p_value);
+                        } else if( 0 == strcmp("json", p_token)) {
+                            sub.mode = DATA_MODE_JSON;
+                        } else if( 0 == strcmp("bin", p_token)) {
+                            sub.mode = DATA_MODE_BINARY;
+                        } else {
+                            b_ok = false;
+                        }
+                        p_token = strtok_r(NULL, " ", &p_save);
+                    }
+                    if( b_ok ) {
+                        data_subscribe(&sub);
+                        data_get_subscription(&sub);
+                    }
+                }
+                if( !b_ok ) {
+                    printf("Usage: subscribe [fields <f1,f2..>|all] [every <n>] [min <ms>] [json|bin]\n");
+                } else {
+                    printf("subscribe fields");
+                    char c_sep = ' ';
+                    for(uint32_t f=0; f<DATA_NB_FIELD; f++) {
+                        if( sub.u32_fields & (1u << f) ) {
+                            printf("%c%s", c_sep, data_field_name((enum data_field)f));
+                            c_sep = ',';
+                        }
+                    }
+                    printf(" every %u min %u ms %s\n", sub.u32_decimation, sub.u32_min_interval_ms,
+                            (sub.mode == DATA_MODE_BINARY) ? "bin" : "json");
+                }
+            } else if( 0 == strcmp("datetime", cmd_buf)) {
+                // no argument print datetime
+                if(NULL == p_first_space) {
+                    datetime_t t;
+                    char datetime_buf[256];
+                    rtc_get_datetime(&t);
+                    datetime_to_str(datetime_buf, sizeof(datetime_buf), &t);
+                    printf("%s\n", datetime_buf);
+                } else {
+                    // first argument is datetime in format YYYY-MM-DD-HH-MM-SS-dotw
+                    char* p_datetime = p_first_space+1;
+                    // trim end space
+                    char * p_end_space = strchr(p_datetime, ' ');
+                    if(p_end_space != NULL) {
+                        *p_end_space = '\0';
+                    }
+                    // parse datetime
+                    // newlib-nano doesn't support %hhd so use intermediate int
+                    datetime_t t;
+                    int val[7];
+                    int nb_found = sscanf(p_datetime, "%d-%d-%d-%d-%d-%d-%d", &val[0], &val[1], &val[2], &val[3], &val[4], &val[5], &val[6]);
+                    if( 7 == nb_found ) {
+                        t.year=val[0];
+                        t.month=val[1];
+                        t.day=val[2];
+                        t.hour=val[3];
+                        t.min=val[4];
+                        t.sec=val[5];
+                        t.dotw=val[6];
+                        // Set time
+                        rtc_set_datetime(&t);
+                        // clk_sys is >2000x faster than clk_rtc, so datetime is not updated immediately when rtc_get_datetime() is called.
+                        // tbe delay is up to 3 RTC clock cycles (which is 64us with the default clock settings)
+                        sleep_us(64);
+                        // get and print new time
+                        datetime_t newt;
+                        char datetime_buf[256];
+                        rtc_get_datetime(&newt);
+                        datetime_to_str(datetime_buf, sizeof(datetime_buf), &newt);
+                        printf("datetime set to %s\n", datetime_buf);
+                    } else {
+                        printf("Invalid format [%s] nb_found=%d\n", p_datetime, nb_found);
+                        printf("%d-%d-%d-%d-%d-%d-%d\n", t.year, t.month, t.day, t.hour, t.min, t.sec, t.dotw);
+                    }
+                }
+
 
+            } else {
+                printf("Unknown command [%s]\n", cmd_buf);
+            }
+            // reset command
+            u32_char_count = 0;
+        } else {
+            // add char to command
+            cmd_buf[u32_char_count] = c;
+            u32_char_count++;
+            if( u32_char_count >= (sizeof(cmd_buf)-1) ) {
+                // command too long
+                printf("Command too long\n");
+                u32_char_count = 0;
+            }
+        }
+    }
+}
+
+// USB IRQ
+static void console_chars_available(void* p_param) {
+    sched_post(SCHED_TASK_CONSOLE);
+}
 
 int main() {
     stdio_init_all();
@@ -116,94 +544,20 @@ int main() {
     
     hardware_init();
     SSD1306_init();
-    modbus_client_init();
-    
-    while (true) {
-        blink_led();
-        modbus_client_loop();
-        data_loop();
-        SSD1306_loop();
-
-        // console
-        int val = getchar_timeout_us(0);
-        if( val != PICO_ERROR_TIMEOUT ) {
-            char c = (char)val;
-            if (c == '\r' ) {
-                char* p_cmd = cmd_buf;
-                // execute command
-                cmd_buf[u32_char_count] = '\0';
-                // get command
-                char * p_first_space = strchr(cmd_buf, ' ');
-                if(p_first_space != NULL) {
-                    *p_first_space = '\0';
-                }
-                if( 0 == strcmp("reset", cmd_buf)) {
-                    printf("Enable watchdog\n");
-                    watchdog_enable(100,1);
-                } else if( 0 == strcmp("simu", cmd_buf)) {
-                    data_toggle_simu();
-                } else if( 0 == strcmp("datetime", cmd_buf)) {
-                    // no argument print datetime
-                    if(NULL == p_first_space) {
-                        datetime_t t;
-                        char datetime_buf[256];
-                        rtc_get_datetime(&t);
-                        datetime_to_str(datetime_buf, sizeof(datetime_buf), &t);
-                        printf("%s\n", datetime_buf);
-                    } else {
-                        // first argument is datetime in format YYYY-MM-DD-HH-MM-SS-dotw
-                        char* p_datetime = p_first_space+1;
-                        // trim end space
-                        char * p_end_space = strchr(p_datetime, ' ');
-                        if(p_end_space != NULL) {
-                            *p_end_space = '\0';
-                        }
-                        // parse datetime
-                        // newlib-nano doesn't support %hhd so use intermediate int
-                        datetime_t t;
-                        int val[7];
-                        int nb_found = sscanf(p_datetime, "%d-%d-%d-%d-%d-%d-%d", &val[0], &val[1], &val[2], &val[3], &val[4], &val[5], &val[6]);
-                        if( 7 == nb_found ) {
-                            t.year=val[0];
-                            t.month=val[1];
-                            t.day=val[2];
-                            t.hour=val[3];
-                            t.min=val[4];
-                            t.sec=val[5];
-                            t.dotw=val[6];
-                            // Set time
-                            rtc_set_datetime(&t);
-                            // clk_sys is >2000x faster than clk_rtc, so datetime is not updated immediately when rtc_get_datetime() is called.
-                            // tbe delay is up to 3 RTC clock cycles (which is 64us with the default clock settings)
-                            sleep_us(64);
-                            // get and print new time
-                            datetime_t newt;
-                            char datetime_buf[256];
-                            rtc_get_datetime(&newt);
-                            datetime_to_str(datetime_buf, sizeof(datetime_buf), &newt);
-                            printf("datetime set to %s\n", datetime_buf);
-                        } else {
-                            printf("Invalid format [%s] nb_found=%d\n", p_datetime, nb_found);
-                            printf("%d-%d-%d-%d-%d-%d-%d\n", t.year, t.month, t.day, t.hour, t.min, t.sec, t.dotw);
-                        }
-                    }
-
+    modbus_crc_init();
+    history_init();
+    energy_init();
+    flash_log_init();
+    latency_init();
+    data_init();
+    multicore_launch_core1(core1_entry);
 
-                } else {
-                    printf("Unknown command [%s]\n", cmd_buf);
-                }
-                // reset command
-                u32_char_count = 0;
-            } else {
-                // add char to command
-                cmd_buf[u32_char_count] = c;
-                u32_char_count++;
-                if( u32_char_count >= (sizeof(cmd_buf)-1) ) {
-                    // command too long
-                    printf("Command too long\n");
-                    u32_char_count = 0;
-                }
-            }
-        }
-    }
+    sched_add(SCHED_TASK_BLINK, blink_led);
+    sched_add(SCHED_TASK_SYNC, sync_loop);
+    sched_add(SCHED_TASK_FLASH_LOG, flash_log_loop);
+    sched_add(SCHED_TASK_DATA, data_loop);
+    sched_add(SCHED_TASK_DISPLAY, SSD1306_loop);
+    sched_add(SCHED_TASK_CONSOLE, console_loop);
+    stdio_set_chars_available_callback(console_chars_available, NULL);
+    sched_run(SCHED_CORE0);
 }
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "modbus.h"
+#include "modbus_crc.h"
+#include "meter.h"
+#include "data.h"
+#include "gfx.h"
+#include "bench.h"
+
+/*
+On target micro benchmarks, started with "bench" console command.
+Run on core0 while acquisition keeps running on core1, results include
+interrupt noise from USB.
+*/
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+#define BENCH_CRC_LOOP 2000
+// size of a 0x0048 block response
+#define BENCH_FRAME_SIZE 61
+#define BENCH_JSON_LOOP 500
+#define BENCH_DECODE_LOOP 2000
+#define BENCH_GFX_LOOP 200
+
+/*****************************************************************************/
+/*            PRIVATE TYPE                                                   */
+/*****************************************************************************/
+typedef uint16_t (*t_crc_kernel)(uint16_t, const uint8_t*, uint32_t);
+typedef int (*t_gfx_char_kernel)(t_gfx_frame*, const t_gfx_font*, int, int, char);
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static uint8_t bench_frame[BENCH_FRAME_SIZE];
+static char bench_json_buf[DATA_JSON_MAX_LEN];
+static t_gfx_frame bench_gfx_frame;
+static uint8_t bench_gfx_ref[SSD1306_BUF_LEN];
+// results are stored here so loops are not optimized out
+static volatile uint32_t u32_bench_sink;
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+static void bench_print(const char* name, uint64_t u64_us, uint32_t u32_nb_op, uint32_t u32_op_size) {
+    uint32_t u32_clk_mhz = clock_get_hz(clk_sys) / 1000000;
+    uint32_t u32_ns_op = (uint32_t)((u64_us * 1000) / u32_nb_op);
+    uint32_t u32_cycles_op = (uint32_t)((u64_us * u32_clk_mhz) / u32_nb_op);
+    printf("%-16s %6u ns/op %6u cycles/op", name, u32_ns_op, u32_cycles_op);
+    if( u32_op_size > 0 ) {
+        printf(" %3u.%02u cycles/byte", u32_cycles_op / u32_op_size, ((u32_cycles_op % u32_op_size) * 100) / u32_op_size);
+    }
+    printf("\n");
+}
+
+static void bench_crc_kernel(const char* name, t_crc_kernel kernel) {
+    uint64_t u64_start = time_us_64();
+    for(int i=0; i<BENCH_CRC_LOOP; i++) {
+        u32_bench_sink = kernel(MODBUS_CRC_INIT, bench_frame, BENCH_FRAME_SIZE);
+    }
+    bench_print(name, time_us_64() - u64_start, BENCH_CRC_LOOP, BENCH_FRAME_SIZE);
+}
+
+// json formatting as done before fmt module : one snprintf per field
+static uint32_t bench_json_snprintf(char* buf, const t_power_data* p_power_data, const datetime_t* p_t) {
+    char datetime_buf[32];
+    int len = 0;
+    snprintf(datetime_buf, sizeof(datetime_buf), "%d-%02d-%02dT%02d:%02d:%02d", p_t->year, p_t->month, p_t->day, p_t->hour, p_t->min, p_t->sec);
+    len += snprintf(&buf[len], DATA_JSON_MAX_LEN-len, "{");
+    len += snprintf(&buf[len], DATA_JSON_MAX_LEN-len, "\"idx\":%u,", p_power_data->u32_index);
+    len += snprintf(&buf[len], DATA_JSON_MAX_LEN-len, "\"time\":\"%s\",", datetime_buf);
+    len += snprintf(&buf[len], DATA_JSON_MAX_LEN-len, "\"V\":%u.%03u,", p_power_data->tension_mv/1000, p_power_data->tension_mv%1000);
+    len += snprintf(&buf[len], DATA_JSON_MAX_LEN-len, "\"F\":%u.%03u", p_power_data->frequence_mhz/1000, p_power_data->frequence_mhz%1000);
+    for(int8_t i=0; i<2; i++) {
+        len += snprintf(&buf[len], DATA_JSON_MAX_LEN-len, ",\"I%d\":%u.%03u", i+1, p_power_data->voie[i].courant_ma/1000, p_power_data->voie[i].courant_ma%1000);
+        len += snprintf(&buf[len], DATA_JSON_MAX_LEN-len, ",\"P%d\":%d.%03u", i+1, p_power_data->voie[i].puissance_active_mw/1000, abs(p_power_data->voie[i].puissance_active_mw)%1000);
+        len += snprintf(&buf[len], DATA_JSON_MAX_LEN-len, ",\"E%d\":%u", i+1, p_power_data->voie[i].energie_wh);
+        len += snprintf(&buf[len], DATA_JSON_MAX_LEN-len, ",\"fp%d\":%u.%03u", i+1, p_power_data->voie[i].facteur_puissance/1000, p_power_data->voie[i].facteur_puissance%1000);
+    }
+    len += snprintf(&buf[len], DATA_JSON_MAX_LEN-len, "}\n");
+    return len;
+}
+
+static uint32_t bench_bytes_to_uint32(uint8_t* pbuf) {
+    return (((uint32_t)pbuf[0])<<24) + (((uint32_t)pbuf[1])<<16)  + (((uint32_t)pbuf[2])<<8) + pbuf[3];
+}
+
+// 0x0048 block decoding as done before register maps, pbuf is the whole frame
+static void __attribute__((noinline)) bench_decode_hand(uint8_t* pbuf, t_power_data* p_data) {
+    p_data->tension_mv = bench_bytes_to_uint32(&pbuf[3]) / 10;
+    p_data->frequence_mhz = bench_bytes_to_uint32(&pbuf[31]) * 10;
+    p_data->voie[0].courant_ma = bench_bytes_to_uint32(&pbuf[7]) / 10;
+    p_data->voie[0].puissance_active_mw = bench_bytes_to_uint32(&pbuf[11]) / 10;
+    if( pbuf[27] ) {
+        p_data->voie[0].puissance_active_mw = -p_data->voie[0].puissance_active_mw;
+    }
+    p_data->voie[0].energie_wh = bench_bytes_to_uint32(&pbuf[15]) / 10;
+    p_data->voie[0].facteur_puissance = bench_bytes_to_uint32(&pbuf[19]);
+    p_data->voie[1].courant_ma = bench_bytes_to_uint32(&pbuf[39]) / 10;
+    p_data->voie[1].puissance_active_mw = bench_bytes_to_uint32(&pbuf[43]) / 10;
+    if( pbuf[28] ) {
+        p_data->voie[1].puissance_active_mw = -p_data->voie[1].puissance_active_mw;
+    }
+    p_data->voie[1].energie_wh = bench_bytes_to_uint32(&pbuf[47]) / 10;
+    p_data->voie[1].facteur_puissance = bench_bytes_to_uint32(&pbuf[51]);
+}
+
+static void bench_decode(void) {
+    t_power_data hand, map;
+    // sign flags alternate between loops
+    uint64_t u64_start = time_us_64();
+    for(int i=0; i<BENCH_DECODE_LOOP; i++) {
+        bench_frame[27] = (uint8_t)(i & 1);
+        bench_decode_hand(bench_frame, &hand);
+        u32_bench_sink = hand.voie[0].puissance_active_mw;
+    }
+    bench_print("decode hand", time_us_64() - u64_start, BENCH_DECODE_LOOP, 0);
+
+    u64_start = time_us_64();
+    for(int i=0; i<BENCH_DECODE_LOOP; i++) {
+        bench_frame[27] = (uint8_t)(i & 1);
+        meter_jsy_mk194.decode(&bench_frame[3], &map);
+        u32_bench_sink = map.voie[0].puissance_active_mw;
+    }
+    bench_print("decode map", time_us_64() - u64_start, BENCH_DECODE_LOOP, 0);
+
+    if( memcmp(&hand.tension_mv, &map.tension_mv, sizeof(hand) - offsetof(t_power_data, tension_mv)) != 0 ) {
+        printf("decode map differs from hand decoding\n");
+    }
+}
+
+static void bench_json(void) {
+    const t_power_data power_data = {
+        .u32_index = 123456,
+        .tension_mv = 231456,
+        .frequence_mhz = 49980,
+        .voie = {
+            { .courant_ma = 12345, .puissance_active_mw = -2845123, .energie_wh = 1234567, .facteur_puissance = 987 },
+            { .courant_ma = 2345, .puissance_active_mw = 512345, .energie_wh = 76543, .facteur_puissance = 912 },
+        }
+    };
+    const datetime_t t = { .year = 2023, .month = 6, .day = 21, .hour = 13, .min = 37, .sec = 42 };
+
+    uint64_t u64_start = time_us_64();
+    for(int i=0; i<BENCH_JSON_LOOP; i++) {
+        u32_bench_sink = bench_json_snprintf(bench_json_buf, &power_data, &t);
+    }
+    bench_print("json snprintf", time_us_64() - u64_start, BENCH_JSON_LOOP, 0);
+
+    u64_start = time_us_64();
+    for(int i=0; i<BENCH_JSON_LOOP; i++) {
+        u32_bench_sink = data_format_json(bench_json_buf, &power_data, &t);
+    }
+    bench_print("json fmt", time_us_64() - u64_start, BENCH_JSON_LOOP, 0);
+}
+
+// draw 2 different strings in turn so every draw changes the frame
+static void bench_gfx_kernel(const char* name, t_gfx_char_kernel kernel, const t_gfx_font* p_font, int y) {
+    static const char* strings[2] = { "-12345", "678.90" };
+    uint32_t u32_pixels = 0;
+    uint64_t u64_start = time_us_64();
+    for(int i=0; i<BENCH_GFX_LOOP; i++) {
+        int x = 1;
+        for(const char* p = strings[i & 1]; *p; p++) {
+            int advance = kernel(&bench_gfx_frame, p_font, x, y, *p);
+            u32_pixels += advance * p_font->u8_height;
+            x += advance;
+        }
+    }
+    uint64_t u64_us = time_us_64() - u64_start;
+    uint32_t u32_px_us_x100 = (u64_us > 0) ? (uint32_t)(((uint64_t)u32_pixels * 100) / u64_us) : 0;
+    printf("%-16s %6u ns/string %4u.%02u px/us\n", name, (uint32_t)((u64_us * 1000) / BENCH_GFX_LOOP),
+            u32_px_us_x100 / 100, u32_px_us_x100 % 100);
+}
+
+// pixel by pixel then blit, both must leave the same frame
+static void bench_gfx_font(const char* p_pixel_name, const char* p_blit_name, const t_gfx_font* p_font, int y) {
+    memset(&bench_gfx_frame, 0, sizeof(bench_gfx_frame));
+    bench_gfx_kernel(p_pixel_name, gfx_draw_char_pixels, p_font, y);
+    memcpy(bench_gfx_ref, bench_gfx_frame.buf, SSD1306_BUF_LEN);
+    memset(&bench_gfx_frame, 0, sizeof(bench_gfx_frame));
+    bench_gfx_kernel(p_blit_name, gfx_draw_char, p_font, y);
+    if( memcmp(bench_gfx_ref, bench_gfx_frame.buf, SSD1306_BUF_LEN) != 0 ) {
+        printf("%s differs from %s\n", p_blit_name, p_pixel_name);
+    }
+}
+
+static void bench_gfx(void) {
+    // y not on a page boundary, glyphs cover two pages (four for 16x24)
+    bench_gfx_font("8x8 set_pixel", "8x8 blit", &gfx_font_8x8, 3);
+    bench_gfx_font("prop set_pixel", "prop blit", &gfx_font_prop, 3);
+    bench_gfx_font("16x24 set_pixel", "16x24 blit", &gfx_font_digits_16x24, 21);
+}
+
+void bench_run(void) {
+    for(int i=0; i<BENCH_FRAME_SIZE; i++) {
+        bench_frame[i] = (uint8_t)(i * 7 + 1);
+    }
+
+    printf("bench crc16 %u bytes frame, kernel in use %s\n", BENCH_FRAME_SIZE,
+            (MODBUS_CRC_KERNEL == MODBUS_CRC_KERNEL_TABLE8) ? "table8" : "slice4");
+    bench_crc_kernel("crc16 table8", modbus_crc16_update_table8);
+    bench_crc_kernel("crc16 slice4", modbus_crc16_update_slice4);
+
+    printf("bench 0x0048 block decoding\n");
+    bench_decode();
+
+    printf("bench json record, cycles per record\n");
+    bench_json();
+
+    printf("bench glyphs, 6 chars strings at unaligned y\n");
+    bench_gfx();
+}
@@ -0,0 +1,6 @@
+#ifndef BENCH_H__
+#define BENCH_H__
+
+void bench_run(void);
+
+#endif // BENCH_H__
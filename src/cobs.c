@@ -0,0 +1,31 @@
+#include <stdint.h>
+#include "cobs.h"
+
+/*
+Consistent Overhead Byte Stuffing : encoded data has no 0x00 byte, so 0x00
+can be used as frame delimiter. Each block starts with a code byte giving
+the distance to the next 0x00 (or 0xFF for a 254 bytes block without 0x00).
+*/
+
+// encode u32_len bytes of p_src in p_dst, return encoded size (delimiter not added)
+uint32_t cobs_encode(const uint8_t* p_src, uint32_t u32_len, uint8_t* p_dst) {
+    uint8_t* p_code = p_dst;    // code byte of current block
+    uint8_t* p_out = p_dst + 1;
+    uint8_t u8_code = 1;
+
+    for(uint32_t i=0; i<u32_len; i++) {
+        if( p_src[i] != 0 ) {
+            *p_out++ = p_src[i];
+            u8_code++;
+        }
+        if( (p_src[i] == 0) || (u8_code == 0xFF) ) {
+            // close block
+            *p_code = u8_code;
+            p_code = p_out++;
+            u8_code = 1;
+        }
+    }
+    *p_code = u8_code;
+
+    return (uint32_t)(p_out - p_dst);
+}
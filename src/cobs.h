@@ -0,0 +1,10 @@
+#ifndef COBS_H__
+#define COBS_H__
+#include <stdint.h>
+
+// worst case encoded size of a len bytes buffer, without the 0x00 delimiter
+#define COBS_MAX_ENCODED_SIZE(len) ((len) + ((len) / 254) + 1)
+
+uint32_t cobs_encode(const uint8_t* p_src, uint32_t u32_len, uint8_t* p_dst);
+
+#endif // COBS_H__
@@ -1,46 +1,366 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 #include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
 #include "hardware/rtc.h"
 #include "pico/util/datetime.h"
 #include "modbus.h"
+#include "modbus_crc.h"
+#include "cobs.h"
+#include "fmt.h"
+#include "data.h"
+#include "scheduler.h"
+
+/*
+Telemetry of the main meter on stdout, as selected by the subscription :
+fields, one sample out of n, minimum interval and encoding.
+
+The subscription is turned into a plan once, when it is set : the list of
+selected fields with their json key already built. Formatting a sample
+only walks the plan, and the RTC is only read when the time is selected.
+
+Json : one line, selected fields in the order of enum data_field.
+
+Binary record (DATA_MODE_BINARY), all fields little endian, packed :
+
+    version     u8      DATA_RECORD_VERSION, all fields
+                        DATA_RECORD_VERSION_FIELDS, some fields
+    fields      u16     only in DATA_RECORD_VERSION_FIELDS, mask of the
+                        fields present, bit n is enum data_field n
+    idx         u32     sample index
+    datetime    u32     (year-2000)<<26 | month<<22 | day<<17 | hour<<12 | min<<6 | sec
+    V           u32     tension mV
+    F           u16     frequence mHz
+    voie[2]
+        I       u32     courant mA
+        P       i32     puissance active mW
+        E       u32     energie Wh
+        fp      u16     facteur puissance x1000
+    crc         u16     modbus CRC16 of previous bytes, low byte first
+
+With all fields the record is the DATA_RECORD_VERSION one (45 bytes).
+The record is COBS encoded and followed by a 0x00 delimiter.
+
+Modbus server registers (data_format_registers), every field whatever the
+subscription : field n of enum data_field on registers 2n and 2n+1, 32 bits
+high word first, datetime packed like in the binary record, P signed.
+*/
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+#define DATA_RECORD_VERSION 1
+#define DATA_RECORD_VERSION_FIELDS 2
+// version, field mask, every field, crc
+#define DATA_RECORD_MAX_SIZE (1 + 2 + 41 + 2)
+
+/*****************************************************************************/
+/*            PRIVATE TYPE                                                   */
+/*****************************************************************************/
+enum data_format {
+    DATA_FORMAT_U32=0,     // integer
+    DATA_FORMAT_MILLI_U32, // 3 decimals
+    DATA_FORMAT_MILLI_I32,
+    DATA_FORMAT_TIME       // iso 8601 in json, packed u32 in binary
+};
+
+typedef struct
+{
+    const char* p_name;
+    enum data_format format;
+    uint8_t u8_offset;     // in t_power_data
+    uint8_t u8_bin_size;   // 2 or 4 bytes
+}t_data_field;
+
+// one selected field, json key with its separator
+typedef struct
+{
+    const t_data_field* p_field;
+    char key[8];
+    uint8_t u8_key_len;
+}t_data_step;
+
+typedef struct
+{
+    uint8_t u8_nb_step;
+    bool b_time;           // RTC needed
+    t_data_step steps[DATA_NB_FIELD];
+}t_data_plan;
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static const t_data_field data_fields[DATA_NB_FIELD] = {
+    [DATA_FIELD_IDX]  = { "idx",  DATA_FORMAT_U32,       offsetof(t_power_data, u32_index), 4 },
+    [DATA_FIELD_TIME] = { "time", DATA_FORMAT_TIME,      0, 4 },
+    [DATA_FIELD_V]    = { "V",    DATA_FORMAT_MILLI_U32, offsetof(t_power_data, tension_mv), 4 },
+    [DATA_FIELD_F]    = { "F",    DATA_FORMAT_MILLI_U32, offsetof(t_power_data, frequence_mhz), 2 },
+    [DATA_FIELD_I1]   = { "I1",   DATA_FORMAT_MILLI_U32, offsetof(t_power_data, voie[0].courant_ma), 4 },
+    [DATA_FIELD_P1]   = { "P1",   DATA_FORMAT_MILLI_I32, offsetof(t_power_data, voie[0].puissance_active_mw), 4 },
+    [DATA_FIELD_E1]   = { "E1",   DATA_FORMAT_U32,       offsetof(t_power_data, voie[0].energie_wh), 4 },
+    [DATA_FIELD_FP1]  = { "fp1",  DATA_FORMAT_MILLI_U32, offsetof(t_power_data, voie[0].facteur_puissance), 2 },
+    [DATA_FIELD_I2]   = { "I2",   DATA_FORMAT_MILLI_U32, offsetof(t_power_data, voie[1].courant_ma), 4 },
+    [DATA_FIELD_P2]   = { "P2",   DATA_FORMAT_MILLI_I32, offsetof(t_power_data, voie[1].puissance_active_mw), 4 },
+    [DATA_FIELD_E2]   = { "E2",   DATA_FORMAT_U32,       offsetof(t_power_data, voie[1].energie_wh), 4 },
+    [DATA_FIELD_FP2]  = { "fp2",  DATA_FORMAT_MILLI_U32, offsetof(t_power_data, voie[1].facteur_puissance), 2 },
+};
+
+_Static_assert(DATA_NB_FIELD <= 16, "binary field mask is 16 bits");
 
 uint32_t u32_LastSendIndex = 0;
 bool b_simu = false;
+static t_data_subscription subscription = {
+    .u32_fields = DATA_FIELDS_ALL,
+    .u32_decimation = 1,
+    .u32_min_interval_ms = 0,
+    .mode = DATA_MODE_JSON
+};
+static t_data_plan plan;
+static uint32_t u32_decimation_count = 0;
+static uint32_t u32_last_send_us = 0;
+static bool b_sent = false;
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+static void data_plan(void) {
+    memset(&plan, 0, sizeof(plan));
+    for(uint32_t f=0; f<DATA_NB_FIELD; f++) {
+        if( !(subscription.u32_fields & (1u << f)) ) {
+            continue;
+        }
+        t_data_step* p_step = &plan.steps[plan.u8_nb_step];
+        p_step->p_field = &data_fields[f];
+        // {"idx": for the first one, ,"P1": for the next ones
+        char* p = p_step->key;
+        p = fmt_char(p, (plan.u8_nb_step == 0) ? '{' : ',');
+        p = fmt_char(p, '"');
+        p = fmt_str(p, data_fields[f].p_name);
+        p = fmt_str(p, "\":");
+        p_step->u8_key_len = (uint8_t)(p - p_step->key);
+        plan.b_time |= (data_fields[f].format == DATA_FORMAT_TIME);
+        plan.u8_nb_step++;
+    }
+}
+
+// datetime is packed in 32 bits
+static uint32_t data_field_value(const t_data_field* p_field, const t_power_data* p_power_data, const datetime_t* p_t) {
+    if( p_field->format == DATA_FORMAT_TIME ) {
+        return ((uint32_t)(p_t->year - 2000) << 26) | ((uint32_t)p_t->month << 22) | ((uint32_t)p_t->day << 17)
+             | ((uint32_t)p_t->hour << 12) | ((uint32_t)p_t->min << 6) | (uint32_t)p_t->sec;
+    }
+    uint32_t u32_value;
+    memcpy(&u32_value, (const uint8_t*)p_power_data + p_field->u8_offset, sizeof(u32_value));
+    return u32_value;
+}
+
+// build a json line of the subscribed fields in buf, return its length
+uint32_t data_format_json(char* buf, const t_power_data* p_power_data, const datetime_t* p_t) {
+    char* p = buf;
+    for(uint32_t s=0; s<plan.u8_nb_step; s++) {
+        const t_data_step* p_step = &plan.steps[s];
+        memcpy(p, p_step->key, p_step->u8_key_len);
+        p += p_step->u8_key_len;
+        uint32_t u32_value = data_field_value(p_step->p_field, p_power_data, p_t);
+        switch( p_step->p_field->format ) {
+            case DATA_FORMAT_U32:
+                p = fmt_u32(p, u32_value);
+                break;
+            case DATA_FORMAT_MILLI_U32:
+                p = fmt_milli_u32(p, u32_value, 3);
+                break;
+            case DATA_FORMAT_MILLI_I32:
+                p = fmt_milli_i32(p, (int32_t)u32_value, 3);
+                break;
+            case DATA_FORMAT_TIME:
+                // format to iso 8601 YYYY-MM-DDTHH:MM:SS
+                p = fmt_char(p, '"');
+                p = fmt_u32(p, p_t->year);
+                p = fmt_char(p, '-');
+                p = fmt_u32_pad(p, p_t->month, 2, '0');
+                p = fmt_char(p, '-');
+                p = fmt_u32_pad(p, p_t->day, 2, '0');
+                p = fmt_char(p, 'T');
+                p = fmt_u32_pad(p, p_t->hour, 2, '0');
+                p = fmt_char(p, ':');
+                p = fmt_u32_pad(p, p_t->min, 2, '0');
+                p = fmt_char(p, ':');
+                p = fmt_u32_pad(p, p_t->sec, 2, '0');
+                p = fmt_char(p, '"');
+                break;
+        }
+    }
+    if( plan.u8_nb_step == 0 ) {
+        p = fmt_char(p, '{');
+    }
+    p = fmt_str(p, "}\n");
+    return (uint32_t)(p - buf);
+}
+
+// build a binary record of the subscribed fields in buf, return its length
+static uint32_t data_format_binary(uint8_t* buf, const t_power_data* p_power_data, const datetime_t* p_t) {
+    uint8_t* p = buf;
+    if( subscription.u32_fields == DATA_FIELDS_ALL ) {
+        *p++ = DATA_RECORD_VERSION;
+    } else {
+        *p++ = DATA_RECORD_VERSION_FIELDS;
+        *p++ = (uint8_t)subscription.u32_fields;
+        *p++ = (uint8_t)(subscription.u32_fields >> 8);
+    }
+    for(uint32_t s=0; s<plan.u8_nb_step; s++) {
+        const t_data_field* p_field = plan.steps[s].p_field;
+        uint32_t u32_value = data_field_value(p_field, p_power_data, p_t);
+        // little endian, 2 bytes fields are truncated
+        memcpy(p, &u32_value, p_field->u8_bin_size);
+        p += p_field->u8_bin_size;
+    }
+    // CRC low byte first, like on modbus
+    uint16_t u16_crc = modbus_crc16_update(MODBUS_CRC_INIT, buf, (uint32_t)(p - buf));
+    *p++ = (uint8_t)u16_crc;
+    *p++ = (uint8_t)(u16_crc >> 8);
+    return (uint32_t)(p - buf);
+}
+
+// Modbus server registers of every field in p_regs, big endian, return their number
+uint16_t data_format_registers(uint8_t* p_regs, const t_power_data* p_power_data, const datetime_t* p_t) {
+    uint8_t* p = p_regs;
+    for(uint32_t f=0; f<DATA_NB_FIELD; f++) {
+        uint32_t u32_value = data_field_value(&data_fields[f], p_power_data, p_t);
+        *p++ = (uint8_t)(u32_value >> 24);
+        *p++ = (uint8_t)(u32_value >> 16);
+        *p++ = (uint8_t)(u32_value >> 8);
+        *p++ = (uint8_t)u32_value;
+    }
+    return DATA_NB_REGISTER;
+}
+
+static void data_send_json(t_power_data* p_power_data, datetime_t* p_t) {
+    char json_buf[DATA_JSON_MAX_LEN];
+    uint32_t u32_len = data_format_json(json_buf, p_power_data, p_t);
+    // single write
+    fwrite(json_buf, 1, u32_len, stdout);
+    fflush(stdout);
+}
+
+static void data_send_binary(t_power_data* p_power_data, datetime_t* p_t) {
+    uint8_t record[DATA_RECORD_MAX_SIZE];
+    uint8_t frame[COBS_MAX_ENCODED_SIZE(DATA_RECORD_MAX_SIZE) + 1];
+
+    uint32_t u32_len = data_format_binary(record, p_power_data, p_t);
+    u32_len = cobs_encode(record, u32_len, frame);
+    frame[u32_len++] = 0x00;
+
+    // single write
+    fwrite(frame, 1, u32_len, stdout);
+    fflush(stdout);
+}
+
+void data_init(void) {
+    data_plan();
+}
 
 void data_loop(void) {
- 
-    // get power data 
+
+    // get power data
     t_power_data* p_power_data = modbus_get_power_data();
 
-    // send data if new recent data
+    // new recent data, or the last one again in simu
     absolute_time_t cur_time = get_absolute_time();
     int64_t diff_us = absolute_time_diff_us(p_power_data->time, cur_time);
     // if data has less than one second
-    if( ((diff_us < (1*1000*1000)) && (u32_LastSendIndex != p_power_data->u32_index)) || (b_simu) ) {
-        u32_LastSendIndex = p_power_data->u32_index;
+    if( !(((diff_us < (1*1000*1000)) && (u32_LastSendIndex != p_power_data->u32_index)) || (b_simu)) ) {
+        return;
+    }
+    uint32_t u32_now_us = time_us_32();
+    uint32_t u32_interval_us = subscription.u32_min_interval_ms * 1000;
+    uint32_t u32_elapsed_us = u32_now_us - u32_last_send_us;
+    if( b_sent && (u32_elapsed_us < u32_interval_us) ) {
+        if( b_simu ) {
+            sched_wake_in_us(SCHED_TASK_DATA, u32_interval_us - u32_elapsed_us);
+        } else {
+            // sample skipped
+            u32_LastSendIndex = p_power_data->u32_index;
+        }
+        return;
+    }
+    u32_LastSendIndex = p_power_data->u32_index;
+    u32_decimation_count++;
+    if( u32_decimation_count >= subscription.u32_decimation ) {
+        u32_decimation_count = 0;
+        u32_last_send_us = u32_now_us;
+        b_sent = true;
+
         // send data on stdout
         datetime_t t;
-        char datetime_buf[256];
-        rtc_get_datetime(&t);
-        // format to iso 8601 YYYY-MM-DDTHH:MM:SS
-        snprintf(datetime_buf, sizeof(datetime_buf), "%d-%02d-%02dT%02d:%02d:%02d", t.year, t.month, t.day, t.hour, t.min, t.sec);
-        // use json format
-        printf("{");
-        printf("\"idx\":%u,", p_power_data->u32_index);
-        printf("\"time\":\"%s\",", datetime_buf); //p_power_data->time);
-        printf("\"V\":%u.%03u,", p_power_data->tension_mv/1000, p_power_data->tension_mv%1000);
-        printf("\"F\":%u.%03u", p_power_data->frequence_mhz/1000, p_power_data->frequence_mhz%1000);
-        for(int8_t i=0; i<2; i++) {
-            printf(",\"I%d\":%u.%03u", i+1, p_power_data->voie[i].courant_ma/1000, p_power_data->voie[i].courant_ma%1000);
-            printf(",\"P%d\":%d.%03u", i+1, p_power_data->voie[i].puissance_active_mw/1000, abs(p_power_data->voie[i].puissance_active_mw)%1000);
-            printf(",\"E%d\":%u", i+1, p_power_data->voie[i].energie_wh);
-            printf(",\"fp%d\":%u.%03u", i+1, p_power_data->voie[i].facteur_puissance/1000, p_power_data->voie[i].facteur_puissance%1000);
-        }
-        printf("}\n");
+        if( plan.b_time ) {
+            rtc_get_datetime(&t);
+        }
+        if( subscription.mode == DATA_MODE_BINARY ) {
+            data_send_binary(p_power_data, &t);
+        } else {
+            data_send_json(p_power_data, &t);
+        }
+        latency_stamp(p_power_data->u32_stage_us, LATENCY_STAGE_TELEMETRY);
+    }
+    if( b_simu ) {
+        // stress test, send as fast as the subscription allows
+        sched_wake_in_us(SCHED_TASK_DATA, u32_interval_us);
     }
 }
 
 void data_toggle_simu(void) {
     b_simu = !b_simu;
-}
\ No newline at end of file
+    sched_post(SCHED_TASK_DATA);
+}
+
+void data_set_mode(enum data_mode mode) {
+    subscription.mode = mode;
+    // binary frames must not get a \r before each 0x0A byte
+    stdio_set_translate_crlf(&stdio_usb, mode != DATA_MODE_BINARY);
+}
+
+// core0 : new subscription, applied from the next sample
+void data_subscribe(const t_data_subscription* p_subscription) {
+    subscription = *p_subscription;
+    if( subscription.u32_decimation == 0 ) {
+        subscription.u32_decimation = 1;
+    }
+    subscription.u32_fields &= DATA_FIELDS_ALL;
+    data_set_mode(subscription.mode);
+    data_plan();
+    u32_decimation_count = 0;
+    b_sent = false;
+}
+
+void data_get_subscription(t_data_subscription* p_subscription) {
+    *p_subscription = subscription;
+}
+
+// comma separated field names to mask, false on unknown name
+bool data_parse_fields(const char* p_list, uint32_t* p_fields) {
+    uint32_t u32_fields = 0;
+    while( *p_list != '\0' ) {
+        const char* p_end = strchr(p_list, ',');
+        size_t len = (p_end == NULL) ? strlen(p_list) : (size_t)(p_end - p_list);
+        uint32_t f = 0;
+        while( (f < DATA_NB_FIELD) && !((strlen(data_fields[f].p_name) == len) && (0 == strncmp(data_fields[f].p_name, p_list, len))) ) {
+            f++;
+        }
+        if( f == DATA_NB_FIELD ) {
+            return false;
+        }
+        u32_fields |= 1u << f;
+        p_list += len;
+        if( *p_list == ',' ) {
+            p_list++;
+        }
+    }
+    *p_fields = u32_fields;
+    return true;
+}
+
+const char* data_field_name(enum data_field field) {
+    return data_fields[field].p_name;
+}
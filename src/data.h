@@ -1,8 +1,54 @@
 #ifndef DATA_H__
 #define DATA_H__
+#include "pico/util/datetime.h"
+#include "modbus.h"
 
+// longest json line is ~230 chars
+#define DATA_JSON_MAX_LEN 256
+
+enum data_mode {
+    DATA_MODE_JSON=0,
+    DATA_MODE_BINARY
+};
+
+// telemetry fields, in output order
+enum data_field {
+    DATA_FIELD_IDX=0,
+    DATA_FIELD_TIME,
+    DATA_FIELD_V,
+    DATA_FIELD_F,
+    DATA_FIELD_I1,
+    DATA_FIELD_P1,
+    DATA_FIELD_E1,
+    DATA_FIELD_FP1,
+    DATA_FIELD_I2,
+    DATA_FIELD_P2,
+    DATA_FIELD_E2,
+    DATA_FIELD_FP2,
+    DATA_NB_FIELD
+};
+#define DATA_FIELDS_ALL ((1u << DATA_NB_FIELD) - 1)
+// Modbus server registers, two per field
+#define DATA_NB_REGISTER (2 * DATA_NB_FIELD)
+
+typedef struct
+{
+    uint32_t u32_fields;          // mask of 1 << enum data_field
+    uint32_t u32_decimation;      // one sample out of n is sent
+    uint32_t u32_min_interval_ms; // between two sent samples
+    enum data_mode mode;
+}t_data_subscription;
+
+void data_init(void);
 void data_loop(void);
 void data_toggle_simu(void);
+void data_set_mode(enum data_mode mode);
+void data_subscribe(const t_data_subscription* p_subscription);
+void data_get_subscription(t_data_subscription* p_subscription);
+bool data_parse_fields(const char* p_list, uint32_t* p_fields);
+const char* data_field_name(enum data_field field);
+uint32_t data_format_json(char* buf, const t_power_data* p_power_data, const datetime_t* p_t);
+uint16_t data_format_registers(uint8_t* p_regs, const t_power_data* p_power_data, const datetime_t* p_t);
 
 
-#endif // DATA_H__
\ No newline at end of file
+#endif // DATA_H__
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "modbus.h"
+#include "triac.h"
+#include "scheduler.h"
+#include "diverter.h"
+
+/*
+Solar surplus diverter : a PI controller keeps the grid power of the main
+meter at a small import by driving a resistive load, either through a
+zero-cross SSR or through the triac driver (phase angle or whole cycles).
+
+Everything runs on core1 : the controller is called by the Modbus client
+as soon as an answer of the main meter is decoded, and the burst-fire
+output is stepped by the core1 loop. The time from the end of the answer
+on the UART to the new duty cycle is measured on every sample. The duty
+only reaches the SSR at the next cycle decision, up to DIVERTER_CYCLE_US
+later : the time from the answer to that decision is measured apart, as
+the output latency. The triac outputs apply the duty in the triac driver,
+their wait for the next half cycle is not measured.
+
+Controller, integer only, in velocity form so clamping the output is
+enough against windup :
+    load += (kp * (e - e_prev) + ki * dt * e) / 256, e = target - grid
+The load in mW is turned into a duty cycle with a compile-time reciprocal.
+
+Burst-fire : the SSR switches at zero crossing, so the output is chosen
+per mains cycle with a first order sigma-delta, which spreads the on
+cycles evenly (lowest flicker for a given duty). Whole cycles keep both
+polarities equal, no DC goes through the load, like the triac cycle mode.
+With the mains seen by the triac zero-cross detector, the SSR input
+changes DIVERTER_SSR_LEAD_US before every other zero crossing, else every
+DIVERTER_CYCLE_US from the timer. The output is forced off when no sample
+arrives for DIVERTER_SAMPLE_TIMEOUT_US.
+With a triac output the duty goes to the triac driver as its power and
+the SSR stays off.
+*/
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+// 50 Hz mains
+#define DIVERTER_CYCLE_US 20000
+// SSR input set before the zero crossing that starts a cycle
+#define DIVERTER_SSR_LEAD_US 1000
+#define DIVERTER_SAMPLE_TIMEOUT_US (5 * 1000 * 1000)
+// longer gaps between samples don't grow the integral more
+#define DIVERTER_MAX_DT_MS 2000
+#define DIVERTER_DEFAULT_KP_X256 128 // 0.5
+#define DIVERTER_DEFAULT_KI_X256 256 // 1 per second
+// ki * dt must fit 32 bits
+#define DIVERTER_MAX_GAIN_X256 65535
+// duty = load * DIVERTER_MW_TO_DUTY_Q32 >> 32
+#define DIVERTER_MW_TO_DUTY_Q32 ((((uint64_t)DIVERTER_DUTY_ONE) << 32) / DIVERTER_LOAD_MW)
+
+_Static_assert(DIVERTER_DUTY_ONE == TRIAC_POWER_ONE, "duty is the triac power");
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+// set by core0
+static volatile bool b_diverter_enabled = false;
+static volatile enum diverter_output diverter_output = DIVERTER_OUTPUT_SSR;
+static volatile int32_t i32_diverter_target_mw = DIVERTER_DEFAULT_TARGET_MW;
+static volatile uint32_t u32_diverter_kp_x256 = DIVERTER_DEFAULT_KP_X256;
+static volatile uint32_t u32_diverter_ki_x256 = DIVERTER_DEFAULT_KI_X256;
+
+// core1
+static bool b_previous = false; // previous error valid
+static int32_t i32_previous_error_mw = 0;
+static uint32_t u32_previous_rx_us = 0;
+static uint32_t u32_last_sample_us = 0;
+static int32_t i32_grid_mw = 0;
+static int32_t i32_load_mw = 0;
+static volatile uint32_t u32_duty = 0;
+static uint32_t u32_sigma_delta = 0;
+static uint64_t u64_next_cycle_us = 0;
+static bool b_output_pending = false; // sample not yet applied to the SSR
+static uint32_t u32_output_rx_us = 0;
+static t_diverter_stats stats;
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+// core1
+void diverter_init(void) {
+    gpio_init(DIVERTER_SSR_GPIO);
+    gpio_set_dir(DIVERTER_SSR_GPIO, GPIO_OUT);
+    gpio_put(DIVERTER_SSR_GPIO, false);
+    memset(&stats, 0, sizeof(stats));
+    stats.u32_latency_min_us = UINT32_MAX;
+    stats.u32_output_latency_min_us = UINT32_MAX;
+    u64_next_cycle_us = time_us_64();
+}
+
+static void diverter_set_load(int32_t i32_mw) {
+    i32_load_mw = i32_mw;
+    u32_duty = (uint32_t)(((uint64_t)i32_mw * DIVERTER_MW_TO_DUTY_Q32) >> 32);
+    switch( diverter_output ) {
+        case DIVERTER_OUTPUT_PHASE:
+            triac_set(TRIAC_MODE_PHASE, u32_duty);
+            break;
+        case DIVERTER_OUTPUT_CYCLE:
+            triac_set(TRIAC_MODE_CYCLE, u32_duty);
+            break;
+        default:
+            // the triac is free for manual tests
+            break;
+    }
+}
+
+// core1 : every decoded sample, the grid one updates the output
+void diverter_sample(uint8_t u8_slave, const t_power_data* p_data) {
+    if( u8_slave != DIVERTER_GRID_SLAVE ) {
+        return;
+    }
+    i32_grid_mw = p_data->voie[DIVERTER_GRID_CHANNEL].puissance_active_mw;
+    u32_last_sample_us = p_data->u32_stage_us[LATENCY_STAGE_RX_LAST];
+
+    if( !b_diverter_enabled ) {
+        b_previous = false;
+        diverter_set_load(0);
+        return;
+    }
+
+    int32_t i32_error_mw = i32_diverter_target_mw - i32_grid_mw;
+    if( b_previous ) {
+        uint32_t u32_dt_ms = (p_data->u32_stage_us[LATENCY_STAGE_RX_LAST] - u32_previous_rx_us) / 1000;
+        if( u32_dt_ms > DIVERTER_MAX_DT_MS ) {
+            u32_dt_ms = DIVERTER_MAX_DT_MS;
+        }
+        uint32_t u32_ki_dt_x256 = u32_diverter_ki_x256 * u32_dt_ms / 1000;
+        int64_t i64_delta = (int64_t)u32_diverter_kp_x256 * (i32_error_mw - i32_previous_error_mw)
+                          + (int64_t)u32_ki_dt_x256 * i32_error_mw;
+        int64_t i64_load_mw = i32_load_mw + (i64_delta >> 8);
+        if( i64_load_mw < 0 ) {
+            i64_load_mw = 0;
+        } else if( i64_load_mw > DIVERTER_LOAD_MW ) {
+            i64_load_mw = DIVERTER_LOAD_MW;
+        }
+        diverter_set_load((int32_t)i64_load_mw);
+    }
+    b_previous = true;
+    i32_previous_error_mw = i32_error_mw;
+    u32_previous_rx_us = p_data->u32_stage_us[LATENCY_STAGE_RX_LAST];
+
+    // the SSR input follows at the next cycle decision
+    b_output_pending = (diverter_output == DIVERTER_OUTPUT_SSR);
+    u32_output_rx_us = p_data->u32_stage_us[LATENCY_STAGE_RX_LAST];
+
+    // answer on the wire to duty updated
+    uint32_t u32_latency_us = time_us_32() - p_data->u32_stage_us[LATENCY_STAGE_RX_LAST];
+    stats.u32_update++;
+    stats.u32_latency_us = u32_latency_us;
+    stats.u64_latency_sum_us += u32_latency_us;
+    if( u32_latency_us < stats.u32_latency_min_us ) {
+        stats.u32_latency_min_us = u32_latency_us;
+    }
+    if( u32_latency_us > stats.u32_latency_max_us ) {
+        stats.u32_latency_max_us = u32_latency_us;
+    }
+}
+
+// core1 : time of the burst-fire decision after the one of u64_now_us
+static uint64_t diverter_next_cycle_us(uint64_t u64_now_us) {
+    t_triac_status mains;
+    triac_get_status(&mains);
+    if( mains.b_mains_ok ) {
+        // even zero crossings start a cycle, the first one far enough from now
+        uint64_t u64_period_us = 2 * (uint64_t)mains.u32_half_period_us;
+        uint64_t u64_cross_us = mains.u64_zero_cross_us + ((mains.u32_zero_cross & 1) ? mains.u32_half_period_us : u64_period_us);
+        while( (int64_t)(u64_cross_us - DIVERTER_SSR_LEAD_US - u64_now_us) < (DIVERTER_CYCLE_US / 2) ) {
+            u64_cross_us += u64_period_us;
+        }
+        return u64_cross_us - DIVERTER_SSR_LEAD_US;
+    }
+    // restart from now after a long stall (core1 locked out)
+    if( (u64_now_us - u64_next_cycle_us) >= DIVERTER_CYCLE_US ) {
+        return u64_now_us + DIVERTER_CYCLE_US;
+    }
+    return u64_next_cycle_us + DIVERTER_CYCLE_US;
+}
+
+// core1 : burst-fire output, one decision per mains cycle
+void diverter_loop(void) {
+    uint64_t u64_now_us = time_us_64();
+    int64_t i64_wait_us = (int64_t)(u64_next_cycle_us - u64_now_us);
+    if( i64_wait_us > 0 ) {
+        sched_wake_in_us(SCHED_TASK_DIVERTER, (uint32_t)i64_wait_us);
+        return;
+    }
+    u64_next_cycle_us = diverter_next_cycle_us(u64_now_us);
+
+    // meter lost : don't keep a load on that may import
+    if( (u32_duty != 0) && (((uint32_t)u64_now_us - u32_last_sample_us) > DIVERTER_SAMPLE_TIMEOUT_US) ) {
+        b_previous = false;
+        diverter_set_load(0);
+        stats.u32_timeout++;
+    }
+    if( !b_diverter_enabled ) {
+        diverter_set_load(0);
+    }
+
+    u32_sigma_delta += (diverter_output == DIVERTER_OUTPUT_SSR) ? u32_duty : 0;
+    bool b_on = u32_sigma_delta >= DIVERTER_DUTY_ONE;
+    if( b_on ) {
+        u32_sigma_delta -= DIVERTER_DUTY_ONE;
+        stats.u32_cycle_on++;
+    }
+    stats.u32_cycle++;
+    gpio_put(DIVERTER_SSR_GPIO, b_on);
+
+    // answer on the wire to SSR input set
+    if( b_output_pending ) {
+        b_output_pending = false;
+        uint32_t u32_latency_us = time_us_32() - u32_output_rx_us;
+        stats.u32_output++;
+        stats.u32_output_latency_us = u32_latency_us;
+        stats.u64_output_latency_sum_us += u32_latency_us;
+        if( u32_latency_us < stats.u32_output_latency_min_us ) {
+            stats.u32_output_latency_min_us = u32_latency_us;
+        }
+        if( u32_latency_us > stats.u32_output_latency_max_us ) {
+            stats.u32_output_latency_max_us = u32_latency_us;
+        }
+    }
+    sched_wake_in_us(SCHED_TASK_DIVERTER, (uint32_t)(u64_next_cycle_us - u64_now_us));
+}
+
+// core0
+void diverter_enable(bool b_enabled) {
+    b_diverter_enabled = b_enabled;
+}
+
+void diverter_set_output(enum diverter_output output) {
+    if( (diverter_output != DIVERTER_OUTPUT_SSR) && (output == DIVERTER_OUTPUT_SSR) ) {
+        triac_set(TRIAC_MODE_OFF, 0);
+    }
+    diverter_output = output;
+}
+
+void diverter_set_target_mw(int32_t i32_target_mw) {
+    i32_diverter_target_mw = i32_target_mw;
+}
+
+void diverter_set_gains(uint32_t u32_kp_x256, uint32_t u32_ki_x256) {
+    u32_diverter_kp_x256 = (u32_kp_x256 > DIVERTER_MAX_GAIN_X256) ? DIVERTER_MAX_GAIN_X256 : u32_kp_x256;
+    u32_diverter_ki_x256 = (u32_ki_x256 > DIVERTER_MAX_GAIN_X256) ? DIVERTER_MAX_GAIN_X256 : u32_ki_x256;
+}
+
+// core0 : copy of core1 state, fields may be from different samples
+void diverter_get_status(t_diverter_status* p_status) {
+    p_status->b_enabled = b_diverter_enabled;
+    p_status->output = diverter_output;
+    p_status->i32_target_mw = i32_diverter_target_mw;
+    p_status->u32_kp_x256 = u32_diverter_kp_x256;
+    p_status->u32_ki_x256 = u32_diverter_ki_x256;
+    p_status->i32_grid_mw = i32_grid_mw;
+    p_status->i32_load_mw = i32_load_mw;
+    p_status->u32_duty = u32_duty;
+    p_status->stats = stats;
+}
@@ -0,0 +1,63 @@
+#ifndef DIVERTER_H__
+#define DIVERTER_H__
+#include "pico/stdlib.h"
+#include "modbus.h"
+
+// SSR of the diverted resistive load
+#define DIVERTER_SSR_GPIO 2
+// grid power is channel 1 of the main meter, negative when exporting
+#define DIVERTER_GRID_SLAVE 0
+#define DIVERTER_GRID_CHANNEL 0
+// rated power of the load at full duty
+#define DIVERTER_LOAD_MW (2000 * 1000)
+// small import kept as margin so the meter noise doesn't export
+#define DIVERTER_DEFAULT_TARGET_MW (30 * 1000)
+// duty cycle scale, DIVERTER_DUTY_ONE is full power
+#define DIVERTER_DUTY_ONE 65536
+
+enum diverter_output {
+    DIVERTER_OUTPUT_SSR=0,  // burst-fire on the SSR
+    DIVERTER_OUTPUT_PHASE,  // triac, phase angle
+    DIVERTER_OUTPUT_CYCLE   // triac, whole cycles
+};
+
+typedef struct
+{
+    uint32_t u32_update;     // samples processed
+    uint32_t u32_timeout;    // output forced off, no sample
+    uint32_t u32_cycle;      // burst-fire mains cycles
+    uint32_t u32_cycle_on;
+    uint32_t u32_latency_us; // answer received to duty updated, last sample, without the wait for the output
+    uint32_t u32_latency_min_us;
+    uint32_t u32_latency_max_us;
+    uint64_t u64_latency_sum_us;
+    uint32_t u32_output;     // SSR decisions taken from a new sample
+    uint32_t u32_output_latency_us; // answer received to SSR input set, last decision
+    uint32_t u32_output_latency_min_us;
+    uint32_t u32_output_latency_max_us;
+    uint64_t u64_output_latency_sum_us;
+}t_diverter_stats;
+
+typedef struct
+{
+    bool b_enabled;
+    enum diverter_output output;
+    int32_t i32_target_mw;
+    uint32_t u32_kp_x256;
+    uint32_t u32_ki_x256; // per second
+    int32_t i32_grid_mw;  // last measure
+    int32_t i32_load_mw;  // controller output
+    uint32_t u32_duty;    // 0..DIVERTER_DUTY_ONE
+    t_diverter_stats stats;
+}t_diverter_status;
+
+void diverter_init(void);
+void diverter_loop(void);
+void diverter_sample(uint8_t u8_slave, const t_power_data* p_data);
+void diverter_enable(bool b_enabled);
+void diverter_set_output(enum diverter_output output);
+void diverter_set_target_mw(int32_t i32_target_mw);
+void diverter_set_gains(uint32_t u32_kp_x256, uint32_t u32_ki_x256);
+void diverter_get_status(t_diverter_status* p_status);
+
+#endif // DIVERTER_H__
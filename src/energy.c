@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "modbus.h"
+#include "energy.h"
+
+/*
+Energy integrated on the device from the power of the main meter.
+
+The meter counter is in whole Wh and doesn't tell import from export, so
+short diversion bursts don't show in it. Here the signed active power of
+each channel is integrated over the sample times (trapezoids) into 64 bit
+import and export accumulators in mW.ms. When the power changes sign
+between two samples, the interval is split at the interpolated zero.
+An interval longer than ENERGY_MAX_GAP_US (meter lost, core1 stalled)
+isn't integrated, it is only counted.
+
+Hourly buckets are kept in a ring indexed by hour slot, like the history.
+An interval crossing the end of the hour is split there, at the
+interpolated power, and the sub mWh remainder of a closed hour is
+carried to the next one, so the buckets add up to the totals.
+
+Every ENERGY_RECONCILE_S the integrated energy of the window is compared
+with the increase of the meter counter. The JSY counter adds up the
+energy in both directions, so import + export is compared to it. The
+tolerance covers the 1 Wh truncation of the counter at each end of the
+window plus ENERGY_DRIFT_PERMIL of the energy. Windows holding a gap are
+skipped.
+
+Everything runs on core0, from the samples given by modbus_sync_power_data().
+*/
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+#define ENERGY_MAX_GAP_US (5 * 1000 * 1000)
+#define ENERGY_HOUR_S 3600
+#define ENERGY_RECONCILE_S (15 * 60)
+#define ENERGY_DRIFT_MIN_MWH 2000
+#define ENERGY_DRIFT_PERMIL 20
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static t_energy_status status;
+
+// previous sample
+static bool b_previous = false;
+static uint64_t u64_previous_us = 0;
+static int32_t i32_previous_mw[2];
+
+// current hour
+static uint32_t u32_hour_slot = 0;
+static t_energy_counter hour_acc[2];
+static t_energy_hour hours[ENERGY_NB_HOUR];
+
+// current reconcile window
+static uint32_t u32_window_slot = 0;
+static bool b_window_gap = false;
+static uint32_t u32_meter_ref_wh[2];
+static uint64_t u64_local_ref_mwms[2];
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+void energy_init(void) {
+    memset(&status, 0, sizeof(status));
+    // slot 0xFFFFFFFF is never queried
+    memset(hours, 0xFF, sizeof(hours));
+    memset(hour_acc, 0, sizeof(hour_acc));
+    b_previous = false;
+}
+
+static void energy_counter_add(uint8_t u8_channel, uint64_t u64_import_mwms, uint64_t u64_export_mwms) {
+    status.total[u8_channel].u64_import_mwms += u64_import_mwms;
+    status.total[u8_channel].u64_export_mwms += u64_export_mwms;
+    hour_acc[u8_channel].u64_import_mwms += u64_import_mwms;
+    hour_acc[u8_channel].u64_export_mwms += u64_export_mwms;
+}
+
+// trapezoid between two powers, split at the zero crossing
+static void energy_integrate(uint8_t u8_channel, int32_t i32_p0_mw, int32_t i32_p1_mw, uint32_t u32_dt_us) {
+    uint64_t u64_p0_mw = (i32_p0_mw < 0) ? -(int64_t)i32_p0_mw : i32_p0_mw;
+    uint64_t u64_p1_mw = (i32_p1_mw < 0) ? -(int64_t)i32_p1_mw : i32_p1_mw;
+    // area in mW.us, divided by 1000 once
+    if( (i32_p0_mw >= 0) == (i32_p1_mw >= 0) ) {
+        uint64_t u64_mwms = (u64_p0_mw + u64_p1_mw) * u32_dt_us / 2000;
+        if( i32_p0_mw >= 0 ) {
+            energy_counter_add(u8_channel, u64_mwms, 0);
+        } else {
+            energy_counter_add(u8_channel, 0, u64_mwms);
+        }
+    } else {
+        uint64_t u64_zero_us = u64_p0_mw * u32_dt_us / (u64_p0_mw + u64_p1_mw);
+        uint64_t u64_first_mwms = u64_p0_mw * u64_zero_us / 2000;
+        uint64_t u64_second_mwms = u64_p1_mw * (u32_dt_us - u64_zero_us) / 2000;
+        if( i32_p0_mw >= 0 ) {
+            energy_counter_add(u8_channel, u64_first_mwms, u64_second_mwms);
+        } else {
+            energy_counter_add(u8_channel, u64_second_mwms, u64_first_mwms);
+        }
+    }
+}
+
+static void energy_hour_close(void) {
+    t_energy_hour* p_hour = &hours[u32_hour_slot % ENERGY_NB_HOUR];
+    p_hour->u32_slot = u32_hour_slot;
+    for(uint8_t i=0; i<2; i++) {
+        p_hour->u32_import_mwh[i] = (uint32_t)(hour_acc[i].u64_import_mwms / ENERGY_MWMS_PER_MWH);
+        p_hour->u32_export_mwh[i] = (uint32_t)(hour_acc[i].u64_export_mwms / ENERGY_MWMS_PER_MWH);
+        // remainder goes to the next hour
+        hour_acc[i].u64_import_mwms %= ENERGY_MWMS_PER_MWH;
+        hour_acc[i].u64_export_mwms %= ENERGY_MWMS_PER_MWH;
+    }
+}
+
+static void energy_window_start(const t_power_data* p_data) {
+    b_window_gap = false;
+    for(uint8_t i=0; i<2; i++) {
+        u32_meter_ref_wh[i] = p_data->voie[i].energie_wh;
+        u64_local_ref_mwms[i] = status.total[i].u64_import_mwms + status.total[i].u64_export_mwms;
+    }
+}
+
+static void energy_reconcile(const t_power_data* p_data) {
+    for(uint8_t i=0; i<2; i++) {
+        t_energy_reconcile* p_reconcile = &status.reconcile[i];
+        if( b_window_gap ) {
+            p_reconcile->u32_skip++;
+            continue;
+        }
+        uint32_t u32_meter_wh = p_data->voie[i].energie_wh - u32_meter_ref_wh[i];
+        uint64_t u64_local_mwms = status.total[i].u64_import_mwms + status.total[i].u64_export_mwms - u64_local_ref_mwms[i];
+        int64_t i64_drift_mwh = (int64_t)(u64_local_mwms / ENERGY_MWMS_PER_MWH) - (int64_t)u32_meter_wh * 1000;
+        int64_t i64_tolerance_mwh = ENERGY_DRIFT_MIN_MWH + (int64_t)u32_meter_wh * ENERGY_DRIFT_PERMIL;
+        p_reconcile->u32_check++;
+        p_reconcile->i32_last_drift_mwh = (int32_t)i64_drift_mwh;
+        p_reconcile->i32_last_meter_wh = (int32_t)u32_meter_wh;
+        p_reconcile->i64_total_drift_mwh += i64_drift_mwh;
+        if( (i64_drift_mwh > i64_tolerance_mwh) || (-i64_drift_mwh > i64_tolerance_mwh) ) {
+            p_reconcile->u32_alarm++;
+            printf("energy: channel %u drift %lld mWh over %u Wh\n", i+1, (long long)i64_drift_mwh, u32_meter_wh);
+        }
+    }
+}
+
+// core0 : every sample popped from the acquisition queue, only the main meter is kept
+void energy_add(uint8_t u8_slave, const t_power_data* p_data) {
+    if( u8_slave != 0 ) {
+        return;
+    }
+    uint64_t u64_time_us = to_us_since_boot(p_data->time);
+    uint32_t u32_time_s = (uint32_t)(u64_time_us / 1000000);
+    status.u32_sample++;
+
+    if( !b_previous ) {
+        u32_hour_slot = u32_time_s / ENERGY_HOUR_S;
+        u32_window_slot = u32_time_s / ENERGY_RECONCILE_S;
+        energy_window_start(p_data);
+    } else {
+        uint64_t u64_dt_us = u64_time_us - u64_previous_us;
+        bool b_gap = u64_dt_us > ENERGY_MAX_GAP_US;
+        if( b_gap ) {
+            status.u32_gap++;
+            status.u64_gap_ms += u64_dt_us / 1000;
+            b_window_gap = true;
+        }
+        int32_t i32_start_mw[2] = { i32_previous_mw[0], i32_previous_mw[1] };
+        if( (u32_time_s / ENERGY_HOUR_S) != u32_hour_slot ) {
+            if( !b_gap ) {
+                // split at the end of the hour, at the interpolated power
+                uint64_t u64_hour_end_us = (uint64_t)(u32_hour_slot + 1) * ENERGY_HOUR_S * 1000000;
+                uint32_t u32_first_us = (uint32_t)(u64_hour_end_us - u64_previous_us);
+                for(uint8_t i=0; i<2; i++) {
+                    int64_t i64_delta_mw = (int64_t)p_data->voie[i].puissance_active_mw - i32_previous_mw[i];
+                    i32_start_mw[i] = i32_previous_mw[i] + (int32_t)(i64_delta_mw * u32_first_us / (int64_t)u64_dt_us);
+                    energy_integrate(i, i32_previous_mw[i], i32_start_mw[i], u32_first_us);
+                }
+                u64_dt_us -= u32_first_us;
+            }
+            energy_hour_close();
+            u32_hour_slot = u32_time_s / ENERGY_HOUR_S;
+        }
+        if( !b_gap ) {
+            for(uint8_t i=0; i<2; i++) {
+                energy_integrate(i, i32_start_mw[i], p_data->voie[i].puissance_active_mw, (uint32_t)u64_dt_us);
+            }
+        }
+        if( (u32_time_s / ENERGY_RECONCILE_S) != u32_window_slot ) {
+            energy_reconcile(p_data);
+            energy_window_start(p_data);
+            u32_window_slot = u32_time_s / ENERGY_RECONCILE_S;
+        }
+    }
+
+    b_previous = true;
+    u64_previous_us = u64_time_us;
+    for(uint8_t i=0; i<2; i++) {
+        i32_previous_mw[i] = p_data->voie[i].puissance_active_mw;
+    }
+}
+
+void energy_get_status(t_energy_status* p_status) {
+    *p_status = status;
+}
+
+// closed hour holding u32_time_s, false if no sample during that hour or too old
+bool energy_get_hour(uint32_t u32_time_s, t_energy_hour* p_hour) {
+    uint32_t u32_slot = u32_time_s / ENERGY_HOUR_S;
+    const t_energy_hour* p_stored = &hours[u32_slot % ENERGY_NB_HOUR];
+    if( p_stored->u32_slot != u32_slot ) {
+        return false;
+    }
+    *p_hour = *p_stored;
+    return true;
+}
+
+static void energy_print_mwh(const char* p_name, uint64_t u64_mwh) {
+    printf(" %s %llu.%03u Wh", p_name, (unsigned long long)(u64_mwh / 1000), (unsigned int)(u64_mwh % 1000));
+}
+
+void energy_print(void) {
+    printf("energy samples %u gaps %u lost %llu ms\n", status.u32_sample, status.u32_gap, (unsigned long long)status.u64_gap_ms);
+    for(uint8_t i=0; i<2; i++) {
+        const t_energy_reconcile* p_reconcile = &status.reconcile[i];
+        printf("channel %u", i+1);
+        energy_print_mwh("import", status.total[i].u64_import_mwms / ENERGY_MWMS_PER_MWH);
+        energy_print_mwh("export", status.total[i].u64_export_mwms / ENERGY_MWMS_PER_MWH);
+        printf("\n  meter check %u alarm %u skip %u last drift %d mWh over %d Wh total drift %lld mWh\n",
+                p_reconcile->u32_check, p_reconcile->u32_alarm, p_reconcile->u32_skip,
+                p_reconcile->i32_last_drift_mwh, p_reconcile->i32_last_meter_wh,
+                (long long)p_reconcile->i64_total_drift_mwh);
+    }
+}
+
+// last closed hours then the current one
+void energy_print_hours(uint32_t u32_nb_hour) {
+    if( u32_nb_hour > ENERGY_NB_HOUR ) {
+        u32_nb_hour = ENERGY_NB_HOUR;
+    }
+    uint32_t u32_from_slot = (u32_hour_slot > u32_nb_hour) ? u32_hour_slot - u32_nb_hour : 0;
+    for(uint32_t u32_slot = u32_from_slot; u32_slot < u32_hour_slot; u32_slot++) {
+        const t_energy_hour* p_hour = &hours[u32_slot % ENERGY_NB_HOUR];
+        if( p_hour->u32_slot != u32_slot ) {
+            continue;
+        }
+        printf("hour %u", u32_slot * ENERGY_HOUR_S);
+        for(uint8_t i=0; i<2; i++) {
+            printf(" ch%u", i+1);
+            energy_print_mwh("import", p_hour->u32_import_mwh[i]);
+            energy_print_mwh("export", p_hour->u32_export_mwh[i]);
+        }
+        printf("\n");
+    }
+    if( b_previous ) {
+        printf("hour %u (current)", u32_hour_slot * ENERGY_HOUR_S);
+        for(uint8_t i=0; i<2; i++) {
+            printf(" ch%u", i+1);
+            energy_print_mwh("import", hour_acc[i].u64_import_mwms / ENERGY_MWMS_PER_MWH);
+            energy_print_mwh("export", hour_acc[i].u64_export_mwms / ENERGY_MWMS_PER_MWH);
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef ENERGY_H__
+#define ENERGY_H__
+#include "pico/stdlib.h"
+#include "modbus.h"
+
+// accumulators are in mW.ms, 1 Wh is 3.6e9 mW.ms
+#define ENERGY_MWMS_PER_MWH 3600000ull
+#define ENERGY_MWMS_PER_WH  3600000000ull
+// hourly buckets kept in RAM
+#define ENERGY_NB_HOUR 48
+
+typedef struct
+{
+    uint64_t u64_import_mwms;
+    uint64_t u64_export_mwms;
+}t_energy_counter;
+
+// energy of one hour, time is u32_slot * 3600 in seconds since boot
+typedef struct
+{
+    uint32_t u32_slot;
+    uint32_t u32_import_mwh[2];
+    uint32_t u32_export_mwh[2];
+}t_energy_hour;
+
+// comparison of the integrated energy with the meter counter
+typedef struct
+{
+    uint32_t u32_check;        // closed reconcile windows
+    uint32_t u32_alarm;        // windows with a drift over the tolerance
+    uint32_t u32_skip;         // windows not checked (gap in the samples)
+    int32_t i32_last_drift_mwh; // integrated - meter, last window
+    int32_t i32_last_meter_wh;  // meter counter increase, last window
+    int64_t i64_total_drift_mwh; // integrated - meter, checked windows since boot
+}t_energy_reconcile;
+
+typedef struct
+{
+    t_energy_counter total[2];
+    uint32_t u32_sample;
+    uint32_t u32_gap;      // intervals not integrated
+    uint64_t u64_gap_ms;   // time lost in those
+    t_energy_reconcile reconcile[2];
+}t_energy_status;
+
+void energy_init(void);
+void energy_add(uint8_t u8_slave, const t_power_data* p_data);
+void energy_get_status(t_energy_status* p_status);
+bool energy_get_hour(uint32_t u32_time_s, t_energy_hour* p_hour);
+void energy_print(void);
+void energy_print_hours(uint32_t u32_nb_hour);
+
+#endif // ENERGY_H__
@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "modbus.h"
+#include "modbus_crc.h"
+#include "history.h"
+#include "flash_log.h"
+
+/*
+Append only log of closed 1 min and 15 min history periods in the last
+FLASH_LOG_SIZE bytes of the QSPI flash.
+
+Records are batched in a RAM page, full pages wait in a small queue and
+are programmed one page at a time. Pages are written in sequence order
+around the region, so every sector is erased once per turn (wear
+levelling by rotation). When a page opens a sector, the next sector is
+erased ahead, dropping the oldest data.
+
+Flash can't be read while it is programmed or erased, so core1 is locked
+out and interrupts are disabled during the operation. Operations only
+start when the Modbus client has no outstanding request and its next
+poll is further than the operation time, acquisition is not delayed.
+A sector erase rarely finds such a gap with short poll periods : once
+the current sector has few free pages left, the erase ahead is forced
+into the next gap between two transactions, the polls are only late.
+A page is forced when the queue is almost full. Forced operations are
+counted in the status.
+
+Page layout (256 bytes) : magic, sequence number, number of records,
+4 records, CRC16 of the page. The sequence number gives the position
+(seq % number of pages). At boot, the first page of each sector gives
+a sector index (sequence and close time of its first record) used
+to find the write position and to look up records by time.
+
+Record times are on the log time line : at init the offset is the close
+time of the newest record rounded up to the longest period, the history
+adds it to the time since boot. Close times keep increasing across
+resets and records of previous boots are found like the current ones.
+*/
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+#define FLASH_LOG_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_LOG_SIZE)
+#define FLASH_LOG_NB_SECTOR (FLASH_LOG_SIZE / FLASH_SECTOR_SIZE)
+#define FLASH_LOG_PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define FLASH_LOG_NB_PAGE (FLASH_LOG_SIZE / FLASH_PAGE_SIZE)
+#define FLASH_LOG_MAGIC 0x474F4C46 // "FLOG"
+#define FLASH_LOG_RECORDS_PER_PAGE 4
+// full pages waiting for flash, must be a power of two
+#define FLASH_LOG_QUEUE_SIZE 4
+// bus idle time needed to start an operation, datasheet max of W25Q16JV plus margin
+#define FLASH_LOG_PROGRAM_US 3000
+#define FLASH_LOG_ERASE_US 400000
+// free pages left in the current sector when the erase ahead is forced
+#define FLASH_LOG_ERASE_DUE_PAGES FLASH_LOG_QUEUE_SIZE
+#define FLASH_LOG_NO_SECTOR 0xFFFFFFFF
+
+_Static_assert(FLASH_LOG_NB_SECTOR <= 32, "writable sectors are a 32 bits mask");
+_Static_assert(FLASH_LOG_MAX_RECORD == FLASH_LOG_NB_PAGE * FLASH_LOG_RECORDS_PER_PAGE, "FLASH_LOG_MAX_RECORD is wrong");
+
+/*****************************************************************************/
+/*            PRIVATE TYPE                                                   */
+/*****************************************************************************/
+typedef struct
+{
+    uint16_t u16_boot;
+    uint8_t u8_level;
+    uint8_t u8_reserved;
+    uint32_t u32_energy_total_wh[2]; // meter energy counters at the end of the period
+    t_history_record record;
+}t_flash_log_record;
+
+typedef struct
+{
+    uint32_t u32_magic;
+    uint32_t u32_seq;
+    uint16_t u16_nb_record;
+    uint16_t u16_reserved;
+    t_flash_log_record records[FLASH_LOG_RECORDS_PER_PAGE];
+    uint8_t pad[FLASH_PAGE_SIZE - 12 - FLASH_LOG_RECORDS_PER_PAGE * sizeof(t_flash_log_record) - 2];
+    uint16_t u16_crc;
+}t_flash_log_page;
+
+_Static_assert(sizeof(t_flash_log_page) == FLASH_PAGE_SIZE, "flash log page must fill a flash page");
+
+typedef struct
+{
+    uint32_t u32_seq; // first page sequence, FLASH_LOG_NO_SECTOR if no valid page
+    uint32_t u32_close_s; // end of period of the first record
+}t_flash_log_sector;
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static t_flash_log_sector sectors[FLASH_LOG_NB_SECTOR];
+static t_flash_log_page fill_page; // page being filled
+static t_flash_log_page queue[FLASH_LOG_QUEUE_SIZE];
+static uint32_t u32_queue_head = 0;
+static uint32_t u32_queue_tail = 0;
+static uint32_t u32_head_seq = 0; // sequence of next page
+static uint32_t u32_writable_mask = 0; // sectors whose unwritten pages are erased
+static uint32_t u32_erase_ahead = FLASH_LOG_NO_SECTOR;
+static uint16_t u16_boot = 1;
+static uint32_t u32_time_offset_s = 0;
+static uint32_t u32_nb_program = 0;
+static uint32_t u32_nb_erase = 0;
+static uint32_t u32_nb_forced_program = 0;
+static uint32_t u32_nb_forced_erase = 0;
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+static const t_flash_log_page* flash_log_page(uint32_t u32_pos) {
+    return (const t_flash_log_page*)(XIP_BASE + FLASH_LOG_OFFSET + u32_pos * FLASH_PAGE_SIZE);
+}
+
+static uint16_t flash_log_crc(const t_flash_log_page* p_page) {
+    return modbus_crc16_update(MODBUS_CRC_INIT, (const uint8_t*)p_page, sizeof(*p_page) - 2);
+}
+
+static bool flash_log_page_valid(const t_flash_log_page* p_page) {
+    return (p_page->u32_magic == FLASH_LOG_MAGIC) && (p_page->u16_nb_record > 0)
+        && (p_page->u16_nb_record <= FLASH_LOG_RECORDS_PER_PAGE) && (p_page->u16_crc == flash_log_crc(p_page));
+}
+
+static bool flash_log_sector_blank(uint32_t u32_sector) {
+    const uint32_t* p_word = (const uint32_t*)flash_log_page(u32_sector * FLASH_LOG_PAGES_PER_SECTOR);
+    for(uint32_t i=0; i<(FLASH_SECTOR_SIZE / 4); i++) {
+        if( p_word[i] != 0xFFFFFFFF ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t flash_log_close_s(const t_flash_log_record* p_record) {
+    uint32_t u32_period_s = history_get_period_s(p_record->u8_level);
+    return (p_record->record.u32_slot + 1) * u32_period_s;
+}
+
+static void flash_log_index_sector(uint32_t u32_sector) {
+    const t_flash_log_page* p_page = flash_log_page(u32_sector * FLASH_LOG_PAGES_PER_SECTOR);
+    if( flash_log_page_valid(p_page) ) {
+        sectors[u32_sector].u32_seq = p_page->u32_seq;
+        sectors[u32_sector].u32_close_s = flash_log_close_s(&p_page->records[0]);
+    } else {
+        sectors[u32_sector].u32_seq = FLASH_LOG_NO_SECTOR;
+    }
+}
+
+// page at u32_seq opens its sector : erase the next one ahead
+static void flash_log_prepare(uint32_t u32_seq) {
+    uint32_t u32_pos = u32_seq % FLASH_LOG_NB_PAGE;
+    if( (u32_pos % FLASH_LOG_PAGES_PER_SECTOR) == 0 ) {
+        uint32_t u32_next = (u32_pos / FLASH_LOG_PAGES_PER_SECTOR + 1) % FLASH_LOG_NB_SECTOR;
+        if( !(u32_writable_mask & (1u << u32_next)) ) {
+            u32_erase_ahead = u32_next;
+        }
+    }
+}
+
+void flash_log_init(void) {
+    // sector index and newest sector
+    uint32_t u32_newest = FLASH_LOG_NO_SECTOR;
+    for(uint32_t s=0; s<FLASH_LOG_NB_SECTOR; s++) {
+        flash_log_index_sector(s);
+        if( sectors[s].u32_seq == FLASH_LOG_NO_SECTOR ) {
+            if( flash_log_sector_blank(s) ) {
+                u32_writable_mask |= 1u << s;
+            }
+        } else if( (u32_newest == FLASH_LOG_NO_SECTOR) || (sectors[s].u32_seq > sectors[u32_newest].u32_seq) ) {
+            u32_newest = s;
+        }
+    }
+
+    if( u32_newest != FLASH_LOG_NO_SECTOR ) {
+        // last valid page of the newest sector
+        const t_flash_log_page* p_last = flash_log_page(u32_newest * FLASH_LOG_PAGES_PER_SECTOR);
+        u32_head_seq = p_last->u32_seq + 1;
+        for(uint32_t p=1; p<FLASH_LOG_PAGES_PER_SECTOR; p++) {
+            const t_flash_log_page* p_page = flash_log_page(u32_newest * FLASH_LOG_PAGES_PER_SECTOR + p);
+            if( !flash_log_page_valid(p_page) || (p_page->u32_seq != u32_head_seq) ) {
+                break;
+            }
+            p_last = p_page;
+            u32_head_seq++;
+        }
+        u16_boot = p_last->records[p_last->u16_nb_record - 1].u16_boot + 1;
+        // time line continues after the newest record, on a slot boundary of every level
+        uint32_t u32_period_s = history_get_period_s(HISTORY_NB_LEVEL - 1);
+        for(uint16_t r=0; r<p_last->u16_nb_record; r++) {
+            uint32_t u32_close_s = flash_log_close_s(&p_last->records[r]);
+            u32_close_s = ((u32_close_s + u32_period_s - 1) / u32_period_s) * u32_period_s;
+            if( u32_close_s > u32_time_offset_s ) {
+                u32_time_offset_s = u32_close_s;
+            }
+        }
+
+        // remaining pages of the newest sector are writable if erased,
+        // a torn page leaves the end of the sector unused
+        uint32_t u32_pos = u32_head_seq % FLASH_LOG_NB_PAGE;
+        if( (u32_pos % FLASH_LOG_PAGES_PER_SECTOR) != 0 ) {
+            bool b_blank = true;
+            const uint32_t* p_word = (const uint32_t*)flash_log_page(u32_pos);
+            for(uint32_t i=0; i<(FLASH_PAGE_SIZE / 4); i++) {
+                b_blank = b_blank && (p_word[i] == 0xFFFFFFFF);
+            }
+            if( b_blank ) {
+                u32_writable_mask |= 1u << u32_newest;
+            } else {
+                u32_head_seq += FLASH_LOG_PAGES_PER_SECTOR - (u32_pos % FLASH_LOG_PAGES_PER_SECTOR);
+            }
+        }
+        // erase ahead of the current sector
+        uint32_t u32_next = ((u32_head_seq % FLASH_LOG_NB_PAGE) / FLASH_LOG_PAGES_PER_SECTOR + 1) % FLASH_LOG_NB_SECTOR;
+        if( !(u32_writable_mask & (1u << u32_next)) ) {
+            u32_erase_ahead = u32_next;
+        }
+    }
+
+    memset(&fill_page, 0, sizeof(fill_page));
+    printf("flash log: boot %u, next page %u, time offset %u s\n", u16_boot, u32_head_seq, u32_time_offset_s);
+}
+
+// log time at boot, constant after init
+uint32_t flash_log_get_time_offset_s(void) {
+    return u32_time_offset_s;
+}
+
+// full or flushed fill page goes to the queue
+static void flash_log_push(void) {
+    fill_page.u32_magic = FLASH_LOG_MAGIC;
+    fill_page.u32_seq = u32_head_seq++;
+    memset(fill_page.pad, 0xFF, sizeof(fill_page.pad));
+    fill_page.u16_crc = flash_log_crc(&fill_page);
+    queue[u32_queue_head % FLASH_LOG_QUEUE_SIZE] = fill_page;
+    u32_queue_head++;
+    memset(&fill_page, 0, sizeof(fill_page));
+}
+
+// next flash operation : erase needed before the queued page, the queued page, or erase ahead
+static bool flash_log_next_op(uint32_t* p_sector, bool* p_erase) {
+    if( u32_queue_head != u32_queue_tail ) {
+        uint32_t u32_pos = queue[u32_queue_tail % FLASH_LOG_QUEUE_SIZE].u32_seq % FLASH_LOG_NB_PAGE;
+        *p_sector = u32_pos / FLASH_LOG_PAGES_PER_SECTOR;
+        *p_erase = !(u32_writable_mask & (1u << *p_sector));
+        return true;
+    }
+    if( u32_erase_ahead != FLASH_LOG_NO_SECTOR ) {
+        *p_sector = u32_erase_ahead;
+        *p_erase = true;
+        return true;
+    }
+    return false;
+}
+
+// core1 locked out
+static void flash_log_execute(uint32_t u32_sector, bool b_erase) {
+    if( b_erase ) {
+        uint32_t u32_irq_state = save_and_disable_interrupts();
+        flash_range_erase(FLASH_LOG_OFFSET + u32_sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+        restore_interrupts(u32_irq_state);
+        u32_writable_mask |= 1u << u32_sector;
+        sectors[u32_sector].u32_seq = FLASH_LOG_NO_SECTOR;
+        if( u32_erase_ahead == u32_sector ) {
+            u32_erase_ahead = FLASH_LOG_NO_SECTOR;
+        }
+        u32_nb_erase++;
+        return;
+    }
+
+    const t_flash_log_page* p_page = &queue[u32_queue_tail % FLASH_LOG_QUEUE_SIZE];
+    uint32_t u32_pos = p_page->u32_seq % FLASH_LOG_NB_PAGE;
+    uint32_t u32_irq_state = save_and_disable_interrupts();
+    flash_range_program(FLASH_LOG_OFFSET + u32_pos * FLASH_PAGE_SIZE, (const uint8_t*)p_page, FLASH_PAGE_SIZE);
+    restore_interrupts(u32_irq_state);
+    u32_queue_tail++;
+    u32_nb_program++;
+
+    if( (u32_pos % FLASH_LOG_PAGES_PER_SECTOR) == 0 ) {
+        flash_log_index_sector(u32_sector);
+    }
+    if( (u32_pos % FLASH_LOG_PAGES_PER_SECTOR) == (FLASH_LOG_PAGES_PER_SECTOR - 1) ) {
+        // sector full, must be erased before next turn
+        u32_writable_mask &= ~(1u << u32_sector);
+    }
+    flash_log_prepare(p_page->u32_seq);
+}
+
+// erase ahead can't wait for a long enough gap any more
+static bool flash_log_erase_due(uint32_t u32_sector) {
+    uint32_t u32_pos = u32_head_seq % FLASH_LOG_NB_PAGE;
+    uint32_t u32_used = u32_pos % FLASH_LOG_PAGES_PER_SECTOR;
+    uint32_t u32_free = (u32_used > 0) ? FLASH_LOG_PAGES_PER_SECTOR - u32_used : 0;
+    return (u32_sector == u32_erase_ahead) && (u32_free <= FLASH_LOG_ERASE_DUE_PAGES);
+}
+
+// core0 : run one pending flash operation if the bus leaves time for it
+void flash_log_loop(void) {
+    uint32_t u32_sector;
+    bool b_erase;
+    if( !flash_log_next_op(&u32_sector, &b_erase) ) {
+        return;
+    }
+    uint32_t u32_need_us = b_erase ? FLASH_LOG_ERASE_US : FLASH_LOG_PROGRAM_US;
+    bool b_force = (u32_queue_head - u32_queue_tail) >= (FLASH_LOG_QUEUE_SIZE - 1);
+    if( !b_force && b_erase && flash_log_erase_due(u32_sector) ) {
+        // between two transactions, not in the middle of one
+        u32_need_us = FLASH_LOG_PROGRAM_US;
+    }
+    // check before stopping core1, then again once it is stopped
+    if( !b_force && (modbus_client_idle_us() < u32_need_us) ) {
+        return;
+    }
+    multicore_lockout_start_blocking();
+    uint32_t u32_idle_us = modbus_client_idle_us();
+    if( b_force || (u32_idle_us >= u32_need_us) ) {
+        flash_log_execute(u32_sector, b_erase);
+        if( b_erase && (u32_idle_us < FLASH_LOG_ERASE_US) ) {
+            u32_nb_forced_erase++;
+        } else if( !b_erase && (u32_idle_us < FLASH_LOG_PROGRAM_US) ) {
+            u32_nb_forced_program++;
+        }
+    }
+    multicore_lockout_end_blocking();
+}
+
+// core0 : closed history period, 1 min and 15 min levels are logged
+void flash_log_append(enum history_level level, const t_history_record* p_record, const uint32_t* p_energy_total_wh) {
+    if( level == HISTORY_LEVEL_1S ) {
+        return;
+    }
+    t_flash_log_record* p_log = &fill_page.records[fill_page.u16_nb_record++];
+    p_log->u16_boot = u16_boot;
+    p_log->u8_level = level;
+    p_log->u8_reserved = 0;
+    p_log->u32_energy_total_wh[0] = p_energy_total_wh[0];
+    p_log->u32_energy_total_wh[1] = p_energy_total_wh[1];
+    p_log->record = *p_record;
+
+    if( fill_page.u16_nb_record == FLASH_LOG_RECORDS_PER_PAGE ) {
+        // no room, write oldest page now. The queue is full so each loop is forced,
+        // it may first erase the sector of the page : never overwrite it.
+        while( (u32_queue_head - u32_queue_tail) >= FLASH_LOG_QUEUE_SIZE ) {
+            flash_log_loop();
+        }
+        flash_log_push();
+    }
+}
+
+// core0 : write everything now, before a reset
+void flash_log_flush(void) {
+    if( fill_page.u16_nb_record > 0 ) {
+        flash_log_push();
+    }
+    uint32_t u32_sector;
+    bool b_erase;
+    multicore_lockout_start_blocking();
+    while( (u32_queue_head != u32_queue_tail) && flash_log_next_op(&u32_sector, &b_erase) ) {
+        flash_log_execute(u32_sector, b_erase);
+    }
+    multicore_lockout_end_blocking();
+}
+
+// cursor on the first page that may hold periods of the level closed at or after u32_time_s
+bool flash_log_seek(t_flash_log_cursor* p_cursor, enum history_level level, uint32_t u32_time_s) {
+    uint32_t u32_period_s = history_get_period_s(level);
+    uint32_t u32_close_s = (u32_time_s / u32_period_s + 1) * u32_period_s;
+
+    // records are in close time order : start from the newest sector opened before,
+    // else from the oldest one
+    uint32_t u32_start = FLASH_LOG_NO_SECTOR;
+    uint32_t u32_oldest = FLASH_LOG_NO_SECTOR;
+    for(uint32_t s=0; s<FLASH_LOG_NB_SECTOR; s++) {
+        const t_flash_log_sector* p_sector = &sectors[s];
+        if( p_sector->u32_seq == FLASH_LOG_NO_SECTOR ) {
+            continue;
+        }
+        if( (u32_oldest == FLASH_LOG_NO_SECTOR) || (p_sector->u32_seq < sectors[u32_oldest].u32_seq) ) {
+            u32_oldest = s;
+        }
+        if( (p_sector->u32_close_s <= u32_close_s)
+            && ((u32_start == FLASH_LOG_NO_SECTOR) || (p_sector->u32_seq > sectors[u32_start].u32_seq)) ) {
+            u32_start = s;
+        }
+    }
+    if( u32_start == FLASH_LOG_NO_SECTOR ) {
+        u32_start = u32_oldest;
+    }
+    if( u32_start == FLASH_LOG_NO_SECTOR ) {
+        return false;
+    }
+    p_cursor->u8_level = level;
+    p_cursor->u32_seq = sectors[u32_start].u32_seq;
+    p_cursor->u16_record = 0;
+    return true;
+}
+
+// next record of the cursor level, pages are read once, false at the end of the written pages
+bool flash_log_next(t_flash_log_cursor* p_cursor, t_history_record* p_record) {
+    while( p_cursor->u32_seq < u32_head_seq ) {
+        const t_flash_log_page* p_page = flash_log_page(p_cursor->u32_seq % FLASH_LOG_NB_PAGE);
+        if( !flash_log_page_valid(p_page) || (p_page->u32_seq != p_cursor->u32_seq) ) {
+            // queued page or erased since the seek
+            return false;
+        }
+        while( p_cursor->u16_record < p_page->u16_nb_record ) {
+            const t_flash_log_record* p_log = &p_page->records[p_cursor->u16_record++];
+            if( p_log->u8_level == p_cursor->u8_level ) {
+                *p_record = p_log->record;
+                return true;
+            }
+        }
+        p_cursor->u32_seq++;
+        p_cursor->u16_record = 0;
+    }
+    return false;
+}
+
+void flash_log_print_status(void) {
+    uint32_t u32_nb_valid = 0;
+    for(uint32_t s=0; s<FLASH_LOG_NB_SECTOR; s++) {
+        u32_nb_valid += (sectors[s].u32_seq != FLASH_LOG_NO_SECTOR) ? 1 : 0;
+    }
+    printf("flash log %u KB at 0x%08X, %u/%u sectors used, boot %u, next page %u, queued %u records %u\n",
+            FLASH_LOG_SIZE / 1024, FLASH_LOG_OFFSET, u32_nb_valid, FLASH_LOG_NB_SECTOR, u16_boot, u32_head_seq,
+            u32_queue_head - u32_queue_tail, fill_page.u16_nb_record);
+    printf("programs %u forced %u, erases %u forced %u\n", u32_nb_program, u32_nb_forced_program,
+            u32_nb_erase, u32_nb_forced_erase);
+}
+
+// last records in flash, oldest first, one json line each
+void flash_log_print_last(uint32_t u32_nb_record) {
+    // go back from the newest page written
+    uint32_t u32_written_seq = u32_head_seq - (u32_queue_head - u32_queue_tail);
+    uint32_t u32_first_seq = u32_written_seq;
+    uint32_t u32_nb = 0;
+    while( (u32_nb < u32_nb_record) && (u32_first_seq > 0) && ((u32_written_seq - u32_first_seq) < FLASH_LOG_NB_PAGE) ) {
+        const t_flash_log_page* p_page = flash_log_page((u32_first_seq - 1) % FLASH_LOG_NB_PAGE);
+        if( !flash_log_page_valid(p_page) || (p_page->u32_seq != u32_first_seq - 1) ) {
+            break;
+        }
+        u32_nb += p_page->u16_nb_record;
+        u32_first_seq--;
+    }
+
+    char buf[HISTORY_JSON_MAX_LEN];
+    uint32_t u32_skip = (u32_nb > u32_nb_record) ? u32_nb - u32_nb_record : 0;
+    for(uint32_t u32_seq = u32_first_seq; u32_seq < u32_written_seq; u32_seq++) {
+        const t_flash_log_page* p_page = flash_log_page(u32_seq % FLASH_LOG_NB_PAGE);
+        for(uint16_t r=0; r<p_page->u16_nb_record; r++) {
+            if( u32_skip > 0 ) {
+                u32_skip--;
+                continue;
+            }
+            const t_flash_log_record* p_log = &p_page->records[r];
+            history_format_json(buf, p_log->u8_level, &p_log->record);
+            // boot in front of the history fields
+            printf("{\"boot\":%u,%s", p_log->u16_boot, &buf[1]);
+        }
+    }
+}
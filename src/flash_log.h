@@ -0,0 +1,29 @@
+#ifndef FLASH_LOG_H__
+#define FLASH_LOG_H__
+#include "pico/stdlib.h"
+#include "history.h"
+
+// log region at the end of the QSPI flash, the firmware must stay below
+#define FLASH_LOG_SIZE (128 * 1024)
+// records of all levels the log holds, 4 per 256 bytes page
+#define FLASH_LOG_MAX_RECORD ((FLASH_LOG_SIZE / 256) * 4)
+
+// position in the log, read forward
+typedef struct
+{
+    uint32_t u32_seq;
+    uint16_t u16_record;
+    uint8_t u8_level;
+}t_flash_log_cursor;
+
+void flash_log_init(void);
+uint32_t flash_log_get_time_offset_s(void);
+void flash_log_loop(void);
+void flash_log_append(enum history_level level, const t_history_record* p_record, const uint32_t* p_energy_total_wh);
+void flash_log_flush(void);
+bool flash_log_seek(t_flash_log_cursor* p_cursor, enum history_level level, uint32_t u32_time_s);
+bool flash_log_next(t_flash_log_cursor* p_cursor, t_history_record* p_record);
+void flash_log_print_status(void);
+void flash_log_print_last(uint32_t u32_nb_record);
+
+#endif // FLASH_LOG_H__
@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include "pico/stdlib.h"
+#include "hardware/divider.h"
+#include "fmt.h"
+
+/*
+Values are milli-unit integers (mV, mHz, mA, mW, power factor x1000).
+Quotient and remainder of each /10 step come from one hardware divider
+operation.
+*/
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+// write digits of u32_val in tmp buffer from the end, return number of digits
+static uint8_t fmt_digits(char* p_tmp_end, uint32_t u32_val) {
+    uint8_t u8_nb = 0;
+    do {
+        divmod_result_t r = hw_divider_divmod_u32(u32_val, 10);
+        *--p_tmp_end = (char)('0' + to_remainder_u32(r));
+        u32_val = to_quotient_u32(r);
+        u8_nb++;
+    } while( u32_val );
+    return u8_nb;
+}
+
+char* fmt_char(char* p, char c) {
+    *p++ = c;
+    return p;
+}
+
+char* fmt_str(char* p, const char* str) {
+    while( *str ) {
+        *p++ = *str++;
+    }
+    return p;
+}
+
+char* fmt_end(char* p) {
+    *p = '\0';
+    return p;
+}
+
+char* fmt_u32_pad(char* p, uint32_t u32_val, uint8_t u8_width, char pad) {
+    char tmp[FMT_MAX_NUMBER_LEN];
+    uint8_t u8_nb = fmt_digits(&tmp[sizeof(tmp)], u32_val);
+    while( u8_width > u8_nb ) {
+        *p++ = pad;
+        u8_width--;
+    }
+    for(char* p_digit = &tmp[sizeof(tmp) - u8_nb]; p_digit < &tmp[sizeof(tmp)]; p_digit++) {
+        *p++ = *p_digit;
+    }
+    return p;
+}
+
+char* fmt_u32(char* p, uint32_t u32_val) {
+    return fmt_u32_pad(p, u32_val, 0, ' ');
+}
+
+char* fmt_i32_pad(char* p, int32_t i32_val, uint8_t u8_width, char pad) {
+    char tmp[FMT_MAX_NUMBER_LEN];
+    uint32_t u32_abs = (i32_val < 0) ? -(uint32_t)i32_val : (uint32_t)i32_val;
+    char* p_start = &tmp[sizeof(tmp)] - fmt_digits(&tmp[sizeof(tmp)], u32_abs);
+    if( i32_val < 0 ) {
+        *--p_start = '-';
+    }
+    uint8_t u8_nb = (uint8_t)(&tmp[sizeof(tmp)] - p_start);
+    while( u8_width > u8_nb ) {
+        *p++ = pad;
+        u8_width--;
+    }
+    while( p_start < &tmp[sizeof(tmp)] ) {
+        *p++ = *p_start++;
+    }
+    return p;
+}
+
+char* fmt_i32(char* p, int32_t i32_val) {
+    return fmt_i32_pad(p, i32_val, 0, ' ');
+}
+
+// u32_milli/1000 with u8_decimals (0 to 3) truncated decimals, ex 230123 -> "230.1"
+// integer part is padded with spaces to u8_int_width chars
+char* fmt_milli_u32_pad(char* p, uint32_t u32_milli, uint8_t u8_int_width, uint8_t u8_decimals) {
+    divmod_result_t r = hw_divider_divmod_u32(u32_milli, 1000);
+    p = fmt_u32_pad(p, to_quotient_u32(r), u8_int_width, ' ');
+    if( u8_decimals > 0 ) {
+        uint32_t u32_frac = to_remainder_u32(r);
+        *p++ = '.';
+        *p++ = (char)('0' + u32_frac / 100);
+        if( u8_decimals > 1 ) {
+            *p++ = (char)('0' + (u32_frac / 10) % 10);
+        }
+        if( u8_decimals > 2 ) {
+            *p++ = (char)('0' + u32_frac % 10);
+        }
+    }
+    return p;
+}
+
+char* fmt_milli_u32(char* p, uint32_t u32_milli, uint8_t u8_decimals) {
+    return fmt_milli_u32_pad(p, u32_milli, 0, u8_decimals);
+}
+
+char* fmt_milli_i32(char* p, int32_t i32_milli, uint8_t u8_decimals) {
+    if( i32_milli < 0 ) {
+        *p++ = '-';
+        return fmt_milli_u32(p, -(uint32_t)i32_milli, u8_decimals);
+    }
+    return fmt_milli_u32(p, (uint32_t)i32_milli, u8_decimals);
+}
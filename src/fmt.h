@@ -0,0 +1,25 @@
+#ifndef FMT_H__
+#define FMT_H__
+#include <stdint.h>
+
+/*
+Decimal formatting without printf : every function writes in the caller
+buffer at p and returns the position after the last written char.
+No terminating null char is added, see fmt_end().
+*/
+
+// longest output of fmt_i32 / fmt_milli_i32 ("-2147483.648")
+#define FMT_MAX_NUMBER_LEN 12
+
+char* fmt_char(char* p, char c);
+char* fmt_str(char* p, const char* str);
+char* fmt_end(char* p);
+char* fmt_u32(char* p, uint32_t u32_val);
+char* fmt_i32(char* p, int32_t i32_val);
+char* fmt_u32_pad(char* p, uint32_t u32_val, uint8_t u8_width, char pad);
+char* fmt_i32_pad(char* p, int32_t i32_val, uint8_t u8_width, char pad);
+char* fmt_milli_u32_pad(char* p, uint32_t u32_milli, uint8_t u8_int_width, uint8_t u8_decimals);
+char* fmt_milli_u32(char* p, uint32_t u32_milli, uint8_t u8_decimals);
+char* fmt_milli_i32(char* p, int32_t i32_milli, uint8_t u8_decimals);
+
+#endif // FMT_H__
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "modbus.h"
+#include "fmt.h"
+#include "history.h"
+#include "flash_log.h"
+
+/*
+History of the main meter at three resolutions : 1 s, 1 min and 15 min.
+
+Each level has an accumulator for the current period, updated in O(1) by
+every sample, and a ring of closed periods. A period is stored at index
+slot % size where slot is its start time divided by the period, so a time
+range is read back by direct indexing, without scanning. The slot kept in
+the record tells if the entry is the expected period or an older one
+(no sample received during that period).
+
+Times are on the log time line : seconds since boot plus the offset the
+flash log found at init, so periods logged before a reset keep their
+place and are read back by the same slots.
+*/
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+#define HISTORY_NB_1S 600       // 10 minutes
+#define HISTORY_NB_1MIN 360     // 6 hours
+#define HISTORY_NB_15MIN 384    // 4 days
+
+/*****************************************************************************/
+/*            PRIVATE TYPE                                                   */
+/*****************************************************************************/
+typedef struct
+{
+    uint32_t u32_slot;
+    uint32_t u32_nb_sample;
+    uint64_t u64_tension_sum_mv;
+    int64_t i64_power_sum_mw[2];
+    int32_t i32_min_mw[2];
+    int32_t i32_max_mw[2];
+    uint32_t u32_energy_ref_wh[2]; // energy counter at the end of previous period
+    uint32_t u32_energy_last_wh[2];
+}t_history_acc;
+
+typedef struct
+{
+    const char* p_name;
+    uint32_t u32_period_s;
+    uint32_t u32_size;
+    t_history_record* p_records;
+    t_history_acc acc;
+}t_history_level;
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static t_history_record history_1s[HISTORY_NB_1S];
+static t_history_record history_1min[HISTORY_NB_1MIN];
+static t_history_record history_15min[HISTORY_NB_15MIN];
+static t_history_level history_levels[HISTORY_NB_LEVEL] = {
+    { .p_name = "1s", .u32_period_s = 1, .u32_size = HISTORY_NB_1S, .p_records = history_1s },
+    { .p_name = "1m", .u32_period_s = 60, .u32_size = HISTORY_NB_1MIN, .p_records = history_1min },
+    { .p_name = "15m", .u32_period_s = 15*60, .u32_size = HISTORY_NB_15MIN, .p_records = history_15min },
+};
+// the first sample gives the energy reference of every level
+static bool b_energy_valid = false;
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+void history_init(void) {
+    for(uint8_t i=0; i<HISTORY_NB_LEVEL; i++) {
+        t_history_level* p_level = &history_levels[i];
+        // slot 0xFFFFFFFF is never queried
+        memset(p_level->p_records, 0xFF, p_level->u32_size * sizeof(t_history_record));
+        memset(&p_level->acc, 0, sizeof(p_level->acc));
+    }
+    b_energy_valid = false;
+}
+
+static void history_close(t_history_level* p_level) {
+    t_history_acc* p_acc = &p_level->acc;
+    t_history_record* p_record = &p_level->p_records[p_acc->u32_slot % p_level->u32_size];
+
+    p_record->u32_slot = p_acc->u32_slot;
+    p_record->u32_nb_sample = p_acc->u32_nb_sample;
+    p_record->u32_tension_mean_mv = (uint32_t)(p_acc->u64_tension_sum_mv / p_acc->u32_nb_sample);
+    for(uint8_t i=0; i<2; i++) {
+        p_record->voie[i].i32_min_mw = p_acc->i32_min_mw[i];
+        p_record->voie[i].i32_max_mw = p_acc->i32_max_mw[i];
+        p_record->voie[i].i32_mean_mw = (int32_t)(p_acc->i64_power_sum_mw[i] / (int64_t)p_acc->u32_nb_sample);
+        p_record->voie[i].u32_energy_wh = p_acc->u32_energy_last_wh[i] - p_acc->u32_energy_ref_wh[i];
+        // next period starts where this one ends
+        p_acc->u32_energy_ref_wh[i] = p_acc->u32_energy_last_wh[i];
+    }
+    flash_log_append((enum history_level)(p_level - history_levels), p_record, p_acc->u32_energy_last_wh);
+}
+
+static void history_level_add(t_history_level* p_level, uint32_t u32_slot, const t_power_data* p_data) {
+    t_history_acc* p_acc = &p_level->acc;
+
+    if( (p_acc->u32_nb_sample > 0) && (p_acc->u32_slot != u32_slot) ) {
+        history_close(p_level);
+        p_acc->u32_nb_sample = 0;
+    }
+    if( p_acc->u32_nb_sample == 0 ) {
+        p_acc->u32_slot = u32_slot;
+        p_acc->u64_tension_sum_mv = 0;
+        for(uint8_t i=0; i<2; i++) {
+            p_acc->i64_power_sum_mw[i] = 0;
+            p_acc->i32_min_mw[i] = INT32_MAX;
+            p_acc->i32_max_mw[i] = INT32_MIN;
+            if( !b_energy_valid ) {
+                p_acc->u32_energy_ref_wh[i] = p_data->voie[i].energie_wh;
+            }
+        }
+    }
+
+    p_acc->u32_nb_sample++;
+    p_acc->u64_tension_sum_mv += p_data->tension_mv;
+    for(uint8_t i=0; i<2; i++) {
+        int32_t i32_power_mw = p_data->voie[i].puissance_active_mw;
+        p_acc->i64_power_sum_mw[i] += i32_power_mw;
+        if( i32_power_mw < p_acc->i32_min_mw[i] ) {
+            p_acc->i32_min_mw[i] = i32_power_mw;
+        }
+        if( i32_power_mw > p_acc->i32_max_mw[i] ) {
+            p_acc->i32_max_mw[i] = i32_power_mw;
+        }
+        p_acc->u32_energy_last_wh[i] = p_data->voie[i].energie_wh;
+    }
+}
+
+// core0 : every sample popped from the acquisition queue, only the main meter is kept
+void history_add(uint8_t u8_slave, const t_power_data* p_data) {
+    if( u8_slave != 0 ) {
+        return;
+    }
+    uint32_t u32_time_s = flash_log_get_time_offset_s() + (uint32_t)(to_us_since_boot(p_data->time) / 1000000);
+    for(uint8_t i=0; i<HISTORY_NB_LEVEL; i++) {
+        history_level_add(&history_levels[i], u32_time_s / history_levels[i].u32_period_s, p_data);
+    }
+    b_energy_valid = true;
+}
+
+// current time on the log time line
+uint32_t history_now_s(void) {
+    return flash_log_get_time_offset_s() + (uint32_t)(time_us_64() / 1000000);
+}
+
+uint32_t history_get_period_s(enum history_level level) {
+    return history_levels[level].u32_period_s;
+}
+
+// closed period holding u32_time_s, false if no sample during that period or too old
+bool history_get(enum history_level level, uint32_t u32_time_s, t_history_record* p_record) {
+    t_history_level* p_level = &history_levels[level];
+    uint32_t u32_slot = u32_time_s / p_level->u32_period_s;
+    const t_history_record* p_stored = &p_level->p_records[u32_slot % p_level->u32_size];
+    if( p_stored->u32_slot != u32_slot ) {
+        return false;
+    }
+    *p_record = *p_stored;
+    return true;
+}
+
+uint32_t history_format_json(char* buf, enum history_level level, const t_history_record* p_record) {
+    static const char* channel_names[2][2] = { { ",\"P1\":[", ",\"E1\":" }, { ",\"P2\":[", ",\"E2\":" } };
+    char* p = buf;
+    p = fmt_str(p, "{\"lvl\":\"");
+    p = fmt_str(p, history_levels[level].p_name);
+    p = fmt_str(p, "\",\"t\":");
+    p = fmt_u32(p, p_record->u32_slot * history_levels[level].u32_period_s);
+    p = fmt_str(p, ",\"n\":");
+    p = fmt_u32(p, p_record->u32_nb_sample);
+    p = fmt_str(p, ",\"V\":");
+    p = fmt_milli_u32(p, p_record->u32_tension_mean_mv, 3);
+    for(uint8_t i=0; i<2; i++) {
+        // power min, mean, max
+        p = fmt_str(p, channel_names[i][0]);
+        p = fmt_milli_i32(p, p_record->voie[i].i32_min_mw, 3);
+        p = fmt_char(p, ',');
+        p = fmt_milli_i32(p, p_record->voie[i].i32_mean_mw, 3);
+        p = fmt_char(p, ',');
+        p = fmt_milli_i32(p, p_record->voie[i].i32_max_mw, 3);
+        p = fmt_char(p, ']');
+        p = fmt_str(p, channel_names[i][1]);
+        p = fmt_u32(p, p_record->voie[i].u32_energy_wh);
+    }
+    p = fmt_str(p, "}\n");
+    p = fmt_end(p);
+    return (uint32_t)(p - buf);
+}
+
+// print closed periods between two log times, one json line each
+void history_print(enum history_level level, uint32_t u32_from_s, uint32_t u32_to_s) {
+    t_history_level* p_level = &history_levels[level];
+    uint32_t u32_now_s = history_now_s();
+    if( u32_to_s > u32_now_s ) {
+        u32_to_s = u32_now_s;
+    }
+    if( u32_from_s > u32_to_s ) {
+        return;
+    }
+    uint32_t u32_from_slot = u32_from_s / p_level->u32_period_s;
+    uint32_t u32_to_slot = u32_to_s / p_level->u32_period_s;
+    // older periods are overwritten, 1 min and 15 min ones are read back from flash
+    uint32_t u32_depth = p_level->u32_size + ((level == HISTORY_LEVEL_1S) ? 0 : FLASH_LOG_MAX_RECORD);
+    uint32_t u32_nb_slot = u32_to_slot - u32_from_slot + 1;
+    if( u32_nb_slot > u32_depth ) {
+        u32_from_slot = u32_to_slot - u32_depth + 1;
+        u32_nb_slot = u32_depth;
+    }
+    char buf[HISTORY_JSON_MAX_LEN];
+    // flash records of the level are in slot order : one forward read for the whole range
+    t_flash_log_cursor cursor;
+    t_history_record flash_record;
+    bool b_flash = (level != HISTORY_LEVEL_1S) && flash_log_seek(&cursor, level, u32_from_slot * p_level->u32_period_s);
+    b_flash = b_flash && flash_log_next(&cursor, &flash_record);
+    for(uint32_t i=0; i<u32_nb_slot; i++) {
+        uint32_t u32_slot = u32_from_slot + i;
+        while( b_flash && (flash_record.u32_slot < u32_slot) ) {
+            b_flash = flash_log_next(&cursor, &flash_record);
+        }
+        const t_history_record* p_record = &p_level->p_records[u32_slot % p_level->u32_size];
+        if( p_record->u32_slot != u32_slot ) {
+            if( !b_flash || (flash_record.u32_slot != u32_slot) ) {
+                continue;
+            }
+            p_record = &flash_record;
+        }
+        history_format_json(buf, level, p_record);
+        fputs(buf, stdout);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef HISTORY_H__
+#define HISTORY_H__
+#include "pico/stdlib.h"
+#include "modbus.h"
+
+// longest json line of a history record
+#define HISTORY_JSON_MAX_LEN 256
+
+enum history_level {
+    HISTORY_LEVEL_1S=0,
+    HISTORY_LEVEL_1MIN,
+    HISTORY_LEVEL_15MIN,
+    HISTORY_NB_LEVEL
+};
+
+typedef struct
+{
+    int32_t i32_min_mw;
+    int32_t i32_max_mw;
+    int32_t i32_mean_mw;
+    uint32_t u32_energy_wh; // energy counter increase over the period
+}t_history_channel;
+
+// statistics of one period, time is u32_slot * period on the log time line
+// (seconds since boot plus the time logged by previous boots)
+typedef struct
+{
+    uint32_t u32_slot;
+    uint32_t u32_nb_sample;
+    uint32_t u32_tension_mean_mv;
+    t_history_channel voie[2];
+}t_history_record;
+
+void history_init(void);
+void history_add(uint8_t u8_slave, const t_power_data* p_data);
+uint32_t history_now_s(void);
+uint32_t history_get_period_s(enum history_level level);
+bool history_get(enum history_level level, uint32_t u32_time_s, t_history_record* p_record);
+void history_print(enum history_level level, uint32_t u32_from_s, uint32_t u32_to_s);
+uint32_t history_format_json(char* buf, enum history_level level, const t_history_record* p_record);
+
+#endif // HISTORY_H__
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "latency.h"
+
+/*
+End to end latency of the samples : each t_power_data carries the
+time_us_32() of every stage it went through, and each stamp adds the
+time since the previous stage and the age since the request was sent to
+two histograms of that stage.
+
+A stage is stamped once per sample, a sample shown again is not counted
+again. A stamp of 0 is a stage not reached (time_us_32() is 0 once every
+71 minutes, that sample is lost).
+
+Buckets are powers of two, so recording is a count leading zeros and a
+few adds, cheap enough for the UART and decode path. Each stage has a
+single writer core (core1 up to decode, core0 after), the console reads
+them without lock : a line may mix two samples. Reset is only requested
+by the console and done by the writer on its next stamp.
+*/
+
+/*****************************************************************************/
+/*            PRIVATE TYPE                                                   */
+/*****************************************************************************/
+typedef struct
+{
+    const char* p_name;
+    enum latency_stage previous;
+    volatile bool b_reset; // set by the console, cleared by the writer
+    t_latency_hist step;   // since the previous stage
+    t_latency_hist age;    // since LATENCY_STAGE_SEND
+}t_latency_stage;
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static t_latency_stage latency_stages[LATENCY_NB_STAGE] = {
+    [LATENCY_STAGE_SEND]      = { .p_name = "send",      .previous = LATENCY_STAGE_SEND },
+    [LATENCY_STAGE_RX_FIRST]  = { .p_name = "rx first",  .previous = LATENCY_STAGE_SEND },
+    [LATENCY_STAGE_RX_LAST]   = { .p_name = "rx last",   .previous = LATENCY_STAGE_RX_FIRST },
+    [LATENCY_STAGE_DECODE]    = { .p_name = "decode",    .previous = LATENCY_STAGE_RX_LAST },
+    [LATENCY_STAGE_TELEMETRY] = { .p_name = "telemetry", .previous = LATENCY_STAGE_DECODE },
+    [LATENCY_STAGE_DISPLAY]   = { .p_name = "display",   .previous = LATENCY_STAGE_DECODE },
+};
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+static void latency_hist_clear(t_latency_hist* p_hist) {
+    memset(p_hist, 0, sizeof(*p_hist));
+    p_hist->u32_min_us = UINT32_MAX;
+}
+
+static void latency_hist_add(t_latency_hist* p_hist, uint32_t u32_us) {
+    // bucket of the highest bit set, 0 and 1 us in the first one
+    uint32_t u32_bucket = (u32_us < 2) ? 0 : 31 - __builtin_clz(u32_us);
+    if( u32_bucket >= LATENCY_NB_BUCKET ) {
+        u32_bucket = LATENCY_NB_BUCKET - 1;
+    }
+    p_hist->buckets[u32_bucket]++;
+    p_hist->u32_count++;
+    p_hist->u64_sum_us += u32_us;
+    if( u32_us < p_hist->u32_min_us ) {
+        p_hist->u32_min_us = u32_us;
+    }
+    if( u32_us > p_hist->u32_max_us ) {
+        p_hist->u32_max_us = u32_us;
+    }
+}
+
+void latency_init(void) {
+    for(uint32_t s=0; s<LATENCY_NB_STAGE; s++) {
+        latency_stages[s].b_reset = false;
+        latency_hist_clear(&latency_stages[s].step);
+        latency_hist_clear(&latency_stages[s].age);
+    }
+}
+
+// writer core of the stage
+void latency_stamp_at(uint32_t* p_stage_us, enum latency_stage stage, uint32_t u32_time_us) {
+    if( p_stage_us[stage] != 0 ) {
+        return;
+    }
+    p_stage_us[stage] = u32_time_us;
+
+    t_latency_stage* p_stage = &latency_stages[stage];
+    if( p_stage->b_reset ) {
+        latency_hist_clear(&p_stage->step);
+        latency_hist_clear(&p_stage->age);
+        p_stage->b_reset = false;
+    }
+    // send is the origin, nothing to measure
+    if( stage == LATENCY_STAGE_SEND ) {
+        return;
+    }
+    uint32_t u32_previous_us = p_stage_us[p_stage->previous];
+    if( u32_previous_us != 0 ) {
+        latency_hist_add(&p_stage->step, u32_time_us - u32_previous_us);
+    }
+    uint32_t u32_send_us = p_stage_us[LATENCY_STAGE_SEND];
+    if( u32_send_us != 0 ) {
+        latency_hist_add(&p_stage->age, u32_time_us - u32_send_us);
+    }
+}
+
+void latency_stamp(uint32_t* p_stage_us, enum latency_stage stage) {
+    latency_stamp_at(p_stage_us, stage, time_us_32());
+}
+
+// any core, copy may be torn by the writer
+void latency_get(enum latency_stage stage, t_latency_hist* p_step, t_latency_hist* p_age) {
+    *p_step = latency_stages[stage].step;
+    *p_age = latency_stages[stage].age;
+}
+
+static void latency_print_hist(const char* p_name, const char* p_kind, const t_latency_hist* p_hist) {
+    if( p_hist->u32_count == 0 ) {
+        return;
+    }
+    printf("%-9s %-4s n %u min %u avg %u max %u us |", p_name, p_kind, p_hist->u32_count, p_hist->u32_min_us,
+            (uint32_t)(p_hist->u64_sum_us / p_hist->u32_count), p_hist->u32_max_us);
+    // non empty buckets as lower bound:count
+    for(uint32_t b=0; b<LATENCY_NB_BUCKET; b++) {
+        if( p_hist->buckets[b] != 0 ) {
+            printf(" %u:%u", (b == 0) ? 0 : (1u << b), p_hist->buckets[b]);
+        }
+    }
+    printf("\n");
+}
+
+// core0
+void latency_print(void) {
+    for(uint32_t s=0; s<LATENCY_NB_STAGE; s++) {
+        t_latency_hist step, age;
+        latency_get((enum latency_stage)s, &step, &age);
+        latency_print_hist(latency_stages[s].p_name, "step", &step);
+        latency_print_hist(latency_stages[s].p_name, "age", &age);
+    }
+}
+
+// core0 : cleared by each writer on its next stamp
+void latency_reset(void) {
+    for(uint32_t s=0; s<LATENCY_NB_STAGE; s++) {
+        latency_stages[s].b_reset = true;
+    }
+}
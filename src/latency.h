@@ -0,0 +1,35 @@
+#ifndef LATENCY_H__
+#define LATENCY_H__
+#include <stdint.h>
+
+// steps of a sample, each one stamped with time_us_32()
+enum latency_stage {
+    LATENCY_STAGE_SEND=0,    // request written to the UART (core1)
+    LATENCY_STAGE_RX_FIRST,  // UART IRQ that read the first bytes of the answer
+    LATENCY_STAGE_RX_LAST,   // UART IRQ that read the end of the answer
+    LATENCY_STAGE_DECODE,    // answer decoded (core1)
+    LATENCY_STAGE_TELEMETRY, // telemetry frame written to stdout (core0)
+    LATENCY_STAGE_DISPLAY,   // display frame handed to the I2C DMA (core0)
+    LATENCY_NB_STAGE
+};
+
+// bucket i counts durations in [2^i, 2^(i+1)) us, the last one everything longer
+#define LATENCY_NB_BUCKET 24
+
+typedef struct
+{
+    uint32_t u32_count;
+    uint32_t u32_min_us;
+    uint32_t u32_max_us;
+    uint64_t u64_sum_us;
+    uint32_t buckets[LATENCY_NB_BUCKET];
+}t_latency_hist;
+
+void latency_init(void);
+void latency_stamp_at(uint32_t* p_stage_us, enum latency_stage stage, uint32_t u32_time_us);
+void latency_stamp(uint32_t* p_stage_us, enum latency_stage stage);
+void latency_get(enum latency_stage stage, t_latency_hist* p_step, t_latency_hist* p_age);
+void latency_print(void);
+void latency_reset(void);
+
+#endif // LATENCY_H__
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "modbus.h"
+#include "meter.h"
+
+/*
+Register maps, one line per decoded field :
+    register, width in bytes, mul, div, sign register, sign byte, destination
+The value read is scaled by mul / div, then negated when the sign byte is
+not 0. A sign register of 0 means the field is unsigned.
+Each line becomes straight code in the model decoder : no loop, no table
+walk, and the sign is applied without branch.
+*/
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+// JSY-MK-194 : 4 bytes per register address, sign flags of channels 1 and 2
+// are the two first bytes of 0x004E
+#define JSY_MK194_MAP(X) \
+    X(0x0048, 4,  1, 10,      0, 0, tension_mv) \
+    X(0x004F, 4, 10,  1,      0, 0, frequence_mhz) \
+    X(0x0049, 4,  1, 10,      0, 0, voie[0].courant_ma) \
+    X(0x004A, 4,  1, 10, 0x004E, 0, voie[0].puissance_active_mw) \
+    X(0x004B, 4,  1, 10,      0, 0, voie[0].energie_wh) \
+    X(0x004C, 4,  1,  1,      0, 0, voie[0].facteur_puissance) \
+    X(0x0051, 4,  1, 10,      0, 0, voie[1].courant_ma) \
+    X(0x0052, 4,  1, 10, 0x004E, 1, voie[1].puissance_active_mw) \
+    X(0x0053, 4,  1, 10,      0, 0, voie[1].energie_wh) \
+    X(0x0054, 4,  1,  1,      0, 0, voie[1].facteur_puissance)
+#define JSY_MK194_OFFSET(reg) (((reg) - JSY_MK194_FIRST_REGISTER) * 4)
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+static inline uint32_t meter_load4(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint32_t meter_load2(const uint8_t* p) {
+    return ((uint32_t)p[0] << 8) | p[1];
+}
+
+// one map line : load, scale, then two's complement negate when the sign byte is set
+#define METER_FIELD(offset, width, mul, div, sign_offset, b_signed, field) \
+    { \
+        uint32_t u32_value = meter_load##width(&p_data[offset]) * (mul) / (div); \
+        uint32_t u32_neg = (b_signed) ? (p_data[sign_offset] != 0) : 0; \
+        p_power_data->field = (u32_value ^ (0 - u32_neg)) + u32_neg; \
+    }
+
+#define JSY_MK194_FIELD(reg, width, mul, div, sign_reg, sign_byte, field) \
+    METER_FIELD(JSY_MK194_OFFSET(reg), width, mul, div, JSY_MK194_OFFSET(sign_reg) + (sign_byte), (sign_reg) != 0, field)
+
+static void meter_jsy_mk194_decode(const uint8_t* p_data, t_power_data* p_power_data) {
+    JSY_MK194_MAP(JSY_MK194_FIELD)
+}
+
+const t_meter_model meter_jsy_mk194 = {
+    .p_name = "JSY-MK-194",
+    .u16_first_register = JSY_MK194_FIRST_REGISTER,
+    .u16_nb_register = JSY_MK194_NB_REGISTER,
+    .u8_data_size = JSY_MK194_NB_REGISTER * 4,
+    .decode = meter_jsy_mk194_decode,
+};
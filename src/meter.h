@@ -0,0 +1,43 @@
+#ifndef METER_H__
+#define METER_H__
+#include "pico/stdlib.h"
+#include "modbus.h"
+#include "modbus_crc.h"
+
+/*
+Meter models : block of registers holding the measures and its decoder.
+The register map of each model is a table in meter.c, unrolled at compile
+time into its decoder. Adding a model means adding a map, a decoder line
+and the constants below.
+*/
+
+// JSY-MK-194 : 2 channels, 32 bits registers
+#define JSY_MK194_MODEL meter_jsy_mk194
+#define JSY_MK194_FIRST_REGISTER 0x0048
+#define JSY_MK194_NB_REGISTER 14
+
+typedef struct
+{
+    const char* p_name;
+    uint16_t u16_first_register;
+    uint16_t u16_nb_register;
+    uint8_t u8_data_size; // byte count of the answer
+    void (*decode)(const uint8_t* p_data, t_power_data* p_power_data);
+}t_meter_model;
+
+extern const t_meter_model meter_jsy_mk194;
+
+// constant read request (function 0x03) of the measures block of a model, CRC included
+#define METER_READ_REQUEST(name, address, model) \
+    enum { \
+        name##_crc0 = MODBUS_CRC_CONST_BYTE(MODBUS_CRC_INIT, (address)), \
+        name##_crc1 = MODBUS_CRC_CONST_BYTE(name##_crc0, 0x03), \
+        name##_crc2 = MODBUS_CRC_CONST_BYTE(name##_crc1, (model##_FIRST_REGISTER) >> 8), \
+        name##_crc3 = MODBUS_CRC_CONST_BYTE(name##_crc2, (model##_FIRST_REGISTER) & 0xFF), \
+        name##_crc4 = MODBUS_CRC_CONST_BYTE(name##_crc3, (model##_NB_REGISTER) >> 8), \
+        name##_crc5 = MODBUS_CRC_CONST_BYTE(name##_crc4, (model##_NB_REGISTER) & 0xFF), \
+    }; \
+    static const uint8_t name[8] = { (address), 0x03, (model##_FIRST_REGISTER) >> 8, (model##_FIRST_REGISTER) & 0xFF, \
+        (model##_NB_REGISTER) >> 8, (model##_NB_REGISTER) & 0xFF, name##_crc5 & 0xFF, name##_crc5 >> 8 }
+
+#endif // METER_H__
@@ -1,7 +1,12 @@
 #include <stdio.h>
 #include <string.h>
 #include "pico/stdlib.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "modbus.h"
+#include "modbus_crc.h"
+#include "meter.h"
+#include "scheduler.h"
 
 
 /*
@@ -19,13 +24,46 @@ Function 	1 	Indicates the function code e.g. "read coils"
 Data 	n × 1 	Data + length will be filled depending on the message type
 CRC 	    2 	Cyclic redundancy check
 
+The client polls the meters on MODBUS_CLIENT_UART. The server answers read
+requests (FC 0x03 and 0x04, same registers) on MODBUS_SERVER_UART from a
+register image : core0 publishes a new image for each sample, core1 answers
+from the last one with a memcpy, the CRC of a whole read is in the image and
+the CRC of the header of any read is computed at init. Other functions are
+refused with exception 01, the length of their requests is not known so they
+are answered after the line idle time.
 */
 
 /*****************************************************************************/
 /*            CONST                                                          */
 /*****************************************************************************/
 #define MODBUS_FRAME_SIZE 256
+// RX ring buffer filled by UART IRQ, must be a power of two
+#define MODBUS_RX_RING_SIZE 512
+// frame start marks set by UART IRQ, must be a power of two
+#define MODBUS_RX_BOUNDARY_SIZE 16
+// line idle time splitting frames, in characters : t3.5 plus the RX FIFO
+// latency (4 bytes level or 32 bits timeout) seen between two IRQs of a frame
+#define MODBUS_IDLE_CHARS 7
 #define NB_POWER_DATA 60
+// request (8) and 0x0048 block response (61) plus 3.5 chars of silence after each
+#define MODBUS_CLIENT_CYCLE_CHARS (8 + 61 + 7)
+// consecutive timeouts before trying the next baudrate
+#define MODBUS_CLIENT_MAX_TIMEOUT 5
+// UART TX FIFO depth, the server writes its answer by FIFO loads
+#define MODBUS_SERVER_TX_FIFO 32
+// exception codes
+#define MODBUS_EXCEPTION_ILLEGAL_FUNCTION   0x01
+#define MODBUS_EXCEPTION_ILLEGAL_ADDRESS    0x02
+#define MODBUS_EXCEPTION_ILLEGAL_VALUE      0x03
+#define MODBUS_EXCEPTION_BUSY               0x06
+// address, function, byte count, registers, CRC
+#define MODBUS_SERVER_ANSWER_SIZE (3 + 2*MODBUS_SERVER_MAX_REG + 2)
+// meters on the bus, only the main one is polled by default
+//  name, address, model, priority, enabled, period
+#define MODBUS_CLIENT_SLAVES(X) \
+    X(main,   0x01, JSY_MK194, 0, true,  1000*1000) \
+    X(pv,     0x02, JSY_MK194, 1, false, 1000*1000) \
+    X(heater, 0x03, JSY_MK194, 2, false, 5000*1000)
 /*****************************************************************************/
 /*            PRIVATE TYPE                                                   */
 /*****************************************************************************/
@@ -35,7 +73,8 @@ enum mb_state {
     MODBUS_WAIT_FUNCTION,
     MODBUS_WAIT_DATA_SIZE,
     MODBUS_WAIT_DATA,
-    MODBUS_WAIT_CRC
+    MODBUS_WAIT_CRC,
+    MODBUS_WAIT_IDLE // frame of unknown length, ends with line idle
 };
 
 typedef void (*t_rx_cb)(uint8_t*, uint8_t);
@@ -44,31 +83,152 @@ typedef struct
 {
     enum mb_state state;
     uint8_t u8_function;
-    absolute_time_t sof_time;
+    uint16_t u16_crc; // running CRC of received bytes
     uint8_t mb_frame[MODBUS_FRAME_SIZE];
     uint8_t u8_frame_size;
     uint8_t u8_frame_expected_size;
+    uint32_t u32_rx_frame_count; // valid frames
+    uint32_t u32_rx_crc_error;
+    uint32_t u32_rx_truncated; // frames cut by line idle
+    uint32_t u32_rx_skipped; // bytes dropped to resynchronise
     uart_inst_t *uart;
     t_rx_cb rx_cb;
+    // RX ring buffer : head is written by UART IRQ only, tail by modbus_rx_loop only.
+    // tail is the start of the frame being parsed, so the parser can go back to
+    // tail+1 on error, pos is the next byte to parse
+    uint8_t rx_ring[MODBUS_RX_RING_SIZE];
+    volatile uint32_t u32_rx_head;
+    volatile uint32_t u32_rx_tail;
+    uint32_t u32_rx_pos;
+    uint32_t u32_rx_overrun;
+    // ring positions following a line idle time, written by UART IRQ
+    uint32_t rx_boundary[MODBUS_RX_BOUNDARY_SIZE];
+    volatile uint32_t u32_boundary_head;
+    uint32_t u32_boundary_tail;
+    volatile uint32_t u32_rx_time_us; // last IRQ with data
+    volatile uint32_t u32_rx_start_us; // IRQ of the first bytes of the last frame
+    uint32_t u32_idle_us;
+    bool b_server; // frames are requests instead of answers
 }t_mb_ctx;
 
 
+// single producer (core1, acquisition) / single consumer (core0) queue of samples
+typedef struct
+{
+    t_power_data data[NB_POWER_DATA];
+    volatile uint32_t u32_wr_idx; // core1 only
+    volatile uint32_t u32_rd_idx; // core0 only
+    uint32_t u32_drop;
+    t_power_data last; // last sample popped by core0
+}t_power_queue;
+
+typedef struct
+{
+    uint8_t u8_address;
+    uint8_t u8_priority; // 0 is the highest
+    const char* p_name;
+    volatile bool b_enabled;
+    volatile uint32_t u32_period_us;
+    absolute_time_t next_time; // earliest time of next request
+    const t_meter_model* p_model;
+    const uint8_t* p_request; // measures read, built at compile time
+    t_mb_slave_stats stats;
+    t_power_queue queue;
+    volatile bool b_found; // answered the model read at init
+    volatile uint16_t u16_model;
+}t_mb_slave;
+
+// steps of a baudrate change
+typedef enum
+{
+    MODBUS_NEGO_IDLE = 0,
+    MODBUS_NEGO_WRITE, // new code written to each meter at the old speed
+    MODBUS_NEGO_CHECK, // code read back from each meter at the new speed
+    MODBUS_NEGO_REVERT, // old code written at the new speed to the meters that switched
+}t_mb_nego_state;
+
+typedef struct
+{
+    t_mb_nego_state state;
+    uint32_t u32_baud;
+    uint32_t u32_old_baud;
+    uint8_t u8_code; // register 0x0004 baudrate code
+    uint8_t u8_old_code;
+    uint32_t u32_round_mask; // slaves of the current step, bit per index
+    uint32_t u32_answer_mask; // slaves of the step that answered
+    uint8_t u8_slave; // index of the slave of the current request
+    uint8_t u8_function; // of the current request
+    bool b_wait; // answer to the current request outstanding, sent at send_time
+    uint32_t u32_frame_count; // client frames received when it was sent
+}t_mb_nego;
+
+// registers served, big endian, with the CRC of the answers to a whole read
+typedef struct
+{
+    uint16_t u16_nb_reg;
+    uint8_t regs[2*MODBUS_SERVER_MAX_REG];
+    uint16_t u16_full_crc[2]; // FC 0x03, FC 0x04
+}t_mb_image;
+
 /*****************************************************************************/
 /*            PRIVATE FUNCTION                                               */
 /*****************************************************************************/
-uint16_t modbus_crc16(uint8_t *buffer, uint16_t buffer_length);
-uint32_t bytes_to_uint32(uint8_t* pbuf);
 
 void modbus_client_rx_cb(uint8_t * pbuf, uint8_t size);
 void modbus_rx_loop(t_mb_ctx* ctx);
+static uint32_t modbus_rx_chunk(t_mb_ctx* ctx, uint8_t* p_chunk, uint32_t u32_len, bool* b_error);
 
 /*****************************************************************************/
 /*            PRIVATE VAR                                                    */
 /*****************************************************************************/
 static t_mb_ctx mb_ctx_client;
-static t_power_data power_data[NB_POWER_DATA];
-static uint32_t u32_power_data_idx = 0;
+// context attached to each UART IRQ
+static t_mb_ctx* p_uart_ctx[2];
+// meters on the bus, only the main one is polled by default
+#define MODBUS_SLAVE_REQUEST(name, address, model, priority, enabled, period) \
+    METER_READ_REQUEST(mb_request_##name, address, model);
+MODBUS_CLIENT_SLAVES(MODBUS_SLAVE_REQUEST)
+#define MODBUS_SLAVE_ENTRY(name, address, model, priority, enabled, period) \
+    { .u8_address = address, .u8_priority = priority, .p_name = #name, .b_enabled = enabled, .u32_period_us = period, \
+      .p_model = &model##_MODEL, .p_request = mb_request_##name },
+static t_mb_slave mb_slaves[MODBUS_CLIENT_NB_SLAVE] = {
+    MODBUS_CLIENT_SLAVES(MODBUS_SLAVE_ENTRY)
+};
+_Static_assert(count_of(mb_slaves) == MODBUS_CLIENT_NB_SLAVE, "MODBUS_CLIENT_SLAVES and MODBUS_CLIENT_NB_SLAVE differ");
+// slave of the outstanding request, NULL when the bus is idle, read by core0 in modbus_client_idle_us()
+static t_mb_slave* volatile p_wait_slave = NULL;
 static absolute_time_t send_time = 0;
+static uint32_t u32_send_us = 0; // request written, latency trace
+// framing errors of the bus when the outstanding request was sent
+static uint32_t u32_send_rx_errors = 0;
+// baudrate request is written by core0
+static volatile uint32_t u32_baudrate_request = 0;
+static volatile uint32_t u32_baudrate = MODBUS_CLIENT_DEFAULT_BAUDRATE;
+static uint32_t u32_consecutive_timeout = 0;
+// core1 : baudrate change in progress
+static t_mb_nego nego;
+// written by core1, printed by core0
+static t_mb_baud_status baud_status;
+// achieved sample rate, all slaves
+static absolute_time_t rate_time = 0;
+static uint32_t u32_rate_count = 0;
+static volatile uint32_t u32_sps_x100 = 0;
+// core1 : called with each decoded sample
+static t_power_data_cb client_sample_cb = NULL;
+// baudrates supported by the meter, register 0x0004 code is 5 + index
+static const uint32_t modbus_client_baudrates[] = { 4800, 9600, 19200 };
+
+static t_mb_ctx mb_ctx_server;
+// written by core0 only : the image being built is the one not published, then
+// the sequence is incremented. The published image is mb_images[seq & 1].
+static t_mb_image mb_images[2];
+static volatile uint32_t u32_image_seq = 0;
+// core1 : CRC of address, function and byte count of a read of n registers
+static uint16_t mb_server_header_crc[2][MODBUS_SERVER_MAX_REG + 1];
+static uint8_t mb_server_tx[MODBUS_SERVER_ANSWER_SIZE];
+static uint32_t u32_server_tx_len = 0;
+static uint32_t u32_server_tx_pos = 0;
+static t_mb_server_stats server_stats;
 
 /*****************************************************************************/
 /*            FUNCTION DEFINITION                                            */
@@ -82,10 +242,53 @@ void modbus_print_frame(uint8_t* p_frame, uint8_t u8_size) {
 }
 
 
+// core0 : latest sample of the main meter received through modbus_sync_power_data()
 t_power_data* modbus_get_power_data(void) {
-    uint8_t u8_power_data_idx = (u32_power_data_idx-1) % NB_POWER_DATA;
-    
-    return &power_data[u8_power_data_idx];
+    return &mb_slaves[0].queue.last;
+}
+
+t_power_data* modbus_get_slave_power_data(uint8_t u8_slave) {
+    return &mb_slaves[u8_slave].queue.last;
+}
+
+// core0 : pop the oldest sample of a slave from its acquisition queue
+bool modbus_pop_slave_power_data(uint8_t u8_slave, t_power_data* p_data) {
+    t_power_queue* p_queue = &mb_slaves[u8_slave].queue;
+    uint32_t u32_rd_idx = p_queue->u32_rd_idx;
+    if( u32_rd_idx == p_queue->u32_wr_idx ) {
+        // queue empty
+        return false;
+    }
+    // read index before data
+    __dmb();
+    *p_data = p_queue->data[u32_rd_idx % NB_POWER_DATA];
+    // release slot after the copy
+    __dmb();
+    p_queue->u32_rd_idx = u32_rd_idx + 1;
+    return true;
+}
+
+bool modbus_pop_power_data(t_power_data* p_data) {
+    return modbus_pop_slave_power_data(0, p_data);
+}
+
+// core0 : drain acquisition queues, keep latest sample of each slave, sample_cb sees every sample
+void modbus_sync_power_data(t_power_data_cb sample_cb) {
+    for(uint8_t i=0; i<MODBUS_CLIENT_NB_SLAVE; i++) {
+        while( modbus_pop_slave_power_data(i, &mb_slaves[i].queue.last) ) {
+            if( sample_cb != NULL ) {
+                sample_cb(i, &mb_slaves[i].queue.last);
+            }
+        }
+    }
+}
+
+uint32_t modbus_get_power_data_drop(void) {
+    uint32_t u32_drop = 0;
+    for(uint8_t i=0; i<MODBUS_CLIENT_NB_SLAVE; i++) {
+        u32_drop += mb_slaves[i].queue.u32_drop;
+    }
+    return u32_drop;
 }
 
 
@@ -97,246 +300,913 @@ void modbus_send_blocking(t_mb_ctx *ctx, uint8_t* buf, uint8_t size) {
 }
 
 
-void modbus_ctx_init(t_mb_ctx *ctx, uart_inst_t *uart, t_rx_cb rx_cb) {
-    memset(ctx, 0, sizeof(ctx));
+static void __not_in_flash_func(modbus_uart_rx_isr)(t_mb_ctx* ctx) {
+    // drain UART FIFO into ring buffer, the main loop consume it later
+    uint32_t u32_head = ctx->u32_rx_head;
+    uint32_t u32_now_us = time_us_32();
+    if( uart_is_readable(ctx->uart) && ((u32_now_us - ctx->u32_rx_time_us) > ctx->u32_idle_us) ) {
+        // line was idle, first byte starts a frame
+        uint32_t u32_boundary_head = ctx->u32_boundary_head;
+        if( (u32_boundary_head - ctx->u32_boundary_tail) < MODBUS_RX_BOUNDARY_SIZE ) {
+            ctx->rx_boundary[u32_boundary_head & (MODBUS_RX_BOUNDARY_SIZE-1)] = u32_head;
+            ctx->u32_boundary_head = u32_boundary_head + 1;
+        }
+        ctx->u32_rx_start_us = u32_now_us;
+    }
+    while( uart_is_readable(ctx->uart) ) {
+        uint8_t byte = (uint8_t) uart_getc(ctx->uart);
+        if( (u32_head - ctx->u32_rx_tail) < MODBUS_RX_RING_SIZE ) {
+            ctx->rx_ring[u32_head & (MODBUS_RX_RING_SIZE-1)] = byte;
+            u32_head++;
+        } else {
+            // ring full, byte is lost
+            ctx->u32_rx_overrun++;
+        }
+    }
+    // publish data before head
+    __compiler_memory_barrier();
+    ctx->u32_rx_time_us = u32_now_us;
+    ctx->u32_rx_head = u32_head;
+}
+
+static void __not_in_flash_func(modbus_uart0_irq)(void) {
+    modbus_uart_rx_isr(p_uart_ctx[0]);
+    // client UART
+    sched_post(SCHED_TASK_MODBUS);
+}
+
+static void __not_in_flash_func(modbus_uart1_irq)(void) {
+    modbus_uart_rx_isr(p_uart_ctx[1]);
+    // server UART
+    sched_post(SCHED_TASK_MODBUS_SERVER);
+}
+
+// set UART speed and idle time, drop bytes received at previous speed
+void modbus_ctx_set_baudrate(t_mb_ctx *ctx, uint32_t u32_baud) {
+    uart_set_baudrate(ctx->uart, u32_baud);
+    // 10 bits per character
+    ctx->u32_idle_us = (MODBUS_IDLE_CHARS * 10 * 1000000) / u32_baud;
+    uint32_t u32_irq_state = save_and_disable_interrupts();
+    ctx->u32_rx_tail = ctx->u32_rx_head;
+    ctx->u32_rx_pos = ctx->u32_rx_head;
+    ctx->u32_boundary_tail = ctx->u32_boundary_head;
+    restore_interrupts(u32_irq_state);
+    ctx->state = MODBUS_WAIT_SOF;
+    ctx->u8_frame_size = 0;
+}
+
+void modbus_ctx_init(t_mb_ctx *ctx, uart_inst_t *uart, uint32_t u32_baud, t_rx_cb rx_cb) {
+    memset(ctx, 0, sizeof(*ctx));
     ctx->state = MODBUS_WAIT_SOF;
     ctx->uart = uart;
     ctx->rx_cb = rx_cb;
+    modbus_ctx_set_baudrate(ctx, u32_baud);
+
+    // RX interrupt (FIFO level and RX timeout) feed the ring buffer
+    uint8_t u8_uart_idx = uart_get_index(uart);
+    p_uart_ctx[u8_uart_idx] = ctx;
+    int irq = (u8_uart_idx == 0) ? UART0_IRQ : UART1_IRQ;
+    irq_set_exclusive_handler(irq, (u8_uart_idx == 0) ? modbus_uart0_irq : modbus_uart1_irq);
+    irq_set_enabled(irq, true);
+    uart_set_irq_enables(uart, true, false);
+}
+
+uint32_t modbus_get_rx_overrun(void) {
+    return mb_ctx_client.u32_rx_overrun;
+}
+
+// framing errors of the client bus
+void modbus_get_rx_errors(uint32_t* p_crc_error, uint32_t* p_truncated, uint32_t* p_skipped) {
+    *p_crc_error = mb_ctx_client.u32_rx_crc_error;
+    *p_truncated = mb_ctx_client.u32_rx_truncated;
+    *p_skipped = mb_ctx_client.u32_rx_skipped;
+}
+
+// time of one request/response cycle on the wire
+static uint32_t modbus_client_cycle_us(uint32_t u32_baud) {
+    return (uint32_t)(((uint64_t)MODBUS_CLIENT_CYCLE_CHARS * 10 * 1000000) / u32_baud);
+}
+
+static void modbus_client_set_uart_baudrate(uint32_t u32_baud) {
+    modbus_ctx_set_baudrate(&mb_ctx_client, u32_baud);
+    u32_baudrate = u32_baud;
+}
+
+// core1 : send a request and wait for a valid answer from the same slave with the same function code.
+// Busy waits, only used by modbus_client_init() before the scheduler runs.
+static bool modbus_client_transaction(uint8_t* request, uint8_t size) {
+    uint32_t u32_frame_count = mb_ctx_client.u32_rx_frame_count;
+    uint32_t u32_timeout_us = modbus_client_cycle_us(u32_baudrate) + 100*1000;
+
+    modbus_send_blocking(&mb_ctx_client, request, size);
+    absolute_time_t start_time = get_absolute_time();
+    while( absolute_time_diff_us(start_time, get_absolute_time()) < u32_timeout_us ) {
+        modbus_rx_loop(&mb_ctx_client);
+        // skip late answers to previous requests
+        if( (mb_ctx_client.u32_rx_frame_count != u32_frame_count) && (mb_ctx_client.u8_function == request[1])
+            && (mb_ctx_client.mb_frame[0] == request[0]) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// core1 : send the request of the current step to mb_slaves[nego.u8_slave], its answer is awaited by the next steps
+static void modbus_client_negotiate_send(void) {
+    uint8_t u8_address = mb_slaves[nego.u8_slave].u8_address;
+    nego.u32_frame_count = mb_ctx_client.u32_rx_frame_count;
+    if( nego.state != MODBUS_NEGO_CHECK ) {
+        // address in high byte, 8N1 and baudrate code in low byte
+        uint8_t u8_code = (nego.state == MODBUS_NEGO_WRITE) ? nego.u8_code : nego.u8_old_code;
+        uint8_t write_request[] = {u8_address, 0x10, 0x00, 0x04, 0x00, 0x01, 0x02, u8_address, u8_code, 0, 0};
+        nego.u8_function = write_request[1];
+        modbus_send_blocking(&mb_ctx_client, write_request, sizeof(write_request));
+    } else {
+        uint8_t read_request[] = {u8_address, 0x03, 0x00, 0x04, 0x00, 0x01, 0, 0};
+        nego.u8_function = read_request[1];
+        modbus_send_blocking(&mb_ctx_client, read_request, sizeof(read_request));
+    }
+    send_time = get_absolute_time();
+    nego.b_wait = true;
+}
+
+// register 0x0004 code of a meter speed, 0 if not supported
+static uint8_t modbus_client_baud_code(uint32_t u32_baud) {
+    for(uint8_t i=0; i<count_of(modbus_client_baudrates); i++) {
+        if( modbus_client_baudrates[i] == u32_baud ) {
+            return 5 + i;
+        }
+    }
+    return 0;
+}
+
+// core1 : start a baudrate change, its steps are run by modbus_client_loop()
+static void modbus_client_negotiate_start(uint32_t u32_baud) {
+    uint8_t u8_code = modbus_client_baud_code(u32_baud);
+    baud_status.u32_baud = u32_baud;
+    baud_status.u8_nb_ok = 0;
+    baud_status.u8_nb_enabled = 0;
+    baud_status.u32_stranded_mask = 0;
+    if( u8_code == 0 ) {
+        baud_status.result = MODBUS_BAUD_UNSUPPORTED;
+        u32_baudrate_request = 0;
+        return;
+    }
+    baud_status.result = MODBUS_BAUD_PENDING;
+    memset(&nego, 0, sizeof(nego));
+    nego.state = MODBUS_NEGO_WRITE;
+    nego.u32_baud = u32_baud;
+    nego.u32_old_baud = u32_baudrate;
+    nego.u8_code = u8_code;
+    nego.u8_old_code = modbus_client_baud_code(u32_baudrate);
+    for(uint8_t i=0; i<MODBUS_CLIENT_NB_SLAVE; i++) {
+        if( mb_slaves[i].b_enabled ) {
+            nego.u32_round_mask |= 1u << i;
+            baud_status.u8_nb_enabled++;
+        }
+    }
+}
+
+// core1 : next step on the slaves of u32_round_mask
+static void modbus_client_negotiate_next(t_mb_nego_state state, uint32_t u32_round_mask) {
+    if( (state == MODBUS_NEGO_REVERT) && (nego.u8_old_code == 0) ) {
+        // old speed can't be written back
+        baud_status.u32_stranded_mask |= u32_round_mask;
+        u32_round_mask = 0;
+    }
+    nego.state = state;
+    nego.u32_round_mask = u32_round_mask;
+    nego.u32_answer_mask = 0;
+    nego.u8_slave = 0;
+}
+
+// core1 : baudrate change over, at the old speed unless every meter switched
+static void modbus_client_negotiate_end(enum mb_baud_result result) {
+    if( result != MODBUS_BAUD_OK ) {
+        modbus_client_set_uart_baudrate(nego.u32_old_baud);
+    }
+    baud_status.result = result;
+    nego.state = MODBUS_NEGO_IDLE;
+    u32_baudrate_request = 0;
+    u32_consecutive_timeout = 0;
+}
+
+// core1 : write meter communication register (0x0004) of every slave at the old speed,
+// then switch UART speed only if they all acknowledged and read it back. The meters
+// that switched are sent back to the old speed when any other didn't, the ones
+// whose speed is then unknown are reported as stranded.
+// Never waits : returns while an answer is outstanding, the RX IRQ or the timeout
+// wake the task for the next step.
+static void modbus_client_negotiate_step(void) {
+    if( nego.b_wait ) {
+        // skip late answers to previous requests
+        t_mb_slave* p_slave = &mb_slaves[nego.u8_slave];
+        bool b_frame = (mb_ctx_client.u32_rx_frame_count != nego.u32_frame_count) && (mb_ctx_client.mb_frame[0] == p_slave->u8_address);
+        bool b_answer = b_frame && (mb_ctx_client.u8_function == nego.u8_function);
+        bool b_exception = b_frame && (mb_ctx_client.u8_function == (nego.u8_function | 0x80));
+        if( !b_answer && !b_exception && (absolute_time_diff_us(send_time, get_absolute_time()) <= (modbus_client_cycle_us(u32_baudrate) + 100*1000)) ) {
+            return;
+        }
+        if( b_exception ) {
+            p_slave->stats.u32_exception++;
+        } else if( !b_answer ) {
+            p_slave->stats.u32_miss++;
+        }
+        if( b_answer ) {
+            nego.u32_answer_mask |= 1u << nego.u8_slave;
+        }
+        nego.b_wait = false;
+        nego.u8_slave++;
+    }
+
+    while( nego.state != MODBUS_NEGO_IDLE ) {
+        while( (nego.u8_slave < MODBUS_CLIENT_NB_SLAVE) && !(nego.u32_round_mask & (1u << nego.u8_slave)) ) {
+            nego.u8_slave++;
+        }
+        if( nego.u8_slave < MODBUS_CLIENT_NB_SLAVE ) {
+            modbus_client_negotiate_send();
+            return;
+        }
+
+        uint32_t u32_answer_mask = nego.u32_answer_mask;
+        if( nego.state == MODBUS_NEGO_WRITE ) {
+            if( u32_answer_mask == 0 ) {
+                // no meter switched
+                modbus_client_negotiate_end(MODBUS_BAUD_FAILED);
+            } else {
+                // the meters switch after their acknowledge
+                modbus_client_set_uart_baudrate(nego.u32_baud);
+                bool b_all = (u32_answer_mask == nego.u32_round_mask);
+                modbus_client_negotiate_next(b_all ? MODBUS_NEGO_CHECK : MODBUS_NEGO_REVERT, u32_answer_mask);
+            }
+        } else if( nego.state == MODBUS_NEGO_CHECK ) {
+            baud_status.u8_nb_ok = (uint8_t)__builtin_popcount(u32_answer_mask);
+            if( u32_answer_mask == nego.u32_round_mask ) {
+                modbus_client_negotiate_end(MODBUS_BAUD_OK);
+            } else {
+                // acknowledged but silent at the new speed, lost at either speed
+                baud_status.u32_stranded_mask = nego.u32_round_mask & ~u32_answer_mask;
+                modbus_client_negotiate_next(MODBUS_NEGO_REVERT, u32_answer_mask);
+            }
+        } else {
+            // not sent back, left at the new speed
+            baud_status.u32_stranded_mask |= nego.u32_round_mask & ~u32_answer_mask;
+            modbus_client_negotiate_end(MODBUS_BAUD_FAILED);
+        }
+    }
 }
 
 void modbus_client_init(void) {
-    memset(&power_data, 0, sizeof(power_data));
-    modbus_ctx_init(&mb_ctx_client, MODBUS_CLIENT_UART, modbus_client_rx_cb);
+    modbus_ctx_init(&mb_ctx_client, MODBUS_CLIENT_UART, u32_baudrate, modbus_client_rx_cb);
+
+    for(uint8_t i=0; i<MODBUS_CLIENT_NB_SLAVE; i++) {
+        t_mb_slave* p_slave = &mb_slaves[i];
+        memset(&p_slave->queue, 0, sizeof(p_slave->queue));
+        memset(&p_slave->stats, 0, sizeof(p_slave->stats));
+        p_slave->stats.u32_latency_min_us = UINT32_MAX;
+        p_slave->next_time = get_absolute_time();
 
-    // read sensor properties
-    uint8_t request[] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x04, 0, 0};
-    modbus_send_blocking(&mb_ctx_client, request, sizeof(request));
+        if( p_slave->b_enabled ) {
+            // read sensor properties
+            uint8_t model_request[] = {p_slave->u8_address, 0x03, 0x00, 0x00, 0x00, 0x04, 0, 0};
+            // printed by core0
+            p_slave->b_found = modbus_client_transaction(model_request, sizeof(model_request));
+            if( p_slave->b_found ) {
+                p_slave->u16_model = ((uint16_t)mb_ctx_client.mb_frame[3] << 8) | mb_ctx_client.mb_frame[4];
+            }
+        }
+    }
     send_time = get_absolute_time();
+
+#if MODBUS_CLIENT_STARTUP_BAUDRATE
+    // switch to a faster speed once the client task runs
+    u32_baudrate_request = MODBUS_CLIENT_STARTUP_BAUDRATE;
+#endif
 }
 
+// due slave with the highest priority, the one waiting for the longest time among equals
+static t_mb_slave* modbus_client_next_slave(absolute_time_t cur_time) {
+    t_mb_slave* p_next = NULL;
+    for(uint8_t i=0; i<MODBUS_CLIENT_NB_SLAVE; i++) {
+        t_mb_slave* p_slave = &mb_slaves[i];
+        if( !p_slave->b_enabled || (absolute_time_diff_us(p_slave->next_time, cur_time) < 0) ) {
+            continue;
+        }
+        if( (p_next == NULL) || (p_slave->u8_priority < p_next->u8_priority)
+            || ((p_slave->u8_priority == p_next->u8_priority) && (absolute_time_diff_us(p_slave->next_time, p_next->next_time) > 0)) ) {
+            p_next = p_slave;
+        }
+    }
+    return p_next;
+}
+
+// core1 : next run of the client task, received bytes wake it from the UART IRQ
+static void modbus_client_schedule(void) {
+    absolute_time_t cur_time = get_absolute_time();
+    int64_t i64_wait_us = INT32_MAX;
+    if( (p_wait_slave != NULL) || nego.b_wait ) {
+        // response timeout
+        i64_wait_us = absolute_time_diff_us(cur_time, send_time) + modbus_client_cycle_us(u32_baudrate) + 100*1000 + 1;
+    } else if( u32_baudrate_request ) {
+        i64_wait_us = 0;
+    } else {
+        // next poll
+        for(uint8_t i=0; i<MODBUS_CLIENT_NB_SLAVE; i++) {
+            if( mb_slaves[i].b_enabled ) {
+                int64_t i64_diff_us = absolute_time_diff_us(cur_time, mb_slaves[i].next_time);
+                if( i64_diff_us < i64_wait_us ) {
+                    i64_wait_us = i64_diff_us;
+                }
+            }
+        }
+    }
+    if( mb_ctx_client.state != MODBUS_WAIT_SOF ) {
+        // frame cut by line idle
+        int32_t i32_idle_us = (int32_t)(mb_ctx_client.u32_rx_time_us + mb_ctx_client.u32_idle_us - time_us_32()) + 1;
+        if( i32_idle_us < i64_wait_us ) {
+            i64_wait_us = i32_idle_us;
+        }
+    }
+    if( i64_wait_us != INT32_MAX ) {
+        sched_wake_in_us(SCHED_TASK_MODBUS, (i64_wait_us < 0) ? 0 : (uint32_t)i64_wait_us);
+    }
+}
 
 void modbus_client_loop(void) {
-    const int64_t SEND_PERIOD_US = 1000*1000; // 1000ms
-    // read register 0x0048 -> 0x0048+0x000E
-    const uint8_t request[] = {0x01, 0x03, 0x00, 0x48, 0x00, 0x0E, 0x44, 0x18};
 
-    // blink LED
+    // baudrate change requested by console, once the pending answer is received.
+    // Polls are suspended until it is over.
+    if( u32_baudrate_request && (p_wait_slave == NULL) ) {
+        if( nego.state == MODBUS_NEGO_IDLE ) {
+            modbus_client_negotiate_start(u32_baudrate_request);
+        }
+        modbus_rx_loop(&mb_ctx_client);
+        modbus_client_negotiate_step();
+        modbus_client_schedule();
+        return;
+    }
+
     absolute_time_t cur_time = get_absolute_time();
-    int64_t diff_us = absolute_time_diff_us(send_time, cur_time);
-    if( diff_us > SEND_PERIOD_US ) {
-        send_time = cur_time;
-        // read current, power, ...
-        uart_write_blocking (MODBUS_CLIENT_UART, request, sizeof(request));
+
+    // response timeout
+    if( (p_wait_slave != NULL) && (absolute_time_diff_us(send_time, cur_time) > (modbus_client_cycle_us(u32_baudrate) + 100*1000)) ) {
+        p_wait_slave->stats.u32_miss++;
+        p_wait_slave = NULL;
+        u32_consecutive_timeout++;
+        if( u32_consecutive_timeout >= MODBUS_CLIENT_MAX_TIMEOUT ) {
+            // meters may have been left at another speed, try next one
+            uint8_t i = 0;
+            while( (i < count_of(modbus_client_baudrates)) && (modbus_client_baudrates[i] != u32_baudrate) ) {
+                i++;
+            }
+            i = (i + 1) % count_of(modbus_client_baudrates);
+            baud_status.u32_fallback++;
+            modbus_client_set_uart_baudrate(modbus_client_baudrates[i]);
+            u32_consecutive_timeout = 0;
+        }
+    }
+
+    // one request at a time on the bus
+    if( p_wait_slave == NULL ) {
+        t_mb_slave* p_slave = modbus_client_next_slave(cur_time);
+        if( p_slave != NULL ) {
+            send_time = cur_time;
+            // period 0 polls back to back
+            p_slave->next_time = delayed_by_us(cur_time, p_slave->u32_period_us);
+            p_slave->stats.u32_request++;
+            p_wait_slave = p_slave;
+            u32_send_rx_errors = mb_ctx_client.u32_rx_crc_error + mb_ctx_client.u32_rx_truncated;
+            uart_write_blocking (MODBUS_CLIENT_UART, p_slave->p_request, 8);
+            u32_send_us = time_us_32();
+        }
     }
 
     // RX
     modbus_rx_loop(&mb_ctx_client);
 
+    // answer damaged by line noise and nothing left to parse, poll again without waiting for the timeout
+    if( (p_wait_slave != NULL) && (mb_ctx_client.state == MODBUS_WAIT_SOF)
+        && ((mb_ctx_client.u32_rx_crc_error + mb_ctx_client.u32_rx_truncated) != u32_send_rx_errors) ) {
+        p_wait_slave->stats.u32_miss++;
+        p_wait_slave = NULL;
+    }
+
+    modbus_client_schedule();
+}
+
+// core0 : poll period of all slaves, 0 polls as fast as the meters answer
+void modbus_client_set_period_us(uint32_t u32_period_us) {
+    for(uint8_t i=0; i<MODBUS_CLIENT_NB_SLAVE; i++) {
+        mb_slaves[i].u32_period_us = u32_period_us;
+    }
+    sched_post(SCHED_TASK_MODBUS);
+}
+
+uint32_t modbus_client_get_period_us(void) {
+    return mb_slaves[0].u32_period_us;
+}
+
+// core0 : poll period of one slave
+void modbus_slave_set_period_us(uint8_t u8_slave, uint32_t u32_period_us) {
+    mb_slaves[u8_slave].u32_period_us = u32_period_us;
+    sched_post(SCHED_TASK_MODBUS);
+}
+
+void modbus_slave_enable(uint8_t u8_slave, bool b_enabled) {
+    mb_slaves[u8_slave].b_enabled = b_enabled;
+    sched_post(SCHED_TASK_MODBUS);
+}
+
+// core0 : copy of counters updated by core1, a field may be one sample late
+void modbus_slave_get_info(uint8_t u8_slave, t_mb_slave_info* p_info) {
+    t_mb_slave* p_slave = &mb_slaves[u8_slave];
+    p_info->u8_address = p_slave->u8_address;
+    p_info->u8_priority = p_slave->u8_priority;
+    p_info->p_name = p_slave->p_name;
+    p_info->b_enabled = p_slave->b_enabled;
+    p_info->u32_period_us = p_slave->u32_period_us;
+    p_info->b_found = p_slave->b_found;
+    p_info->u16_model = p_slave->u16_model;
+    p_info->stats = p_slave->stats;
+    p_info->stats.u32_drop = p_slave->queue.u32_drop;
+}
+
+// core0 : time before the next request, 0 while a request is outstanding.
+// Exact when core1 is locked out, used to run flash operations between two polls.
+uint32_t modbus_client_idle_us(void) {
+    if( (p_wait_slave != NULL) || u32_baudrate_request ) {
+        return 0;
+    }
+    absolute_time_t cur_time = get_absolute_time();
+    int64_t i64_idle_us = INT32_MAX;
+    for(uint8_t i=0; i<MODBUS_CLIENT_NB_SLAVE; i++) {
+        if( mb_slaves[i].b_enabled ) {
+            int64_t i64_diff_us = absolute_time_diff_us(cur_time, mb_slaves[i].next_time);
+            if( i64_diff_us < i64_idle_us ) {
+                i64_idle_us = i64_diff_us;
+            }
+        }
+    }
+    return (i64_idle_us < 0) ? 0 : (uint32_t)i64_idle_us;
+}
+
+// shortest period at current baudrate
+uint32_t modbus_client_get_min_period_us(void) {
+    return modbus_client_cycle_us(u32_baudrate);
+}
+
+// core0 : negotiation is done by core1 on next loop
+void modbus_client_request_baudrate(uint32_t u32_baud) {
+    u32_baudrate_request = u32_baud;
+    sched_post(SCHED_TASK_MODBUS);
+}
+
+uint32_t modbus_client_get_baudrate(void) {
+    return u32_baudrate;
+}
+
+// core0 : copy of the last baudrate change, fields may be from different steps
+void modbus_client_get_baud_status(t_mb_baud_status* p_status) {
+    *p_status = baud_status;
+}
+
+// before modbus_client_init(), the callback runs on core1 right after decoding
+void modbus_client_set_sample_cb(t_power_data_cb sample_cb) {
+    client_sample_cb = sample_cb;
+}
+
+// samples per second x100 measured over the last second
+uint32_t modbus_client_get_sps_x100(void) {
+    return u32_sps_x100;
 }
 
 void modbus_client_rx_cb(uint8_t * pbuf, uint8_t size) {
     // print frame
     //printf("CMB RX ");
-    modbus_print_frame(pbuf, size);
+    //modbus_print_frame(pbuf, size);
     uint8_t u8_address = pbuf[0];
     uint8_t u8_function_code = pbuf[1];
+    t_mb_slave* p_slave = p_wait_slave;
+    // only the answer to the outstanding request is expected
+    if( (p_slave == NULL) || (u8_address != p_slave->u8_address) ) {
+        return;
+    }
+    if( u8_function_code == 0x83 ) {
+        p_slave->stats.u32_exception++;
+        p_wait_slave = NULL;
+        return;
+    }
     // check if frame match the request we send, ignore other frame
-    if((u8_function_code == 3) && (size==5+4*0xE)) {
-        //uint8_t u8_data_size = pbuf[2];
-
-        // build data struct
-        uint8_t u8_power_data_idx = u32_power_data_idx % NB_POWER_DATA;
-        t_power_data* p_data = &power_data[u8_power_data_idx];
-        
-        //common value
-        p_data->u32_index = u32_power_data_idx++;
-        p_data->time = get_absolute_time();
-        p_data->tension_mv = bytes_to_uint32(&pbuf[3]) / 10;
-        p_data->frequence_mhz = bytes_to_uint32(&pbuf[31]) * 10;
-        // voie 1
-        p_data->voie[0].courant_ma = bytes_to_uint32(&pbuf[7]) / 10;
-        p_data->voie[0].puissance_active_mw = bytes_to_uint32(&pbuf[11]) / 10;
-        if( pbuf[27] ) {
-            p_data->voie[0].puissance_active_mw = -p_data->voie[0].puissance_active_mw;
-        }
-        p_data->voie[0].energie_wh = bytes_to_uint32(&pbuf[15]) / 10;
-        p_data->voie[0].facteur_puissance = bytes_to_uint32(&pbuf[19]);
-        // voie 2
-        p_data->voie[1].courant_ma = bytes_to_uint32(&pbuf[39]) / 10;
-        p_data->voie[1].puissance_active_mw = bytes_to_uint32(&pbuf[43]) / 10;
-        if( pbuf[28] ) {
-            p_data->voie[1].puissance_active_mw = -p_data->voie[1].puissance_active_mw;
-        }
-        p_data->voie[1].energie_wh = bytes_to_uint32(&pbuf[47]) / 10;
-        p_data->voie[1].facteur_puissance = bytes_to_uint32(&pbuf[51]);
+    const t_meter_model* p_model = p_slave->p_model;
+    if( (u8_function_code == 3) && (pbuf[2] == p_model->u8_data_size) && (size == (5 + p_model->u8_data_size)) ) {
+        p_wait_slave = NULL;
+        u32_consecutive_timeout = 0;
+
+        absolute_time_t cur_time = get_absolute_time();
+        // request to answer latency
+        uint32_t u32_latency_us = (uint32_t)absolute_time_diff_us(send_time, cur_time);
+        t_mb_slave_stats* p_stats = &p_slave->stats;
+        p_stats->u32_response++;
+        p_stats->u32_latency_us = u32_latency_us;
+        p_stats->u64_latency_sum_us += u32_latency_us;
+        if( u32_latency_us < p_stats->u32_latency_min_us ) {
+            p_stats->u32_latency_min_us = u32_latency_us;
+        }
+        if( u32_latency_us > p_stats->u32_latency_max_us ) {
+            p_stats->u32_latency_max_us = u32_latency_us;
+        }
+
+        // achieved rate over one second
+        u32_rate_count++;
+        int64_t rate_diff_us = absolute_time_diff_us(rate_time, cur_time);
+        if( rate_diff_us >= 1000*1000 ) {
+            u32_sps_x100 = (uint32_t)(((uint64_t)u32_rate_count * 100 * 1000000) / rate_diff_us);
+            u32_rate_count = 0;
+            rate_time = cur_time;
+        }
+
+        // decode in the queue when there is room, core0 is late if full
+        t_power_queue* p_queue = &p_slave->queue;
+        uint32_t u32_wr_idx = p_queue->u32_wr_idx;
+        bool b_full = (u32_wr_idx - p_queue->u32_rd_idx) >= NB_POWER_DATA;
+        t_power_data dropped_data;
+        t_power_data* p_data = b_full ? &dropped_data : &p_queue->data[u32_wr_idx % NB_POWER_DATA];
+
+        p_data->u32_index = u32_wr_idx;
+        p_data->time = cur_time;
+        memset(p_data->u32_stage_us, 0, sizeof(p_data->u32_stage_us));
+        latency_stamp_at(p_data->u32_stage_us, LATENCY_STAGE_SEND, u32_send_us);
+        latency_stamp_at(p_data->u32_stage_us, LATENCY_STAGE_RX_FIRST, mb_ctx_client.u32_rx_start_us);
+        latency_stamp_at(p_data->u32_stage_us, LATENCY_STAGE_RX_LAST, mb_ctx_client.u32_rx_time_us);
+        p_model->decode(&pbuf[3], p_data);
+        latency_stamp(p_data->u32_stage_us, LATENCY_STAGE_DECODE);
+
+        // control sees every sample, even the ones core0 will lose
+        if( client_sample_cb != NULL ) {
+            client_sample_cb((uint8_t)(p_slave - mb_slaves), p_data);
+        }
+        if( b_full ) {
+            p_queue->u32_drop++;
+            return;
+        }
+
+        // publish sample to core0
+        __dmb();
+        p_queue->u32_wr_idx = u32_wr_idx + 1;
+        sched_post(SCHED_TASK_SYNC);
     }
 }
 
 
+// drop the frame being parsed and parse again from its second byte
+static void modbus_rx_resync(t_mb_ctx* ctx) {
+    ctx->u32_rx_tail++;
+    ctx->u32_rx_pos = ctx->u32_rx_tail;
+    ctx->u32_rx_skipped++;
+    ctx->state = MODBUS_WAIT_SOF;
+    ctx->u8_frame_size = 0;
+}
+
+// valid frame received, hand it to the callback
+static void modbus_rx_frame(t_mb_ctx* ctx) {
+    // exceptions are counted by the callback, in the stats of their slave
+    ctx->u32_rx_frame_count++;
+    ctx->rx_cb(ctx->mb_frame, ctx->u8_frame_size);
+    ctx->state = MODBUS_WAIT_SOF;
+    ctx->u8_frame_size = 0;
+}
+
 void modbus_rx_loop(t_mb_ctx* ctx) {
+    // head before IRQ time, a newer time only delays idle detection
+    uint32_t u32_head = ctx->u32_rx_head;
+    __compiler_memory_barrier();
+    bool b_idle = (time_us_32() - ctx->u32_rx_time_us) > ctx->u32_idle_us;
 
-    while( uart_is_readable(ctx->uart) ) {
-        uint8_t byte = (uint8_t) uart_get_hw(ctx->uart)->dr;
-        // check max size
-        if(ctx->u8_frame_size >= MODBUS_FRAME_SIZE) {
-            // frame too long, timeout will reset comm
+    while( true ) {
+        // parse up to the next frame start marked by IRQ, or up to head
+        uint32_t u32_end = u32_head;
+        bool b_closed = b_idle;
+        while( ctx->u32_boundary_tail != ctx->u32_boundary_head ) {
+            uint32_t u32_boundary = ctx->rx_boundary[ctx->u32_boundary_tail & (MODBUS_RX_BOUNDARY_SIZE-1)];
+            if( (int32_t)(u32_boundary - ctx->u32_rx_tail) > 0 ) {
+                if( (int32_t)(u32_boundary - u32_head) <= 0 ) {
+                    u32_end = u32_boundary;
+                    b_closed = true;
+                }
+                break;
+            }
+            ctx->u32_boundary_tail++;
+        }
+
+        // consume ring buffer by contiguous chunks
+        while( ctx->u32_rx_pos != u32_end ) {
+            uint32_t u32_pos_idx = ctx->u32_rx_pos & (MODBUS_RX_RING_SIZE-1);
+            uint32_t u32_chunk = u32_end - ctx->u32_rx_pos;
+            if( u32_chunk > (MODBUS_RX_RING_SIZE - u32_pos_idx) ) {
+                u32_chunk = MODBUS_RX_RING_SIZE - u32_pos_idx;
+            }
+            bool b_error = false;
+            ctx->u32_rx_pos += modbus_rx_chunk(ctx, &ctx->rx_ring[u32_pos_idx], u32_chunk, &b_error);
+            if( b_error ) {
+                // bad CRC or header, look for a frame starting at next byte
+                ctx->u32_rx_crc_error++;
+                modbus_rx_resync(ctx);
+            } else if( ctx->state == MODBUS_WAIT_SOF ) {
+                // frame done, release its bytes
+                ctx->u32_rx_tail = ctx->u32_rx_pos;
+            }
+        }
+
+        if( ctx->state == MODBUS_WAIT_SOF ) {
+            ctx->u32_rx_tail = ctx->u32_rx_pos;
+            if( u32_end == u32_head ) {
+                break;
+            }
+        } else if( b_closed && (ctx->state == MODBUS_WAIT_IDLE) ) {
+            // address + function + crc at least
+            if( (ctx->u8_frame_size >= 4) && (ctx->u16_crc == 0) ) {
+                modbus_rx_frame(ctx);
+                ctx->u32_rx_tail = ctx->u32_rx_pos;
+            } else {
+                ctx->u32_rx_crc_error++;
+                modbus_rx_resync(ctx);
+            }
+        } else if( b_closed ) {
+            // line went idle in the middle of a frame, a frame may start after its first byte
+            ctx->u32_rx_truncated++;
+            modbus_rx_resync(ctx);
+        } else {
+            // wait for the end of the frame
             break;
         }
+    }
+}
 
-        ctx->mb_frame[ctx->u8_frame_size++] = byte;
+// run frame state machine on a chunk of received bytes, return number of bytes consumed.
+// Stop after a complete frame, b_error is set if it is not valid.
+static uint32_t modbus_rx_chunk(t_mb_ctx* ctx, uint8_t* p_chunk, uint32_t u32_len, bool* b_error) {
+    uint32_t u32_pos = 0;
 
+    while( u32_pos < u32_len ) {
         switch(ctx->state) {
             case MODBUS_WAIT_SOF:
-                ctx->sof_time = get_absolute_time();
+                ctx->u16_crc = modbus_crc16_update(MODBUS_CRC_INIT, &p_chunk[u32_pos], 1);
+                ctx->mb_frame[ctx->u8_frame_size++] = p_chunk[u32_pos++];
                 ctx->state = MODBUS_WAIT_FUNCTION;
                 break;
 
             case MODBUS_WAIT_FUNCTION:
             {
+                uint8_t byte = p_chunk[u32_pos++];
+                ctx->mb_frame[ctx->u8_frame_size++] = byte;
+                ctx->u16_crc = modbus_crc16_update(ctx->u16_crc, &byte, 1);
                 ctx->u8_function = byte;
-                ctx->state = MODBUS_WAIT_DATA_SIZE;
-                // check for error
-                if(byte&0x80) {
-                    // exception
-                    ctx->u8_frame_expected_size = 7;
+                if( ctx->b_server ) {
+                    if( byte == 0 ) {
+                        // not a function
+                        *b_error = true;
+                        return u32_pos;
+                    }
+                    if( byte <= 0x06 ) {
+                        // read and single write requests : address + function + register + count/value + crc
+                        ctx->u8_frame_expected_size = 8;
+                        ctx->state = MODBUS_WAIT_DATA;
+                    } else {
+                        // other requests are only refused, their length is given by the line idle
+                        ctx->state = MODBUS_WAIT_IDLE;
+                    }
+                } else if(byte&0x80) {
+                    // exception : address + function + exception code + crc
+                    ctx->u8_frame_expected_size = 5;
+                    ctx->state = MODBUS_WAIT_DATA;
+                } else if( (byte == 0x05) || (byte == 0x06) || (byte == 0x0F) || (byte == 0x10) ) {
+                    // write answer : address + function + register + value/count + crc
+                    ctx->u8_frame_expected_size = 8;
+                    ctx->state = MODBUS_WAIT_DATA;
                 } else {
                     // we need to read one more byte
                     ctx->u8_frame_expected_size = 3;
+                    ctx->state = MODBUS_WAIT_DATA_SIZE;
                 }
                 break;
             }
 
             case MODBUS_WAIT_DATA_SIZE:
+            {
+                uint8_t byte = p_chunk[u32_pos++];
+                ctx->mb_frame[ctx->u8_frame_size++] = byte;
+                ctx->u16_crc = modbus_crc16_update(ctx->u16_crc, &byte, 1);
                 // TODO adjust expected size if fc > 10
+                if( byte > (MODBUS_FRAME_SIZE - 6) ) {
+                    // frame too long, not a header
+                    *b_error = true;
+                    return u32_pos;
+                }
                 // header(3) + crc(2)
                 ctx->u8_frame_expected_size = byte + 5;
                 ctx->state = MODBUS_WAIT_DATA;
                 break;
+            }
 
             case MODBUS_WAIT_DATA:
-                // TODO adjust expected size if fc > 10
+            case MODBUS_WAIT_CRC:
+            {
+                // copy as many bytes as available up to the end of frame
+                uint32_t u32_missing = ctx->u8_frame_expected_size - ctx->u8_frame_size;
+                uint32_t u32_copy = u32_len - u32_pos;
+                if( u32_copy > u32_missing ) {
+                    u32_copy = u32_missing;
+                }
+                memcpy(&ctx->mb_frame[ctx->u8_frame_size], &p_chunk[u32_pos], u32_copy);
+                ctx->u16_crc = modbus_crc16_update(ctx->u16_crc, &p_chunk[u32_pos], u32_copy);
+                ctx->u8_frame_size += u32_copy;
+                u32_pos += u32_copy;
+
                 if( ctx->u8_frame_size >= (ctx->u8_frame_expected_size-2)) {
                     ctx->state = MODBUS_WAIT_CRC;
                 }
-                
-                break;
-            
-            case MODBUS_WAIT_CRC:
-            {
                 if( ctx->u8_frame_size >= ctx->u8_frame_expected_size ) {
-                    // compute CRC16
-                    uint16_t crc = modbus_crc16(ctx->mb_frame, ctx->u8_frame_size-2);
-                    if( (ctx->mb_frame[ctx->u8_frame_size-2] == (crc >> 8)) && (ctx->mb_frame[ctx->u8_frame_size-1] == (crc & 0x00ff)) ) {
-                        if(ctx->u8_function&0x80) {
-                            // exception
-                            printf("MB RX Error code=%02X Exception code=%02X\n", ctx->mb_frame[1], ctx->mb_frame[2]);
-                        }
-                        // callback
-                        ctx->rx_cb(ctx->mb_frame, ctx->u8_frame_size);
-                    } else {
-                        printf("modbus bad crc %04X\n", crc);
-                        modbus_print_frame(ctx->mb_frame, ctx->u8_frame_size);
-                        return;
+                    // CRC16 computed over data and received CRC is 0 for a valid frame
+                    if( ctx->u16_crc != 0 ) {
+                        *b_error = true;
+                        return u32_pos;
                     }
-                    ctx->state = MODBUS_WAIT_SOF;
-                    ctx->u8_frame_size = 0;
+                    modbus_rx_frame(ctx);
+                    return u32_pos;
+                }
+                break;
+            }
+
+            case MODBUS_WAIT_IDLE:
+            {
+                // whole chunk, the frame is closed by modbus_rx_loop() at line idle
+                uint32_t u32_copy = u32_len - u32_pos;
+                if( u32_copy > (uint32_t)(MODBUS_FRAME_SIZE - 1 - ctx->u8_frame_size) ) {
+                    // longer than any frame
+                    *b_error = true;
+                    return u32_pos;
                 }
+                memcpy(&ctx->mb_frame[ctx->u8_frame_size], &p_chunk[u32_pos], u32_copy);
+                ctx->u16_crc = modbus_crc16_update(ctx->u16_crc, &p_chunk[u32_pos], u32_copy);
+                ctx->u8_frame_size += u32_copy;
+                u32_pos += u32_copy;
                 break;
             }
         }
     }
+    return u32_pos;
+}
 
-    // 1s timeout
-    if( ctx->state != MODBUS_WAIT_SOF ) {
-        absolute_time_t cur_time = get_absolute_time();
-        int64_t frame_diff_us = absolute_time_diff_us(ctx->sof_time, cur_time);
-        if( frame_diff_us > (1*1000*1000) ) {
-            // cancel frame
-            ctx->state = MODBUS_WAIT_SOF;
-            ctx->u8_frame_size = 0;
-        }
-    }
-}
-
-static const uint8_t table_crc_hi[] = {
-
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-    0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1,
-    0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1,
-    0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1,
-    0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-    0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1,
-    0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40
-};
-
-/* Table of CRC values for low-order byte */
-static const uint8_t table_crc_lo[] = {
-    0x00, 0xC0, 0xC1, 0x01, 0xC3, 0x03, 0x02, 0xC2, 0xC6, 0x06,
-    0x07, 0xC7, 0x05, 0xC5, 0xC4, 0x04, 0xCC, 0x0C, 0x0D, 0xCD,
-    0x0F, 0xCF, 0xCE, 0x0E, 0x0A, 0xCA, 0xCB, 0x0B, 0xC9, 0x09,
-    0x08, 0xC8, 0xD8, 0x18, 0x19, 0xD9, 0x1B, 0xDB, 0xDA, 0x1A,
-    0x1E, 0xDE, 0xDF, 0x1F, 0xDD, 0x1D, 0x1C, 0xDC, 0x14, 0xD4,
-    0xD5, 0x15, 0xD7, 0x17, 0x16, 0xD6, 0xD2, 0x12, 0x13, 0xD3,
-    0x11, 0xD1, 0xD0, 0x10, 0xF0, 0x30, 0x31, 0xF1, 0x33, 0xF3,
-    0xF2, 0x32, 0x36, 0xF6, 0xF7, 0x37, 0xF5, 0x35, 0x34, 0xF4,
-    0x3C, 0xFC, 0xFD, 0x3D, 0xFF, 0x3F, 0x3E, 0xFE, 0xFA, 0x3A,
-    0x3B, 0xFB, 0x39, 0xF9, 0xF8, 0x38, 0x28, 0xE8, 0xE9, 0x29,
-    0xEB, 0x2B, 0x2A, 0xEA, 0xEE, 0x2E, 0x2F, 0xEF, 0x2D, 0xED,
-    0xEC, 0x2C, 0xE4, 0x24, 0x25, 0xE5, 0x27, 0xE7, 0xE6, 0x26,
-    0x22, 0xE2, 0xE3, 0x23, 0xE1, 0x21, 0x20, 0xE0, 0xA0, 0x60,
-    0x61, 0xA1, 0x63, 0xA3, 0xA2, 0x62, 0x66, 0xA6, 0xA7, 0x67,
-    0xA5, 0x65, 0x64, 0xA4, 0x6C, 0xAC, 0xAD, 0x6D, 0xAF, 0x6F,
-    0x6E, 0xAE, 0xAA, 0x6A, 0x6B, 0xAB, 0x69, 0xA9, 0xA8, 0x68,
-    0x78, 0xB8, 0xB9, 0x79, 0xBB, 0x7B, 0x7A, 0xBA, 0xBE, 0x7E,
-    0x7F, 0xBF, 0x7D, 0xBD, 0xBC, 0x7C, 0xB4, 0x74, 0x75, 0xB5,
-    0x77, 0xB7, 0xB6, 0x76, 0x72, 0xB2, 0xB3, 0x73, 0xB1, 0x71,
-    0x70, 0xB0, 0x50, 0x90, 0x91, 0x51, 0x93, 0x53, 0x52, 0x92,
-    0x96, 0x56, 0x57, 0x97, 0x55, 0x95, 0x94, 0x54, 0x9C, 0x5C,
-    0x5D, 0x9D, 0x5F, 0x9F, 0x9E, 0x5E, 0x5A, 0x9A, 0x9B, 0x5B,
-    0x99, 0x59, 0x58, 0x98, 0x88, 0x48, 0x49, 0x89, 0x4B, 0x8B,
-    0x8A, 0x4A, 0x4E, 0x8E, 0x8F, 0x4F, 0x8D, 0x4D, 0x4C, 0x8C,
-    0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42,
-    0x43, 0x83, 0x41, 0x81, 0x80, 0x40
-};
+// core1 : answer of a read from the published image in p_answer, return
+// its length, 0 with the exception code in *p_exception if refused
+static uint32_t modbus_server_read(uint8_t u8_function, uint16_t u16_start, uint16_t u16_count,
+                                   uint8_t* p_answer, uint8_t* p_exception) {
+    uint8_t u8_fc_idx = u8_function - 0x03;
+    uint32_t u32_data_len = 2 * (uint32_t)u16_count;
+    while( true ) {
+        uint32_t u32_seq = u32_image_seq;
+        __dmb();
+        const t_mb_image* p_image = &mb_images[u32_seq & 1];
+        uint16_t u16_nb_reg = p_image->u16_nb_reg;
+        if( u16_nb_reg == 0 ) {
+            // no sample yet
+            *p_exception = MODBUS_EXCEPTION_BUSY;
+            return 0;
+        }
+        if( ((uint32_t)u16_start + u16_count) > u16_nb_reg ) {
+            *p_exception = MODBUS_EXCEPTION_ILLEGAL_ADDRESS;
+            return 0;
+        }
+        p_answer[0] = MODBUS_SERVER_ADDRESS;
+        p_answer[1] = u8_function;
+        p_answer[2] = (uint8_t)u32_data_len;
+        memcpy(&p_answer[3], &p_image->regs[2 * u16_start], u32_data_len);
+        uint16_t u16_crc;
+        if( u16_count == u16_nb_reg ) {
+            u16_crc = p_image->u16_full_crc[u8_fc_idx];
+        } else {
+            u16_crc = modbus_crc16_update(mb_server_header_crc[u8_fc_idx][u16_count], &p_answer[3], u32_data_len);
+        }
+        // image not rebuilt during the copy, core0 only writes the image
+        // that is not published, after a new sequence
+        __dmb();
+        if( u32_image_seq == u32_seq ) {
+            p_answer[3 + u32_data_len] = (uint8_t)u16_crc;
+            p_answer[4 + u32_data_len] = (uint8_t)(u16_crc >> 8);
+            return 5 + u32_data_len;
+        }
+        server_stats.u32_image_retry++;
+    }
+}
 
+// core1 : write the answer by FIFO loads, never waits
+static void modbus_server_tx(void) {
+    while( (u32_server_tx_pos < u32_server_tx_len) && uart_is_writable(MODBUS_SERVER_UART) ) {
+        uart_putc_raw(MODBUS_SERVER_UART, mb_server_tx[u32_server_tx_pos++]);
+    }
+}
 
+static void modbus_server_rx_cb(uint8_t* pbuf, uint8_t size) {
+    // requests for other servers and broadcasts are not answered
+    if( pbuf[0] != MODBUS_SERVER_ADDRESS ) {
+        server_stats.u32_other++;
+        return;
+    }
+    server_stats.u32_request++;
+    // master didn't wait for the previous answer
+    if( u32_server_tx_pos != u32_server_tx_len ) {
+        return;
+    }
+    uint8_t u8_function = pbuf[1];
+    uint16_t u16_start = ((uint16_t)pbuf[2] << 8) | pbuf[3];
+    uint16_t u16_count = ((uint16_t)pbuf[4] << 8) | pbuf[5];
+    uint8_t u8_exception = 0;
+    uint32_t u32_len = 0;
+    if( (u8_function != 0x03) && (u8_function != 0x04) ) {
+        u8_exception = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+    } else if( (u16_count == 0) || (u16_count > MODBUS_SERVER_MAX_REG) ) {
+        u8_exception = MODBUS_EXCEPTION_ILLEGAL_VALUE;
+    } else {
+        u32_len = modbus_server_read(u8_function, u16_start, u16_count, mb_server_tx, &u8_exception);
+    }
+    if( u32_len == 0 ) {
+        server_stats.u32_exception++;
+        mb_server_tx[0] = MODBUS_SERVER_ADDRESS;
+        mb_server_tx[1] = u8_function | 0x80;
+        mb_server_tx[2] = u8_exception;
+        uint16_t u16_crc = modbus_crc16_update(MODBUS_CRC_INIT, mb_server_tx, 3);
+        mb_server_tx[3] = (uint8_t)u16_crc;
+        mb_server_tx[4] = (uint8_t)(u16_crc >> 8);
+        u32_len = 5;
+    }
+    // the last byte of a request (8 bytes) fills the RX FIFO level, so the IRQ
+    // comes with it and not after the RX timeout. Requests of unknown length
+    // are only answered after the line idle time, they are left out.
+    if( mb_ctx_server.state != MODBUS_WAIT_IDLE ) {
+        uint32_t u32_turnaround_us = time_us_32() - mb_ctx_server.u32_rx_time_us;
+        server_stats.u32_turnaround_us = u32_turnaround_us;
+        if( u32_turnaround_us > server_stats.u32_turnaround_max_us ) {
+            server_stats.u32_turnaround_max_us = u32_turnaround_us;
+        }
+    }
+    u32_server_tx_len = u32_len;
+    u32_server_tx_pos = 0;
+    modbus_server_tx();
+}
 
+// core1, IRQ is registered on the calling core
+void modbus_server_init(void) {
+    for(uint8_t f=0; f<2; f++) {
+        for(uint32_t n=0; n<=MODBUS_SERVER_MAX_REG; n++) {
+            uint8_t header[3] = { MODBUS_SERVER_ADDRESS, (uint8_t)(0x03 + f), (uint8_t)(2 * n) };
+            mb_server_header_crc[f][n] = modbus_crc16_update(MODBUS_CRC_INIT, header, sizeof(header));
+        }
+    }
+    memset(&server_stats, 0, sizeof(server_stats));
+    server_stats.u32_t35_us = (35 * 1000000) / MODBUS_SERVER_BAUDRATE;
+    modbus_ctx_init(&mb_ctx_server, MODBUS_SERVER_UART, MODBUS_SERVER_BAUDRATE, modbus_server_rx_cb);
+    mb_ctx_server.b_server = true;
+}
 
-uint16_t modbus_crc16(uint8_t *buffer, uint16_t buffer_length)
-{
-    uint8_t crc_hi = 0xFF; /* high CRC byte initialized */
-    uint8_t crc_lo = 0xFF; /* low CRC byte initialized */
-    unsigned int i; /* will index into CRC lookup */
+void modbus_server_loop(void) {
+    modbus_server_tx();
+    modbus_rx_loop(&mb_ctx_server);
 
-    /* pass through message buffer */
-    while (buffer_length--) {
-        i = crc_hi ^ *buffer++; /* calculate the CRC  */
-        crc_hi = crc_lo ^ table_crc_hi[i];
-        crc_lo = table_crc_lo[i];
+    // one character is 10 bits, woken when half of the FIFO is sent
+    uint32_t u32_char_us = (10 * 1000000) / MODBUS_SERVER_BAUDRATE;
+    if( u32_server_tx_pos != u32_server_tx_len ) {
+        sched_wake_in_us(SCHED_TASK_MODBUS_SERVER, u32_char_us * MODBUS_SERVER_TX_FIFO / 2);
     }
+    if( mb_ctx_server.state != MODBUS_WAIT_SOF ) {
+        // frame cut by line idle
+        int32_t i32_idle_us = (int32_t)(mb_ctx_server.u32_rx_time_us + mb_ctx_server.u32_idle_us - time_us_32()) + 1;
+        sched_wake_in_us(SCHED_TASK_MODBUS_SERVER, (i32_idle_us < 0) ? 0 : (uint32_t)i32_idle_us);
+    }
+}
 
-    return (crc_hi << 8 | crc_lo);
+// core0 : new register image, u16_nb_reg registers big endian in p_regs
+void modbus_server_publish(const uint8_t* p_regs, uint16_t u16_nb_reg) {
+    if( u16_nb_reg > MODBUS_SERVER_MAX_REG ) {
+        u16_nb_reg = MODBUS_SERVER_MAX_REG;
+    }
+    uint32_t u32_seq = u32_image_seq;
+    t_mb_image* p_image = &mb_images[(u32_seq + 1) & 1];
+    uint32_t u32_data_len = 2 * (uint32_t)u16_nb_reg;
+    memcpy(p_image->regs, p_regs, u32_data_len);
+    p_image->u16_nb_reg = u16_nb_reg;
+    for(uint8_t f=0; f<2; f++) {
+        uint8_t header[3] = { MODBUS_SERVER_ADDRESS, (uint8_t)(0x03 + f), (uint8_t)u32_data_len };
+        uint16_t u16_crc = modbus_crc16_update(MODBUS_CRC_INIT, header, sizeof(header));
+        p_image->u16_full_crc[f] = modbus_crc16_update(u16_crc, p_image->regs, u32_data_len);
+    }
+    // image before sequence
+    __dmb();
+    u32_image_seq = u32_seq + 1;
 }
 
-uint32_t bytes_to_uint32(uint8_t* pbuf) {
-    return (((uint32_t)pbuf[0])<<24) + (((uint32_t)pbuf[1])<<16)  + (((uint32_t)pbuf[2])<<8) + pbuf[3];
-}
\ No newline at end of file
+// core0
+void modbus_server_get_stats(t_mb_server_stats* p_stats) {
+    *p_stats = server_stats;
+    p_stats->u32_crc_error = mb_ctx_server.u32_rx_crc_error;
+    p_stats->u32_image = u32_image_seq;
+}
@@ -1,9 +1,25 @@
 #ifndef MODBUS_H__
 #define MODBUS_H__
 #include "pico/stdlib.h"
+#include "latency.h"
 
 
 #define MODBUS_CLIENT_UART uart0
+// meter speed at power up
+#define MODBUS_CLIENT_DEFAULT_BAUDRATE 4800
+// speed negotiated with the meter at startup, 0 keeps MODBUS_CLIENT_DEFAULT_BAUDRATE
+#ifndef MODBUS_CLIENT_STARTUP_BAUDRATE
+#define MODBUS_CLIENT_STARTUP_BAUDRATE 0
+#endif
+// meters on the RS-485 bus : main, pv, heater
+#define MODBUS_CLIENT_NB_SLAVE 3
+
+// server on a second bus, for a PLC or home automation
+#define MODBUS_SERVER_UART uart1
+#define MODBUS_SERVER_BAUDRATE 9600
+#define MODBUS_SERVER_ADDRESS 0x01
+// largest read of FC 0x03 / 0x04
+#define MODBUS_SERVER_MAX_REG 125
 
 
 typedef struct
@@ -16,17 +32,97 @@ typedef struct
 typedef struct
 {
     absolute_time_t time;
+    uint32_t u32_stage_us[LATENCY_NB_STAGE]; // time_us_32() at each stage, 0 if not reached
     uint32_t u32_index;
     uint32_t tension_mv;
     uint32_t frequence_mhz;
     t_channel_data voie[2];
     
 }t_power_data;
+typedef void (*t_power_data_cb)(uint8_t u8_slave, const t_power_data* p_data);
+
+typedef struct
+{
+    uint32_t u32_request;
+    uint32_t u32_response;
+    uint32_t u32_miss;      // no answer before timeout
+    uint32_t u32_exception;
+    uint32_t u32_drop;      // samples lost, queue full
+    uint32_t u32_latency_us; // request to answer, last sample
+    uint32_t u32_latency_min_us;
+    uint32_t u32_latency_max_us;
+    uint64_t u64_latency_sum_us;
+}t_mb_slave_stats;
+typedef struct
+{
+    uint8_t u8_address;
+    uint8_t u8_priority;
+    const char* p_name;
+    bool b_enabled;
+    uint32_t u32_period_us;
+    bool b_found;           // answered the model read at init
+    uint16_t u16_model;
+    t_mb_slave_stats stats;
+}t_mb_slave_info;
+
+enum mb_baud_result {
+    MODBUS_BAUD_NONE = 0,
+    MODBUS_BAUD_PENDING,     // requested or negotiating
+    MODBUS_BAUD_OK,          // every meter answers at the new speed
+    MODBUS_BAUD_FAILED,      // a meter didn't switch, old speed kept
+    MODBUS_BAUD_UNSUPPORTED, // not a meter speed
+};
+typedef struct
+{
+    enum mb_baud_result result;
+    uint32_t u32_baud;       // speed of the last change
+    uint8_t u8_nb_ok;        // meters answering at this speed
+    uint8_t u8_nb_enabled;
+    uint32_t u32_stranded_mask; // meters maybe left at the new speed, bit per slave index
+    uint32_t u32_fallback;   // next speed tried, meters stopped answering
+}t_mb_baud_status;
+
+typedef struct
+{
+    uint32_t u32_request;    // valid frames for this server
+    uint32_t u32_other;      // valid frames for other addresses
+    uint32_t u32_exception;  // answered by an exception
+    uint32_t u32_crc_error;  // bad CRC or header
+    uint32_t u32_image;      // images published
+    uint32_t u32_image_retry; // answers copied again, image swapped during the copy
+    uint32_t u32_turnaround_us; // end of request to first answer byte, last request
+    uint32_t u32_turnaround_max_us;
+    uint32_t u32_t35_us;     // 3.5 characters
+}t_mb_server_stats;
 
 void modbus_client_init(void);
 void modbus_client_loop(void);
+void modbus_client_set_sample_cb(t_power_data_cb sample_cb);
+void modbus_client_set_period_us(uint32_t u32_period_us);
+uint32_t modbus_client_get_period_us(void);
+uint32_t modbus_client_get_min_period_us(void);
+void modbus_client_request_baudrate(uint32_t u32_baud);
+uint32_t modbus_client_get_baudrate(void);
+void modbus_client_get_baud_status(t_mb_baud_status* p_status);
+uint32_t modbus_client_get_sps_x100(void);
+uint32_t modbus_client_idle_us(void);
+void modbus_slave_set_period_us(uint8_t u8_slave, uint32_t u32_period_us);
+void modbus_slave_enable(uint8_t u8_slave, bool b_enabled);
+void modbus_slave_get_info(uint8_t u8_slave, t_mb_slave_info* p_info);
 
 
 t_power_data* modbus_get_power_data(void);
+t_power_data* modbus_get_slave_power_data(uint8_t u8_slave);
+bool modbus_pop_power_data(t_power_data* p_data);
+bool modbus_pop_slave_power_data(uint8_t u8_slave, t_power_data* p_data);
+void modbus_sync_power_data(t_power_data_cb sample_cb);
+uint32_t modbus_get_power_data_drop(void);
+uint32_t modbus_get_rx_overrun(void);
+void modbus_get_rx_errors(uint32_t* p_crc_error, uint32_t* p_truncated, uint32_t* p_skipped);
+
+void modbus_server_init(void);
+void modbus_server_loop(void);
+void modbus_server_publish(const uint8_t* p_regs, uint16_t u16_nb_reg);
+void modbus_server_get_stats(t_mb_server_stats* p_stats);
 
 #endif // MODBUS_H__
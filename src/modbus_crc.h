@@ -0,0 +1,33 @@
+#ifndef MODBUS_CRC_H__
+#define MODBUS_CRC_H__
+#include <stdint.h>
+
+// CRC kernel used by modbus_crc16_update(), select with MODBUS_CRC_KERNEL at build time
+#define MODBUS_CRC_KERNEL_TABLE8    0   // one byte per step, two 256 bytes tables in flash
+#define MODBUS_CRC_KERNEL_SLICE4    1   // four bytes per step, four 256 entries tables in RAM
+
+#ifndef MODBUS_CRC_KERNEL
+#define MODBUS_CRC_KERNEL MODBUS_CRC_KERNEL_SLICE4
+#endif
+
+#define MODBUS_CRC_INIT 0xFFFF
+
+// compile time CRC for constant frames, to chain through enum constants
+// so each step expands its input only 256 times
+#define MODBUS_CRC_CONST_BIT(crc) (((crc) >> 1) ^ (0xA001 & (0 - ((crc) & 1))))
+#define MODBUS_CRC_CONST_BYTE(crc, byte) \
+    MODBUS_CRC_CONST_BIT(MODBUS_CRC_CONST_BIT(MODBUS_CRC_CONST_BIT(MODBUS_CRC_CONST_BIT( \
+    MODBUS_CRC_CONST_BIT(MODBUS_CRC_CONST_BIT(MODBUS_CRC_CONST_BIT(MODBUS_CRC_CONST_BIT((crc) ^ (byte)))))))))
+
+void modbus_crc_init(void);
+uint16_t modbus_crc16_update_table8(uint16_t crc, const uint8_t *buffer, uint32_t buffer_length);
+uint16_t modbus_crc16_update_slice4(uint16_t crc, const uint8_t *buffer, uint32_t buffer_length);
+uint16_t modbus_crc16(uint8_t *buffer, uint16_t buffer_length);
+
+#if MODBUS_CRC_KERNEL == MODBUS_CRC_KERNEL_TABLE8
+#define modbus_crc16_update modbus_crc16_update_table8
+#else
+#define modbus_crc16_update modbus_crc16_update_slice4
+#endif
+
+#endif // MODBUS_CRC_H__
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "profiler.h"
+
+/*
+Profiler of the scheduler loops of both cores, always on.
+
+Each loop iteration starts with profiler_loop() and each task run is closed
+by profiler_task(), given the start time returned by the previous call :
+the end of a task is the start of the next one, one timer read per task.
+time_us_32() is a single register read, so the cost is a few hundred
+cycles per loop. The Cortex-M0+ has no cycle counter, durations are in us.
+Time spent sleeping in the scheduler gives the load of each core.
+
+Every stat is written by the core running the task and read by the
+console without lock. Reset is only requested by the console and done by
+each core at the start of its next iteration.
+*/
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+#define PROFILER_RATE_PERIOD_US (1000 * 1000)
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static t_profiler_task_stats profiler_tasks[SCHED_NB_TASK];
+static t_profiler_loop_stats profiler_loops[SCHED_NB_CORE];
+// first iteration of each core clears its stats
+static volatile bool profiler_reset_request[SCHED_NB_CORE] = { true, true };
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+// core of the loop
+static void profiler_clear(enum sched_core core) {
+    memset(&profiler_loops[core], 0, sizeof(profiler_loops[core]));
+    profiler_loops[core].u64_reset_us = time_us_64();
+    for(uint32_t t=0; t<SCHED_NB_TASK; t++) {
+        if( sched_task_core((enum sched_task)t) == core ) {
+            memset(&profiler_tasks[t], 0, sizeof(profiler_tasks[t]));
+            profiler_tasks[t].u32_min_us = UINT32_MAX;
+        }
+    }
+}
+
+// core of the loop : start of an iteration, return the start of its first task
+uint32_t profiler_loop(enum sched_core core) {
+    uint32_t u32_now_us = time_us_32();
+    t_profiler_loop_stats* p_loop = &profiler_loops[core];
+    if( profiler_reset_request[core] ) {
+        profiler_reset_request[core] = false;
+        profiler_clear(core);
+    }
+    if( p_loop->u32_count == 0 ) {
+        p_loop->u32_rate_start_us = u32_now_us;
+    } else {
+        uint32_t u32_us = u32_now_us - p_loop->u32_start_us - p_loop->u32_sleep_us;
+        if( u32_us > p_loop->u32_max_us ) {
+            p_loop->u32_max_us = u32_us;
+        }
+    }
+    p_loop->u32_start_us = u32_now_us;
+    p_loop->u32_sleep_us = 0;
+    p_loop->u32_count++;
+    p_loop->u32_rate_count++;
+
+    uint32_t u32_rate_us = u32_now_us - p_loop->u32_rate_start_us;
+    if( u32_rate_us >= PROFILER_RATE_PERIOD_US ) {
+        p_loop->u32_rate_x100 = (uint32_t)(((uint64_t)p_loop->u32_rate_count * 100 * 1000000) / u32_rate_us);
+        p_loop->u32_rate_count = 0;
+        p_loop->u32_rate_start_us = u32_now_us;
+    }
+    return u32_now_us;
+}
+
+// core of the task : end of a task started at u32_start_us, return the start of the next one
+uint32_t profiler_task(enum sched_task task, uint32_t u32_start_us) {
+    uint32_t u32_now_us = time_us_32();
+    uint32_t u32_us = u32_now_us - u32_start_us;
+    t_profiler_task_stats* p_task = &profiler_tasks[task];
+    if( p_task->u32_count > 0 ) {
+        uint32_t u32_gap_us = u32_start_us - p_task->u32_start_us;
+        if( u32_gap_us > p_task->u32_max_gap_us ) {
+            p_task->u32_max_gap_us = u32_gap_us;
+        }
+    }
+    p_task->u32_start_us = u32_start_us;
+    p_task->u32_count++;
+    p_task->u64_sum_us += u32_us;
+    if( u32_us < p_task->u32_min_us ) {
+        p_task->u32_min_us = u32_us;
+    }
+    if( u32_us > p_task->u32_max_us ) {
+        p_task->u32_max_us = u32_us;
+    }
+    return u32_now_us;
+}
+
+// core of the loop : end of a sleep started at u32_start_us
+void profiler_sleep(enum sched_core core, uint32_t u32_start_us) {
+    t_profiler_loop_stats* p_loop = &profiler_loops[core];
+    uint32_t u32_us = time_us_32() - u32_start_us;
+    p_loop->u32_sleep_us += u32_us;
+    p_loop->u64_sleep_us += u32_us;
+}
+
+// core0 : copies may mix two iterations
+void profiler_print(void) {
+    for(uint32_t c=0; c<SCHED_NB_CORE; c++) {
+        t_profiler_loop_stats loop = profiler_loops[c];
+        uint64_t u64_elapsed_us = time_us_64() - loop.u64_reset_us;
+        uint32_t u32_load_x10 = (u64_elapsed_us > 0) ? (uint32_t)(1000 - (loop.u64_sleep_us * 1000) / u64_elapsed_us) : 0;
+        printf("core%u loops %u, %u.%02u loops/s, longest %u us, load %u.%u%%\n",
+                c, loop.u32_count, loop.u32_rate_x100 / 100, loop.u32_rate_x100 % 100, loop.u32_max_us,
+                u32_load_x10 / 10, u32_load_x10 % 10);
+        for(uint32_t t=0; t<SCHED_NB_TASK; t++) {
+            if( sched_task_core((enum sched_task)t) != c ) {
+                continue;
+            }
+            t_profiler_task_stats task = profiler_tasks[t];
+            uint32_t u32_avg_us = (task.u32_count > 0) ? (uint32_t)(task.u64_sum_us / task.u32_count) : 0;
+            uint32_t u32_min_us = (task.u32_count > 0) ? task.u32_min_us : 0;
+            printf("  %-9s calls %u time %u/%u/%u us total %llu ms, longest gap %u us\n",
+                    sched_task_name((enum sched_task)t), task.u32_count, u32_min_us, u32_avg_us, task.u32_max_us,
+                    (unsigned long long)(task.u64_sum_us / 1000), task.u32_max_gap_us);
+        }
+    }
+}
+
+// core0 : each core clears its stats at its next iteration
+void profiler_reset(void) {
+    for(uint32_t c=0; c<SCHED_NB_CORE; c++) {
+        profiler_reset_request[c] = true;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef PROFILER_H__
+#define PROFILER_H__
+#include "pico/stdlib.h"
+#include "scheduler.h"
+
+typedef struct
+{
+    uint32_t u32_count;
+    uint32_t u32_min_us;
+    uint32_t u32_max_us;
+    uint64_t u64_sum_us;
+    uint32_t u32_max_gap_us; // longest time between two starts
+    uint32_t u32_start_us;   // last start
+}t_profiler_task_stats;
+
+typedef struct
+{
+    uint32_t u32_count;      // iterations
+    uint32_t u32_max_us;     // longest iteration, sleep excluded
+    uint32_t u32_rate_x100;  // iterations per second over the last second
+    uint32_t u32_start_us;   // last iteration start
+    uint32_t u32_sleep_us;   // sleep of the last iteration
+    uint64_t u64_sleep_us;
+    uint64_t u64_reset_us;
+    uint32_t u32_rate_start_us;
+    uint32_t u32_rate_count;
+}t_profiler_loop_stats;
+
+uint32_t profiler_loop(enum sched_core core);
+uint32_t profiler_task(enum sched_task task, uint32_t u32_start_us);
+void profiler_sleep(enum sched_core core, uint32_t u32_start_us);
+void profiler_print(void);
+void profiler_reset(void);
+
+#endif // PROFILER_H__
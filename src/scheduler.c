@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/timer.h"
+#include "hardware/sync.h"
+#include "profiler.h"
+#include "scheduler.h"
+
+/*
+Run to completion scheduler, one per core.
+
+A task runs when it has been posted (IRQ, other core or other task) or
+when its timer is due, then its event and timer are cleared : a task that
+needs to run again later gives its next deadline at each run with
+sched_wake_in_us(). Ready tasks run in enum order.
+
+With nothing ready the core sleeps in __wfe() until an interrupt or a
+__sev() from sched_post(). The earliest timer is programmed in a hardware
+alarm whose IRQ is on the same core, so a timer wakes its core within the
+IRQ latency whatever the other core does.
+
+Events are one bool per task : set by anyone, cleared by the owner core
+before running the task, so a post during the run is not lost.
+*/
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+// hardware alarm of each core, the default alarm pool uses alarm 3
+#define SCHED_ALARM_CORE0 0
+#define SCHED_ALARM_CORE1 1
+
+/*****************************************************************************/
+/*            PRIVATE TYPE                                                   */
+/*****************************************************************************/
+typedef struct
+{
+    const char* p_name;
+    enum sched_core core;
+    t_sched_task_fn fn;
+    volatile bool b_event; // set by any core or IRQ
+    bool b_timer;          // owner core
+    uint32_t u32_wake_us;
+}t_sched_task;
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static t_sched_task sched_tasks[SCHED_NB_TASK] = {
+    [SCHED_TASK_BLINK]     = { .p_name = "blink",     .core = SCHED_CORE0 },
+    [SCHED_TASK_SYNC]      = { .p_name = "sync",      .core = SCHED_CORE0 },
+    [SCHED_TASK_FLASH_LOG] = { .p_name = "flash log", .core = SCHED_CORE0 },
+    [SCHED_TASK_DATA]      = { .p_name = "data",      .core = SCHED_CORE0 },
+    [SCHED_TASK_DISPLAY]   = { .p_name = "display",   .core = SCHED_CORE0 },
+    [SCHED_TASK_CONSOLE]   = { .p_name = "console",   .core = SCHED_CORE0 },
+    [SCHED_TASK_MODBUS]    = { .p_name = "modbus",    .core = SCHED_CORE1 },
+    [SCHED_TASK_MODBUS_SERVER] = { .p_name = "mb server", .core = SCHED_CORE1 },
+    [SCHED_TASK_DIVERTER]  = { .p_name = "diverter",  .core = SCHED_CORE1 },
+    [SCHED_TASK_TRIAC]     = { .p_name = "triac",     .core = SCHED_CORE1 },
+};
+static const uint32_t sched_alarms[SCHED_NB_CORE] = { SCHED_ALARM_CORE0, SCHED_ALARM_CORE1 };
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+// alarm IRQ : taking it sets the event register of this core, the other
+// one is not woken
+static void sched_alarm_cb(uint alarm_num) {
+}
+
+// before sched_run() of the task core
+void sched_add(enum sched_task task, t_sched_task_fn fn) {
+    sched_tasks[task].fn = fn;
+}
+
+// any core or IRQ
+void sched_post(enum sched_task task) {
+    sched_tasks[task].b_event = true;
+    __sev();
+}
+
+// task core : run the task again within u32_delay_us, the earliest request wins
+void sched_wake_in_us(enum sched_task task, uint32_t u32_delay_us) {
+    t_sched_task* p_task = &sched_tasks[task];
+    uint32_t u32_wake_us = time_us_32() + u32_delay_us;
+    if( !p_task->b_timer || ((int32_t)(u32_wake_us - p_task->u32_wake_us) < 0) ) {
+        p_task->u32_wake_us = u32_wake_us;
+        p_task->b_timer = true;
+    }
+}
+
+const char* sched_task_name(enum sched_task task) {
+    return sched_tasks[task].p_name;
+}
+
+enum sched_core sched_task_core(enum sched_task task) {
+    return sched_tasks[task].core;
+}
+
+// runs the tasks of the calling core, never returns
+void sched_run(enum sched_core core) {
+    uint32_t u32_alarm = sched_alarms[core];
+    hardware_alarm_claim(u32_alarm);
+    // alarm IRQ on this core
+    hardware_alarm_set_callback(u32_alarm, sched_alarm_cb);
+
+    // every task runs once at start and gives its deadline
+    for(uint32_t t=0; t<SCHED_NB_TASK; t++) {
+        if( (sched_tasks[t].core == core) && (sched_tasks[t].fn != NULL) ) {
+            sched_tasks[t].b_event = true;
+        }
+    }
+
+    while (true) {
+        uint32_t u32_task_us = profiler_loop(core);
+        for(uint32_t t=0; t<SCHED_NB_TASK; t++) {
+            t_sched_task* p_task = &sched_tasks[t];
+            if( (p_task->core != core) || (p_task->fn == NULL) ) {
+                continue;
+            }
+            if( p_task->b_event || (p_task->b_timer && ((int32_t)(u32_task_us - p_task->u32_wake_us) >= 0)) ) {
+                p_task->b_event = false;
+                p_task->b_timer = false;
+                p_task->fn();
+                u32_task_us = profiler_task((enum sched_task)t, u32_task_us);
+            }
+        }
+
+        // sleep unless a task is ready, up to the earliest timer
+        bool b_ready = false;
+        int32_t i32_sleep_us = INT32_MAX;
+        uint32_t u32_now_us = time_us_32();
+        for(uint32_t t=0; t<SCHED_NB_TASK; t++) {
+            t_sched_task* p_task = &sched_tasks[t];
+            if( (p_task->core != core) || (p_task->fn == NULL) ) {
+                continue;
+            }
+            if( p_task->b_event ) {
+                b_ready = true;
+            } else if( p_task->b_timer ) {
+                int32_t i32_us = (int32_t)(p_task->u32_wake_us - u32_now_us);
+                if( i32_us < i32_sleep_us ) {
+                    i32_sleep_us = i32_us;
+                }
+            }
+        }
+        if( b_ready || (i32_sleep_us <= 0) ) {
+            continue;
+        }
+        if( i32_sleep_us != INT32_MAX ) {
+            // true when already past
+            if( hardware_alarm_set_target(u32_alarm, from_us_since_boot(time_us_64() + i32_sleep_us)) ) {
+                continue;
+            }
+        }
+        __wfe();
+        profiler_sleep(core, u32_now_us);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef SCHEDULER_H__
+#define SCHEDULER_H__
+#include "pico/stdlib.h"
+
+enum sched_core {
+    SCHED_CORE0=0,
+    SCHED_CORE1,
+    SCHED_NB_CORE
+};
+
+// tasks in run order, each one belongs to one core
+enum sched_task {
+    SCHED_TASK_BLINK=0,   // core0
+    SCHED_TASK_SYNC,
+    SCHED_TASK_FLASH_LOG,
+    SCHED_TASK_DATA,
+    SCHED_TASK_DISPLAY,
+    SCHED_TASK_CONSOLE,
+    SCHED_TASK_MODBUS,    // core1
+    SCHED_TASK_MODBUS_SERVER,
+    SCHED_TASK_DIVERTER,
+    SCHED_TASK_TRIAC,
+    SCHED_NB_TASK
+};
+
+typedef void (*t_sched_task_fn)(void);
+
+void sched_add(enum sched_task task, t_sched_task_fn fn);
+void sched_run(enum sched_core core);
+void sched_post(enum sched_task task);
+void sched_wake_in_us(enum sched_task task, uint32_t u32_delay_us);
+const char* sched_task_name(enum sched_task task);
+enum sched_core sched_task_core(enum sched_task task);
+
+#endif // SCHEDULER_H__
@@ -0,0 +1,324 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "ssd1306_font.h"
+#include "gfx.h"
+
+/*
+Drawing in a frame in the SSD1306 layout.
+
+Everything goes through gfx_write_column() : up to 24 pixels of a column
+are shifted by y % 8 into a 32 bit word and merged with a mask in the 2 to
+4 pages they cover, so glyphs and bitmaps are drawn at any y without
+per pixel work. Only bytes that change mark the frame dirty, the flush
+sends nothing for a redrawn identical text.
+
+Fonts :
+- gfx_font_8x8, the 8x8 font of the pico example, fixed width
+- gfx_font_prop, the same glyphs trimmed of their blank columns, with
+  fixed width digits so numbers don't move when they change
+- gfx_font_digits_16x24, codes ' ' to '?' of the 8x8 font scaled x2 x3,
+  for the power reading
+The last two are built from the 8x8 one by gfx_init().
+*/
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+#define GFX_FONT_FIRST ' '
+#define GFX_FONT_NB_GLYPH (sizeof(font) / 8)
+#define GFX_PROP_BLANK_WIDTH 3
+#define GFX_DIGITS_LAST '?'
+#define GFX_DIGITS_NB_GLYPH (GFX_DIGITS_LAST - GFX_FONT_FIRST + 1)
+#define GFX_DIGITS_WIDTH 16
+#define GFX_DIGITS_HEIGHT 24
+// bytes of a glyph column
+#define GFX_COLUMN_LEN(h) (((h) + 7) / 8)
+
+_Static_assert(GFX_FONT_NB_GLYPH <= 255, "glyph count fits the font descriptor");
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+static uint16_t prop_offsets[GFX_FONT_NB_GLYPH];
+static uint8_t prop_widths[GFX_FONT_NB_GLYPH];
+static uint8_t digits_columns[GFX_DIGITS_NB_GLYPH * GFX_DIGITS_WIDTH * GFX_COLUMN_LEN(GFX_DIGITS_HEIGHT)];
+
+const t_gfx_font gfx_font_8x8 = {
+    .p_columns = font,
+    .u8_width = 8,
+    .u8_height = 8,
+    .u8_first = GFX_FONT_FIRST,
+    .u8_nb_glyph = GFX_FONT_NB_GLYPH,
+};
+
+const t_gfx_font gfx_font_prop = {
+    .p_columns = font,
+    .p_offsets = prop_offsets,
+    .p_widths = prop_widths,
+    .u8_height = 8,
+    .u8_first = GFX_FONT_FIRST,
+    .u8_nb_glyph = GFX_FONT_NB_GLYPH,
+    .u8_spacing = 1,
+};
+
+const t_gfx_font gfx_font_digits_16x24 = {
+    .p_columns = digits_columns,
+    .u8_width = GFX_DIGITS_WIDTH,
+    .u8_height = GFX_DIGITS_HEIGHT,
+    .u8_first = GFX_FONT_FIRST,
+    .u8_nb_glyph = GFX_DIGITS_NB_GLYPH,
+};
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+// 8 pixels column to 24, each pixel 3 times
+static uint32_t gfx_scale3(uint8_t u8_column) {
+    uint32_t u32_column = 0;
+    for(int i=0; i<8; i++) {
+        if( u8_column & (1u << i) ) {
+            u32_column |= 7u << (3*i);
+        }
+    }
+    return u32_column;
+}
+
+void gfx_init(void) {
+    // proportional : glyph columns from the first to the last not blank one
+    int digits_first = 8;
+    int digits_last = -1;
+    for(uint32_t g=0; g<GFX_FONT_NB_GLYPH; g++) {
+        int first = 8;
+        int last = -1;
+        for(int c=0; c<8; c++) {
+            if( font[g*8 + c] != 0 ) {
+                first = (c < first) ? c : first;
+                last = c;
+            }
+        }
+        if( last < 0 ) {
+            first = 0;
+            last = GFX_PROP_BLANK_WIDTH - 1;
+        }
+        if( (g >= '0' - GFX_FONT_FIRST) && (g <= '9' - GFX_FONT_FIRST) ) {
+            digits_first = (first < digits_first) ? first : digits_first;
+            digits_last = (last > digits_last) ? last : digits_last;
+        }
+        prop_offsets[g] = (uint16_t)(g*8 + first);
+        prop_widths[g] = (uint8_t)(last - first + 1);
+    }
+    for(uint32_t g='0' - GFX_FONT_FIRST; g<='9' - GFX_FONT_FIRST; g++) {
+        prop_offsets[g] = (uint16_t)(g*8 + digits_first);
+        prop_widths[g] = (uint8_t)(digits_last - digits_first + 1);
+    }
+
+    // 16x24 : every column of the 8x8 glyph twice, every pixel 3 times
+    uint8_t* p = digits_columns;
+    for(uint32_t g=0; g<GFX_DIGITS_NB_GLYPH; g++) {
+        for(int c=0; c<GFX_DIGITS_WIDTH; c++) {
+            uint32_t u32_column = gfx_scale3(font[g*8 + c/2]);
+            *p++ = (uint8_t)u32_column;
+            *p++ = (uint8_t)(u32_column >> 8);
+            *p++ = (uint8_t)(u32_column >> 16);
+        }
+    }
+}
+
+void gfx_clear_dirty(t_gfx_frame* p_frame) {
+    memset(p_frame->dirty_start_col, 0xFF, sizeof(p_frame->dirty_start_col));
+    memset(p_frame->dirty_end_col, 0, sizeof(p_frame->dirty_end_col));
+}
+
+void gfx_mark_all_dirty(t_gfx_frame* p_frame) {
+    memset(p_frame->dirty_start_col, 0, sizeof(p_frame->dirty_start_col));
+    memset(p_frame->dirty_end_col, SSD1306_WIDTH - 1, sizeof(p_frame->dirty_end_col));
+}
+
+static inline void gfx_mark_dirty(t_gfx_frame* p_frame, int page, int col) {
+    if( col < p_frame->dirty_start_col[page] ) {
+        p_frame->dirty_start_col[page] = (uint8_t)col;
+    }
+    if( col > p_frame->dirty_end_col[page] ) {
+        p_frame->dirty_end_col[page] = (uint8_t)col;
+    }
+}
+
+// h pixels of u32_bits (bit 0 on top) at (x, y), h up to GFX_MAX_FONT_HEIGHT, clipped to the screen
+static void gfx_write_column(t_gfx_frame* p_frame, int x, int y, uint32_t u32_bits, int h) {
+    if( (x < 0) || (x >= SSD1306_WIDTH) ) {
+        return;
+    }
+    if( y < 0 ) {
+        if( -y >= h ) {
+            return;
+        }
+        u32_bits >>= -y;
+        h += y;
+        y = 0;
+    }
+    if( y + h > SSD1306_HEIGHT ) {
+        h = SSD1306_HEIGHT - y;
+    }
+    if( h <= 0 ) {
+        return;
+    }
+    uint32_t u32_shift = (uint32_t)y & 7;
+    uint32_t u32_mask = ((1u << h) - 1) << u32_shift;
+    u32_bits = (u32_bits << u32_shift) & u32_mask;
+
+    int page = y >> 3;
+    uint8_t* p_byte = &p_frame->buf[page * SSD1306_WIDTH + x];
+    while( u32_mask != 0 ) {
+        uint8_t u8_old = *p_byte;
+        uint8_t u8_new = (u8_old & ~(uint8_t)u32_mask) | (uint8_t)u32_bits;
+        if( u8_new != u8_old ) {
+            *p_byte = u8_new;
+            gfx_mark_dirty(p_frame, page, x);
+        }
+        u32_mask >>= 8;
+        u32_bits >>= 8;
+        p_byte += SSD1306_WIDTH;
+        page++;
+    }
+}
+
+void gfx_set_pixel(t_gfx_frame* p_frame, int x, int y, bool on) {
+    if( ((unsigned int)x >= SSD1306_WIDTH) || ((unsigned int)y >= SSD1306_HEIGHT) ) {
+        return;
+    }
+    int page = y >> 3;
+    uint8_t* p_byte = &p_frame->buf[page * SSD1306_WIDTH + x];
+    uint8_t u8_bit = (uint8_t)(1u << (y & 7));
+    uint8_t u8_new = on ? (*p_byte | u8_bit) : (*p_byte & ~u8_bit);
+    if( u8_new != *p_byte ) {
+        *p_byte = u8_new;
+        gfx_mark_dirty(p_frame, page, x);
+    }
+}
+
+void gfx_fill_rect(t_gfx_frame* p_frame, int x, int y, int w, int h, bool on) {
+    for(int band=0; band<h; band+=GFX_MAX_FONT_HEIGHT) {
+        int band_h = ((h - band) < GFX_MAX_FONT_HEIGHT) ? (h - band) : GFX_MAX_FONT_HEIGHT;
+        for(int c=0; c<w; c++) {
+            gfx_write_column(p_frame, x + c, y + band, on ? 0xFFFFFFu : 0, band_h);
+        }
+    }
+}
+
+// Bresenham, straight lines are filled by columns
+void gfx_draw_line(t_gfx_frame* p_frame, int x0, int y0, int x1, int y1, bool on) {
+    if( (x0 == x1) || (y0 == y1) ) {
+        int x = (x0 < x1) ? x0 : x1;
+        int y = (y0 < y1) ? y0 : y1;
+        gfx_fill_rect(p_frame, x, y, abs(x1 - x0) + 1, abs(y1 - y0) + 1, on);
+        return;
+    }
+    int dx =  abs(x1-x0);
+    int sx = x0<x1 ? 1 : -1;
+    int dy = -abs(y1-y0);
+    int sy = y0<y1 ? 1 : -1;
+    int err = dx+dy;
+
+    while( true ) {
+        gfx_set_pixel(p_frame, x0, y0, on);
+        if( (x0 == x1) && (y0 == y1) ) {
+            break;
+        }
+        int e2 = 2*err;
+        if( e2 >= dy ) {
+            err += dy;
+            x0 += sx;
+        }
+        if( e2 <= dx ) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+// bitmap in the SSD1306 layout, (h + 7) / 8 pages of w bytes
+void gfx_draw_bitmap(t_gfx_frame* p_frame, int x, int y, int w, int h, const uint8_t* p_bitmap) {
+    for(int band=0; band<h; band+=8) {
+        int band_h = ((h - band) < 8) ? (h - band) : 8;
+        const uint8_t* p_page = &p_bitmap[(band / 8) * w];
+        for(int c=0; c<w; c++) {
+            gfx_write_column(p_frame, x + c, y + band, p_page[c], band_h);
+        }
+    }
+}
+
+// glyph of a char, '?' when the font doesn't have it
+static const uint8_t* gfx_glyph(const t_gfx_font* p_font, char c, int* p_width) {
+    uint32_t u32_index = (uint32_t)(uint8_t)c - p_font->u8_first;
+    if( u32_index >= p_font->u8_nb_glyph ) {
+        u32_index = '?' - p_font->u8_first;
+    }
+    uint32_t u32_column;
+    if( p_font->p_offsets != NULL ) {
+        *p_width = p_font->p_widths[u32_index];
+        u32_column = p_font->p_offsets[u32_index];
+    } else {
+        *p_width = p_font->u8_width;
+        u32_column = u32_index * p_font->u8_width;
+    }
+    return &p_font->p_columns[u32_column * GFX_COLUMN_LEN(p_font->u8_height)];
+}
+
+static inline uint32_t gfx_glyph_column(const uint8_t* p_column, uint32_t u32_len) {
+    uint32_t u32_bits = p_column[0];
+    if( u32_len > 1 ) {
+        u32_bits |= (uint32_t)p_column[1] << 8;
+    }
+    if( u32_len > 2 ) {
+        u32_bits |= (uint32_t)p_column[2] << 16;
+    }
+    return u32_bits;
+}
+
+// draw a char with its spacing, returns its advance
+int gfx_draw_char(t_gfx_frame* p_frame, const t_gfx_font* p_font, int x, int y, char c) {
+    int width;
+    const uint8_t* p_column = gfx_glyph(p_font, c, &width);
+    uint32_t u32_len = GFX_COLUMN_LEN(p_font->u8_height);
+    for(int i=0; i<width; i++) {
+        gfx_write_column(p_frame, x + i, y, gfx_glyph_column(p_column, u32_len), p_font->u8_height);
+        p_column += u32_len;
+    }
+    for(int i=0; i<p_font->u8_spacing; i++) {
+        gfx_write_column(p_frame, x + width + i, y, 0, p_font->u8_height);
+    }
+    return width + p_font->u8_spacing;
+}
+
+// same result as gfx_draw_char() one pixel at a time, reference of the bench
+int gfx_draw_char_pixels(t_gfx_frame* p_frame, const t_gfx_font* p_font, int x, int y, char c) {
+    int width;
+    const uint8_t* p_column = gfx_glyph(p_font, c, &width);
+    uint32_t u32_len = GFX_COLUMN_LEN(p_font->u8_height);
+    for(int i=0; i<width + p_font->u8_spacing; i++) {
+        uint32_t u32_bits = (i < width) ? gfx_glyph_column(&p_column[i * u32_len], u32_len) : 0;
+        for(int j=0; j<p_font->u8_height; j++) {
+            gfx_set_pixel(p_frame, x + i, y + j, (u32_bits >> j) & 1);
+        }
+    }
+    return width + p_font->u8_spacing;
+}
+
+// returns x after the string
+int gfx_draw_string(t_gfx_frame* p_frame, const t_gfx_font* p_font, int x, int y, const char* p_str) {
+    while( *p_str ) {
+        x += gfx_draw_char(p_frame, p_font, x, y, *p_str++);
+    }
+    return x;
+}
+
+int gfx_string_width(const t_gfx_font* p_font, const char* p_str) {
+    int total = 0;
+    while( *p_str ) {
+        int width;
+        gfx_glyph(p_font, *p_str++, &width);
+        total += width + p_font->u8_spacing;
+    }
+    return total;
+}
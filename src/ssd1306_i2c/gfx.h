@@ -0,0 +1,51 @@
+#ifndef GFX_H__
+#define GFX_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include "ssd1306_i2c.h"
+
+// tallest glyph, a shifted column must fit 32 bits
+#define GFX_MAX_FONT_HEIGHT 24
+
+// screen buffer in the SSD1306 layout : one byte is 8 vertical pixels of a
+// page, top pixel in bit 0, pages of SSD1306_WIDTH bytes
+typedef struct
+{
+    uint8_t buf[SSD1306_BUF_LEN];
+    // changed columns of each page since last flush, page is clean if start > end
+    uint8_t dirty_start_col[SSD1306_NUM_PAGES];
+    uint8_t dirty_end_col[SSD1306_NUM_PAGES];
+}t_gfx_frame;
+
+// glyphs are columns of u8_height pixels, top pixel in bit 0, each column
+// on (u8_height + 7) / 8 bytes. Every font has a '?' glyph, drawn for
+// the codes it doesn't have.
+typedef struct
+{
+    const uint8_t* p_columns;
+    const uint16_t* p_offsets; // proportional : first column of each glyph, NULL if fixed
+    const uint8_t* p_widths;   // proportional : width of each glyph
+    uint8_t u8_width;          // fixed : width of every glyph
+    uint8_t u8_height;
+    uint8_t u8_first;          // code of the first glyph
+    uint8_t u8_nb_glyph;
+    uint8_t u8_spacing;        // blank columns after each glyph
+}t_gfx_font;
+
+extern const t_gfx_font gfx_font_8x8;
+extern const t_gfx_font gfx_font_prop;
+extern const t_gfx_font gfx_font_digits_16x24;
+
+void gfx_init(void);
+void gfx_clear_dirty(t_gfx_frame* p_frame);
+void gfx_mark_all_dirty(t_gfx_frame* p_frame);
+void gfx_set_pixel(t_gfx_frame* p_frame, int x, int y, bool on);
+void gfx_draw_line(t_gfx_frame* p_frame, int x0, int y0, int x1, int y1, bool on);
+void gfx_fill_rect(t_gfx_frame* p_frame, int x, int y, int w, int h, bool on);
+void gfx_draw_bitmap(t_gfx_frame* p_frame, int x, int y, int w, int h, const uint8_t* p_bitmap);
+int gfx_draw_char(t_gfx_frame* p_frame, const t_gfx_font* p_font, int x, int y, char c);
+int gfx_draw_char_pixels(t_gfx_frame* p_frame, const t_gfx_font* p_font, int x, int y, char c);
+int gfx_draw_string(t_gfx_frame* p_frame, const t_gfx_font* p_font, int x, int y, const char* p_str);
+int gfx_string_width(const t_gfx_font* p_font, const char* p_str);
+
+#endif // GFX_H__
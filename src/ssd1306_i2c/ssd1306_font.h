@@ -7,7 +7,7 @@
 // Vertical bitmaps, A-Z, 0-9. Each is 8 pixels high and wide
 // Theses are defined vertically to make them quick to copy to FB
 
-static uint8_t font[] = {
+static const uint8_t font[] = {
 /*   */ 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
 /* ! */ 0x00,0x00,0x00,0x00,0x4f,0x4f,0x00,0x00,
 /* " */ 0x00,0x00,0x07,0x07,0x00,0x00,0x07,0x07,
@@ -11,10 +11,15 @@
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
 #include "hardware/i2c.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
 #include "hardware/rtc.h"
 #include "raspberry26x32.h"
-#include "ssd1306_font.h"
+#include "ssd1306_i2c.h"
+#include "gfx.h"
 #include "modbus.h"
+#include "fmt.h"
+#include "scheduler.h"
 
 /* Example code to talk to an SSD1306-based OLED display
 
@@ -37,12 +42,6 @@
    GND (pin 38)  -> GND on display board
 */
 
-// Define the size of the display we have attached. This can vary, make sure you
-// have the right size defined or the output will look rather odd!
-// Code has been tested on 128x32 and 128x64 OLED displays
-#define SSD1306_HEIGHT              64
-#define SSD1306_WIDTH               128
-
 #define SSD1306_I2C_ADDR            _u(0x3C)
 
 // 400 is usual, but often these can be overclocked to improve display response.
@@ -51,6 +50,10 @@
 //#define SSD1306_I2C_CLK             1000
 
 #define SSD1306_I2C_DEV             i2c1
+// end of DMA to end of transfer, a FIFO of bytes at 400 kHz
+#define SSD1306_BUSY_RETRY_US       500
+// frame rate limit, frames composed in between are merged into the next one
+#define SSD1306_FRAME_PERIOD_US     250000
 
 // commands (see datasheet)
 #define SSD1306_SET_MEM_MODE        _u(0x20)
@@ -80,10 +83,6 @@
 #define SSD1306_SET_COM_PIN_CFG     _u(0xDA)
 #define SSD1306_SET_VCOM_DESEL      _u(0xDB)
 
-#define SSD1306_PAGE_HEIGHT         _u(8)
-#define SSD1306_NUM_PAGES           (SSD1306_HEIGHT / SSD1306_PAGE_HEIGHT)
-#define SSD1306_BUF_LEN             (SSD1306_NUM_PAGES * SSD1306_WIDTH)
-
 #define SSD1306_WRITE_MODE         _u(0xFE)
 #define SSD1306_READ_MODE          _u(0xFF)
 
@@ -109,9 +108,31 @@ struct render_area frame_area = {
 };
 
 
-// screen buffer
-static uint8_t buf[SSD1306_BUF_LEN+1]; // +1 because we use snprintf to write in buffer and snprintf always add a null char
+// screen buffers, the front one is on the panel or on the bus, the back one
+// is composed. Swapped when the back one is handed to the DMA.
+static t_gfx_frame frames[2];
+static uint8_t u8_front = 0;
+// back frame composed and not sent yet, composing again replaces it
+static volatile bool b_back_ready = false;
+// panel content unknown (intro), next frame is sent whole
+static bool b_full_refresh = true;
 static uint32_t u32_LastSendIndex = 0;
+static uint32_t u32_last_frame_us = 0;
+static t_ssd1306_stats stats;
+
+// DMA transmit stream, one entry per write to IC_DATA_CMD.
+// Entries are 16 bits because byte writes to APB registers are replicated
+// on the whole word and would set the CMD (read) bit, and because the last
+// byte of each I2C transaction must carry the STOP flag. The controller
+// starts a new transaction by itself when data follows a STOP, so several
+// command and data transactions are chained in one DMA transfer.
+// worst case : per page one command transaction (1+6) and one data control byte
+#define SSD1306_TX_BUF_LEN          (SSD1306_BUF_LEN + SSD1306_NUM_PAGES * 8)
+static uint16_t tx_buf[SSD1306_TX_BUF_LEN];
+static uint32_t u32_tx_len = 0;
+static int tx_dma_chan = -1;
+static volatile bool b_tx_busy = false;
+static uint32_t u32_tx_abort = 0;
 
 
 void calc_render_area_buflen(struct render_area *area) {
@@ -120,37 +141,98 @@ void calc_render_area_buflen(struct render_area *area) {
 }
 
 
-void SSD1306_send_cmd(uint8_t cmd) {
-    // I2C write process expects a control byte followed by data
-    // this "data" can be a command or data to follow up a command
-    // Co = 1, D/C = 0 => the driver expects a command
-    uint8_t buf[2] = {0x80, cmd};
-    i2c_write_blocking(SSD1306_I2C_DEV, SSD1306_I2C_ADDR, buf, 2, false);
+static void SSD1306_dma_irq(void) {
+    if( dma_channel_get_irq0_status(tx_dma_chan) ) {
+        dma_channel_acknowledge_irq0(tx_dma_chan);
+        // last byte is in I2C FIFO, bus may still be active (see SSD1306_is_busy)
+        b_tx_busy = false;
+        sched_post(SCHED_TASK_DISPLAY);
+    }
 }
 
-void SSD1306_send_cmd_list(uint8_t *buf, int num) {
-    for (int i=0;i<num;i++)
-        SSD1306_send_cmd(buf[i]);
+void SSD1306_dma_init(void) {
+    tx_dma_chan = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(tx_dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, i2c_get_dreq(SSD1306_I2C_DEV, true));
+    dma_channel_configure(tx_dma_chan, &c, &i2c_get_hw(SSD1306_I2C_DEV)->data_cmd, tx_buf, 0, false);
+
+    // completion interrupt
+    dma_channel_set_irq0_enabled(tx_dma_chan, true);
+    irq_add_shared_handler(DMA_IRQ_0, SSD1306_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
 }
 
-void SSD1306_send_buf(uint8_t buf[], int buflen) {
-    // in horizontal addressing mode, the column address pointer auto-increments
-    // and then wraps around to the next page, so we can send the entire frame
-    // buffer in one gooooooo!
+// true while a frame is being sent (DMA running or I2C still shifting bytes out)
+bool SSD1306_is_busy(void) {
+    i2c_hw_t *hw = i2c_get_hw(SSD1306_I2C_DEV);
 
-    // copy our frame buffer into a new buffer because we need to add the control byte
-    // to the beginning
+    if( hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS ) {
+        // display didn't ack, controller has flushed its FIFO : stop DMA and release bus
+        dma_channel_abort(tx_dma_chan);
+        (void) hw->clr_tx_abrt;
+        b_tx_busy = false;
+        u32_tx_abort++;
+    }
+    if( b_tx_busy ) {
+        return true;
+    }
+    return !(hw->status & I2C_IC_STATUS_TFE_BITS) || (hw->status & I2C_IC_STATUS_MST_ACTIVITY_BITS);
+}
 
-    uint8_t *temp_buf = malloc(buflen + 1);
+static void SSD1306_wait_idle(void) {
+    while( SSD1306_is_busy() ) {
+        tight_loop_contents();
+    }
+}
+
+static void SSD1306_tx_begin(void) {
+    // stream buffer is in use until the end of previous transfer
+    SSD1306_wait_idle();
+    u32_tx_len = 0;
+}
+
+// append one I2C transaction (control byte + payload) to the stream
+static void SSD1306_tx_append(uint8_t control, const uint8_t *p_data, int len) {
+    assert(u32_tx_len + len + 1 <= SSD1306_TX_BUF_LEN);
+    tx_buf[u32_tx_len++] = control;
+    for (int i=0;i<len;i++) {
+        tx_buf[u32_tx_len++] = p_data[i];
+    }
+    tx_buf[u32_tx_len-1] |= I2C_IC_DATA_CMD_STOP_BITS;
+}
 
-    temp_buf[0] = 0x40;
-    memcpy(temp_buf+1, buf, buflen);
+// start DMA, this function returns as soon as the transfer is started
+static void SSD1306_tx_start(void) {
+    if( u32_tx_len == 0 ) {
+        return;
+    }
 
-    i2c_write_blocking(SSD1306_I2C_DEV, SSD1306_I2C_ADDR, temp_buf, buflen + 1, false);
+    // target address can only be changed while controller is disabled
+    i2c_hw_t *hw = i2c_get_hw(SSD1306_I2C_DEV);
+    hw->enable = 0;
+    hw->tar = SSD1306_I2C_ADDR;
+    hw->enable = 1;
 
-    free(temp_buf);
+    b_tx_busy = true;
+    dma_channel_transfer_from_buffer_now(tx_dma_chan, tx_buf, u32_tx_len);
 }
 
+void SSD1306_send_cmd_list(uint8_t *buf, int num) {
+    // I2C write process expects a control byte followed by data
+    // this "data" can be a command or data to follow up a command
+    // Co = 0, D/C = 0 => all following bytes are commands, so the whole
+    // list is sent in a single transaction
+    SSD1306_tx_begin();
+    SSD1306_tx_append(0x00, buf, num);
+    SSD1306_tx_start();
+}
+
+void SSD1306_send_cmd(uint8_t cmd) {
+    SSD1306_send_cmd_list(&cmd, 1);
+}
 
 void SSD1306_scroll(bool on) {
     // configure horizontal scrolling
@@ -168,8 +250,10 @@ void SSD1306_scroll(bool on) {
     SSD1306_send_cmd_list(cmds, count_of(cmds));
 }
 
-void render(uint8_t *buf, struct render_area *area) {
-    // update a portion of the display with a render area
+static void SSD1306_tx_area(uint8_t *buf, struct render_area *area) {
+    // in horizontal addressing mode, the column address pointer auto-increments
+    // and then wraps around to the next page, so we can send the entire area
+    // in one gooooooo!
     uint8_t cmds[] = {
         SSD1306_SET_COL_ADDR,
         area->start_col,
@@ -178,96 +262,36 @@ void render(uint8_t *buf, struct render_area *area) {
         area->start_page,
         area->end_page
     };
-    
-    SSD1306_send_cmd_list(cmds, count_of(cmds));
-    SSD1306_send_buf(buf, area->buflen);
-}
-
-static void SetPixel(uint8_t *buf, int x,int y, bool on) {
-    assert(x >= 0 && x < SSD1306_WIDTH && y >=0 && y < SSD1306_HEIGHT);
-
-    // The calculation to determine the correct bit to set depends on which address
-    // mode we are in. This code assumes horizontal
-
-    // The video ram on the SSD1306 is split up in to 8 rows, one bit per pixel.
-    // Each row is 128 long by 8 pixels high, each byte vertically arranged, so byte 0 is x=0, y=0->7,
-    // byte 1 is x = 1, y=0->7 etc
-
-    // This code could be optimised, but is like this for clarity. The compiler
-    // should do a half decent job optimising it anyway.
-
-    const int BytesPerRow = SSD1306_WIDTH ; // x pixels, 1bpp, but each row is 8 pixel high, so (x / 8) * 8
-
-    int byte_idx = (y / 8) * BytesPerRow + x;
-    uint8_t byte = buf[byte_idx];
-
-    if (on)
-        byte |=  1 << (y % 8);
-    else
-        byte &= ~(1 << (y % 8));
-
-    buf[byte_idx] = byte;
-}
-// Basic Bresenhams.
-static void DrawLine(uint8_t *buf, int x0, int y0, int x1, int y1, bool on) {
-
-    int dx =  abs(x1-x0);
-    int sx = x0<x1 ? 1 : -1;
-    int dy = -abs(y1-y0);
-    int sy = y0<y1 ? 1 : -1;
-    int err = dx+dy;
-    int e2;
-
-    while (true) {
-        SetPixel(buf, x0, y0, on);
-        if (x0 == x1 && y0 == y1)
-            break;
-        e2 = 2*err;
-
-        if (e2 >= dy) {
-            err += dy;
-            x0 += sx;
-        }
-        if (e2 <= dx) {
-            err += dx;
-            y0 += sy;
-        }
-    }
-}
 
-static inline int GetFontIndex(uint8_t ch) {
-    if (ch < sizeof(font)) {
-        return  ch - 32;
-    }
-    else return  0; // Not got that char so space.
+    SSD1306_tx_append(0x00, cmds, count_of(cmds));
+    SSD1306_tx_append(0x40, buf, area->buflen);
 }
 
-
-static void WriteChar(uint8_t *buf, int16_t x, int16_t y, uint8_t ch) {
-
-    if (x > SSD1306_WIDTH - 8 || y > SSD1306_HEIGHT - 8)
-        return;
-
-    // For the moment, only write on Y row boundaries (every 8 vertical pixels)
-    y = y/8;
-
-    int idx = GetFontIndex(ch);
-    int fb_idx = y * 128 + x;
-
-    for (int i=0;i<8;i++) {
-        buf[fb_idx++] = font[idx * 8 + i];
-    }
+void render(uint8_t *buf, struct render_area *area) {
+    // update a portion of the display with a render area
+    SSD1306_tx_begin();
+    SSD1306_tx_area(buf, area);
+    SSD1306_tx_start();
 }
 
-static void WriteString(uint8_t *buf, int16_t x, int16_t y, char *str) {
-    // Cull out any string off the screen
-    if (x > SSD1306_WIDTH - 8 || y > SSD1306_HEIGHT - 8)
-        return;
-
-    while (*str) {
-        WriteChar(buf, x, y, *str++);
-        x+=8;
+// send only the changed columns of each page of the screen buffer
+void SSD1306_flush(t_gfx_frame* p_frame) {
+    SSD1306_tx_begin();
+    for (int page=0;page<SSD1306_NUM_PAGES;page++) {
+        if( p_frame->dirty_start_col[page] > p_frame->dirty_end_col[page] ) {
+            continue;
+        }
+        struct render_area area = {
+            start_col : p_frame->dirty_start_col[page],
+            end_col : p_frame->dirty_end_col[page],
+            start_page : page,
+            end_page : page
+        };
+        calc_render_area_buflen(&area);
+        SSD1306_tx_area(&p_frame->buf[page * SSD1306_WIDTH + area.start_col], &area);
     }
+    gfx_clear_dirty(p_frame);
+    SSD1306_tx_start();
 }
 
 void SSD1306_init(void) {
@@ -278,6 +302,9 @@ void SSD1306_init(void) {
 
     printf("SSD1306_init...\n");
 
+    SSD1306_dma_init();
+    gfx_init();
+
     uint8_t cmds[] = {
         SSD1306_SET_DISP,               // set display off
         /* memory mapping */
@@ -325,8 +352,8 @@ void SSD1306_init(void) {
 
     // zero the entire display
     printf("Zero entire display\n");
-    memset(buf, 0, SSD1306_BUF_LEN);
-    render(buf, &frame_area);
+    memset(frames, 0, sizeof(frames));
+    render(frames[u8_front].buf, &frame_area);
 
     // intro sequence: flash the screen 3 times
     printf("flash the screen 3 times\n");
@@ -355,6 +382,9 @@ void SSD1306_init(void) {
         area.start_col += offset;
         area.end_col += offset;
     }
+
+    // screen doesn't match the frame anymore, first flush sends the whole buffer
+    b_full_refresh = true;
     /*printf("Scrolling on\n");
     SSD1306_scroll(true);
     sleep_ms(5000);
@@ -362,75 +392,165 @@ void SSD1306_init(void) {
     printf("Scrolling off\n");*/
 }
 
-// screen buffer
-// a char is 8x8 pixels so screen is 8 lines and a line is 16 char
-/*static char lines[SSD1306_HEIGHT/8][SSD1306_WIDTH/8] = {
-    "YYMMDD  HH:MM:SS",
-    "230.0V   50.0 Hz",
-    "                ",
-    "99.999A  -99999W",
-    "999999Wh   0.000",
-    "                ",
-    "99.999A  -99999W",
-    "999999Wh   0.000",
-};*/
-
-char line[SSD1306_WIDTH/8+1];
+/* screen layout, 8 pixels proportional font except the grid power
+"01/01/2023      12:34:56"
+"230.0V           50.00Hz"
+"-12345 W  0.950"  16x24 digits
+"12.345A        123456Wh"
+"-1234W           678Wh"
+*/
+#define SSD1306_LINE_DATE_Y     0
+#define SSD1306_LINE_MAINS_Y    10
+#define SSD1306_LINE_POWER_Y    20
+#define SSD1306_LINE_VOIE1_Y    46
+#define SSD1306_LINE_VOIE2_Y    56
+#define SSD1306_HALF_WIDTH      (SSD1306_WIDTH / 2)
+#define SSD1306_DATE_WIDTH      72
+// 6 digits of 16 pixels
+#define SSD1306_POWER_WIDTH     96
+
+char line[32];
+
+// text in a field of the screen, the rest of the field is cleared
+static void SSD1306_field(t_gfx_frame* p_frame, const t_gfx_font* p_font, int x, int y, int w, const char* p_str, bool b_right) {
+    int text_w = gfx_string_width(p_font, p_str);
+    int text_x = b_right ? (x + w - text_w) : x;
+    gfx_fill_rect(p_frame, x, y, text_x - x, p_font->u8_height, false);
+    int end_x = gfx_draw_string(p_frame, p_font, text_x, y, p_str);
+    gfx_fill_rect(p_frame, end_x, y, x + w - end_x, p_font->u8_height, false);
+}
 
-void SSD1306_loop(void) {
+// draw a sample in the back frame. The back frame starts from the front
+// one, so its dirty columns are what the panel lacks. If it wasn't sent
+// yet, it is drawn again and the previous sample is dropped.
+static void SSD1306_compose(const t_power_data* p_power_data) {
+    t_gfx_frame* p_frame = &frames[u8_front ^ 1];
+    if( b_back_ready ) {
+        stats.u32_frame_dropped++;
+    } else {
+        memcpy(p_frame->buf, frames[u8_front].buf, SSD1306_BUF_LEN);
+        gfx_clear_dirty(p_frame);
+    }
+
+    datetime_t t;
+    rtc_get_datetime(&t);
+    // DD/MM/YYYY      HH:MM:SS
+    char* p = line;
+    p = fmt_u32_pad(p, t.day, 2, '0');
+    p = fmt_char(p, '/');
+    p = fmt_u32_pad(p, t.month, 2, '0');
+    p = fmt_char(p, '/');
+    p = fmt_u32_pad(p, t.year, 4, '0');
+    fmt_end(p);
+    SSD1306_field(p_frame, &gfx_font_prop, 0, SSD1306_LINE_DATE_Y, SSD1306_DATE_WIDTH, line, false);
+    p = line;
+    p = fmt_u32_pad(p, t.hour, 2, '0');
+    p = fmt_char(p, ':');
+    p = fmt_u32_pad(p, t.min, 2, '0');
+    p = fmt_char(p, ':');
+    p = fmt_u32_pad(p, t.sec, 2, '0');
+    fmt_end(p);
+    SSD1306_field(p_frame, &gfx_font_prop, SSD1306_DATE_WIDTH, SSD1306_LINE_DATE_Y, SSD1306_WIDTH - SSD1306_DATE_WIDTH, line, true);
+
+    // 230.0V           50.00Hz
+    p = line;
+    p = fmt_milli_u32_pad(p, p_power_data->tension_mv, 3, 1);
+    p = fmt_char(p, 'V');
+    fmt_end(p);
+    SSD1306_field(p_frame, &gfx_font_prop, 0, SSD1306_LINE_MAINS_Y, SSD1306_HALF_WIDTH, line, false);
+    p = line;
+    p = fmt_milli_u32_pad(p, p_power_data->frequence_mhz, 2, 2);
+    p = fmt_str(p, "Hz");
+    fmt_end(p);
+    SSD1306_field(p_frame, &gfx_font_prop, SSD1306_HALF_WIDTH, SSD1306_LINE_MAINS_Y, SSD1306_HALF_WIDTH, line, true);
+
+    // grid power in large digits, W on the baseline, power factor on the right
+    p = line;
+    p = fmt_i32_pad(p, p_power_data->voie[0].puissance_active_mw/1000, 6, ' ');
+    fmt_end(p);
+    SSD1306_field(p_frame, &gfx_font_digits_16x24, 0, SSD1306_LINE_POWER_Y, SSD1306_POWER_WIDTH, line, true);
+    gfx_draw_string(p_frame, &gfx_font_prop, SSD1306_POWER_WIDTH + 2,
+            SSD1306_LINE_POWER_Y + gfx_font_digits_16x24.u8_height - gfx_font_prop.u8_height, "W");
+    p = line;
+    p = fmt_milli_u32(p, p_power_data->voie[0].facteur_puissance, 3);
+    fmt_end(p);
+    SSD1306_field(p_frame, &gfx_font_prop, SSD1306_POWER_WIDTH + 1, SSD1306_LINE_POWER_Y,
+            SSD1306_WIDTH - SSD1306_POWER_WIDTH - 1, line, true);
+
+    // 12.345A        123456Wh
+    p = line;
+    p = fmt_milli_u32_pad(p, p_power_data->voie[0].courant_ma, 2, 3);
+    p = fmt_char(p, 'A');
+    fmt_end(p);
+    SSD1306_field(p_frame, &gfx_font_prop, 0, SSD1306_LINE_VOIE1_Y, SSD1306_HALF_WIDTH, line, false);
+    p = line;
+    p = fmt_u32(p, p_power_data->voie[0].energie_wh);
+    p = fmt_str(p, "Wh");
+    fmt_end(p);
+    SSD1306_field(p_frame, &gfx_font_prop, SSD1306_HALF_WIDTH, SSD1306_LINE_VOIE1_Y, SSD1306_HALF_WIDTH, line, true);
+
+    // -1234W           678Wh : diverted load
+    p = line;
+    p = fmt_i32(p, p_power_data->voie[1].puissance_active_mw/1000);
+    p = fmt_char(p, 'W');
+    fmt_end(p);
+    SSD1306_field(p_frame, &gfx_font_prop, 0, SSD1306_LINE_VOIE2_Y, SSD1306_HALF_WIDTH, line, false);
+    p = line;
+    p = fmt_u32(p, p_power_data->voie[1].energie_wh);
+    p = fmt_str(p, "Wh");
+    fmt_end(p);
+    SSD1306_field(p_frame, &gfx_font_prop, SSD1306_HALF_WIDTH, SSD1306_LINE_VOIE2_Y, SSD1306_HALF_WIDTH, line, true);
+
+    if( b_full_refresh ) {
+        gfx_mark_all_dirty(p_frame);
+        b_full_refresh = false;
+    }
+    stats.u32_frame_composed++;
+    b_back_ready = true;
+}
+
+// hand the back frame to the DMA when the bus is free and the frame period
+// elapsed, never waits
+static void SSD1306_present(t_power_data* p_power_data) {
+    if( !b_back_ready ) {
+        return;
+    }
+    if( SSD1306_is_busy() ) {
+        // woken by the end of DMA, then the I2C FIFO drains
+        sched_wake_in_us(SCHED_TASK_DISPLAY, SSD1306_BUSY_RETRY_US);
+        return;
+    }
+    uint32_t u32_now_us = time_us_32();
+    uint32_t u32_elapsed_us = u32_now_us - u32_last_frame_us;
+    if( (stats.u32_frame_sent > 0) && (u32_elapsed_us < SSD1306_FRAME_PERIOD_US) ) {
+        sched_wake_in_us(SCHED_TASK_DISPLAY, SSD1306_FRAME_PERIOD_US - u32_elapsed_us);
+        return;
+    }
+    u32_last_frame_us = u32_now_us;
+    u8_front ^= 1;
+    b_back_ready = false;
+    // update changed part of screen, sent by DMA in background
+    SSD1306_flush(&frames[u8_front]);
+    stats.u32_frame_sent++;
+    if( p_power_data->u32_index == u32_LastSendIndex ) {
+        latency_stamp(p_power_data->u32_stage_us, LATENCY_STAGE_DISPLAY);
+    }
+}
 
+void SSD1306_loop(void) {
     // get power data 
     t_power_data* p_power_data = modbus_get_power_data();
 
-    // send data if new recent data
+    // compose if new recent data, less than one second old
     absolute_time_t cur_time = get_absolute_time();
     int64_t diff_us = absolute_time_diff_us(p_power_data->time, cur_time);
-    // if data has less than one second
     if( ((diff_us < (1*1000*1000)) && (u32_LastSendIndex != p_power_data->u32_index)) ) {
         u32_LastSendIndex = p_power_data->u32_index;
-
-        // update buf content
-        datetime_t t;
-        rtc_get_datetime(&t);
-        // line 1 : DD/MM/YYYY
-        sprintf(line, "%02u/%02u/%04u", t.day, t.month, t.year);
-        WriteString(buf, 0, 0, line);
-        
-        // line 2 : HH:MM:SS
-        sprintf(line, "%02u:%02u:%02u",t.hour, t.min, t.sec);
-        WriteString(buf, 0, SSD1306_PAGE_HEIGHT, line);
-        
-        // line 3 empty
-        
-        // line 4 : "230.0V   50.0 Hz"
-        sprintf(line, "%3u.%uV   %2u.%02uHz", p_power_data->tension_mv/1000, (p_power_data->tension_mv%1000)/100,
-                                    p_power_data->frequence_mhz/1000, (p_power_data->frequence_mhz%1000)/100);
-        WriteString(buf, 0, 3*SSD1306_PAGE_HEIGHT, line);
-        
-        // line 5 : "99.999A  -99999W"
-        sprintf(line, "%2u.%03uA  %6dW", p_power_data->voie[0].courant_ma/1000, p_power_data->voie[0].courant_ma%1000,
-                                    p_power_data->voie[0].puissance_active_mw/1000);
-        WriteString(buf, 0, 4*SSD1306_PAGE_HEIGHT, line);
-        
-        // line 6 : "999999Wh   0.000"
-        sprintf(line, "%6uWh   %u.%03u", p_power_data->voie[0].energie_wh,
-                                    p_power_data->voie[0].facteur_puissance/1000, p_power_data->voie[0].facteur_puissance%1000);
-        
-        WriteString(buf, 0, 5*SSD1306_PAGE_HEIGHT, line);
-        // line 7 : "99.999A  -99999W"
-        sprintf(line, "%2u.%03uA  %6dW", p_power_data->voie[1].courant_ma/1000, p_power_data->voie[1].courant_ma%1000,
-                                    p_power_data->voie[1].puissance_active_mw/1000);
-        WriteString(buf, 0, 6*SSD1306_PAGE_HEIGHT, line);
-        
-        // line 8 : "999999Wh   0.000"
-        sprintf(line, "%6uWh   %u.%03u", p_power_data->voie[1].energie_wh,
-                                    p_power_data->voie[1].facteur_puissance/1000, p_power_data->voie[1].facteur_puissance%1000);
-        WriteString(buf, 0, 7*SSD1306_PAGE_HEIGHT, line);
-        
-        // update screen
-        render(buf, &frame_area);
+        SSD1306_compose(p_power_data);
     }
+    SSD1306_present(p_power_data);
+}
 
-    
-
+void SSD1306_get_stats(t_ssd1306_stats* p_stats) {
+    *p_stats = stats;
 }
@@ -2,7 +2,29 @@
 #define SSD1306_I2C__
 
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// Define the size of the display we have attached. This can vary, make sure you
+// have the right size defined or the output will look rather odd!
+// Code has been tested on 128x32 and 128x64 OLED displays
+#define SSD1306_HEIGHT              64
+#define SSD1306_WIDTH               128
+
+#define SSD1306_PAGE_HEIGHT         8
+#define SSD1306_NUM_PAGES           (SSD1306_HEIGHT / SSD1306_PAGE_HEIGHT)
+#define SSD1306_BUF_LEN             (SSD1306_NUM_PAGES * SSD1306_WIDTH)
+
+typedef struct
+{
+    uint32_t u32_frame_composed;
+    uint32_t u32_frame_sent;
+    uint32_t u32_frame_dropped; // composed again before being sent
+}t_ssd1306_stats;
+
 void SSD1306_init(void);
 void SSD1306_loop(void);
+bool SSD1306_is_busy(void);
+void SSD1306_get_stats(t_ssd1306_stats* p_stats);
 
 #endif // SSD1306_I2C__
\ No newline at end of file
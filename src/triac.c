@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/clocks.h"
+#include "triac.pio.h"
+#include "triac.h"
+#include "scheduler.h"
+
+/*
+Triac driver : the PIO times the mains and fires the gate, the CPU only
+chooses one delay per half cycle.
+
+- state machine triac_zero_cross measures the time between rising edges
+  of the zero-cross detector and raises a PIO irq on each edge,
+- state machine triac_fire waits for that irq and pulses the gate after
+  the delay taken from its TX FIFO, or not at all for 0.
+
+Firing jitter is a few PIO cycles whatever the CPU does. The TX FIFO is
+kept TRIAC_TX_AHEAD half cycles ahead; when core1 is late the previous
+delay is used again, so phase control holds its power through a stall.
+
+Zero crossings are timestamped by adding the measured periods, in the
+time_us_64() base. The mains frequency is averaged over
+TRIAC_FREQ_NB_HALF half cycles, to compare with the meter one.
+
+Modes :
+- phase : the firing angle of a resistive load for the requested power
+  comes from a table of the inverse of 1 - a + sin(2 pi a) / (2 pi),
+- cycle : whole mains cycles on or off chosen by a sigma-delta, both half
+  cycles of a cycle are the same so no DC goes through the load.
+*/
+
+/*****************************************************************************/
+/*            CONST                                                          */
+/*****************************************************************************/
+// one PIO cycle per us
+#define TRIAC_PIO_HZ 1000000
+#define TRIAC_NOMINAL_HALF_PERIOD_US 10000
+// closer edges are noise, 60 Hz mains is 8333 us
+#define TRIAC_MIN_HALF_PERIOD_US 7000
+#define TRIAC_LOST_HALF_PERIOD 3
+// gate pulse after the edge, once the current can latch the triac
+#define TRIAC_MIN_DELAY_US 200
+// last firing time before the next zero crossing
+#define TRIAC_MARGIN_US 600
+#define TRIAC_TX_AHEAD 2
+// triac_zero_cross doesn't use its TX FIFO, joined to its RX one
+#define TRIAC_RX_FIFO_DEPTH 8
+// an older edge means the FIFO may have been full and later edges lost,
+// at the shortest half period
+#define TRIAC_RX_STALL_US (TRIAC_RX_FIFO_DEPTH * TRIAC_MIN_HALF_PERIOD_US)
+#define TRIAC_FREQ_NB_HALF 100
+// run twice per half cycle, the FIFOs hold more than that
+#define TRIAC_LOOP_PERIOD_US (TRIAC_NOMINAL_HALF_PERIOD_US / 2)
+
+/*****************************************************************************/
+/*            PRIVATE VAR                                                    */
+/*****************************************************************************/
+// firing angle / pi in Q16 for power 0/64 .. 64/64
+static const uint16_t triac_phase_table[65] = {
+    65535, 56687, 54305, 52598, 51212, 50022, 48963, 48001, 47112, 46282, 45499, 44755, 44044,
+    43361, 42701, 42063, 41443, 40839, 40248, 39670, 39103, 38545, 37996, 37454, 36918, 36388,
+    35863, 35341, 34823, 34307, 33793, 33280, 32768, 32256, 31743, 31229, 30713, 30195, 29673,
+    29148, 28618, 28082, 27540, 26991, 26433, 25866, 25288, 24697, 24093, 23473, 22835, 22175,
+    21492, 20781, 20037, 19254, 18424, 17535, 16573, 15514, 14324, 12938, 11231, 8849, 0
+};
+
+// set by any core
+static volatile enum triac_mode triac_mode = TRIAC_MODE_OFF;
+static volatile uint32_t u32_triac_power = 0;
+
+// core1
+static bool b_resync = true;      // next edge starts a new period measure
+static bool b_anchor = false;     // next edge starts a new timestamp base
+static uint64_t u64_origin_us = 0;
+static uint64_t u64_pio_us = 0;   // PIO time of the last edge
+static uint32_t u32_pending_us = 0;
+static uint32_t u32_freq_sum_us = 0;
+static uint32_t u32_freq_nb = 0;
+static uint32_t u32_half_index = 0;
+static uint32_t u32_sigma_delta = 0;
+static bool b_cycle_on = false;
+static t_triac_status status;
+
+/*****************************************************************************/
+/*            FUNCTION DEFINITION                                            */
+/*****************************************************************************/
+// core1
+void triac_init(void) {
+    float clkdiv = (float)clock_get_hz(clk_sys) / TRIAC_PIO_HZ;
+    memset(&status, 0, sizeof(status));
+
+    uint32_t offset = pio_add_program(TRIAC_PIO, &triac_zero_cross_program);
+    pio_sm_claim(TRIAC_PIO, TRIAC_ZERO_CROSS_SM);
+    pio_sm_config config = triac_zero_cross_program_get_default_config(offset);
+    sm_config_set_jmp_pin(&config, TRIAC_ZERO_CROSS_GPIO);
+    sm_config_set_fifo_join(&config, PIO_FIFO_JOIN_RX);
+    sm_config_set_clkdiv(&config, clkdiv);
+    pio_sm_init(TRIAC_PIO, TRIAC_ZERO_CROSS_SM, offset, &config);
+
+    offset = pio_add_program(TRIAC_PIO, &triac_fire_program);
+    pio_sm_claim(TRIAC_PIO, TRIAC_FIRE_SM);
+    pio_gpio_init(TRIAC_PIO, TRIAC_GATE_GPIO);
+    pio_sm_set_consecutive_pindirs(TRIAC_PIO, TRIAC_FIRE_SM, TRIAC_GATE_GPIO, 1, true);
+    config = triac_fire_program_get_default_config(offset);
+    sm_config_set_sideset_pins(&config, TRIAC_GATE_GPIO);
+    sm_config_set_clkdiv(&config, clkdiv);
+    pio_sm_init(TRIAC_PIO, TRIAC_FIRE_SM, offset, &config);
+
+    // firing first so it never misses the first irq
+    pio_sm_set_enabled(TRIAC_PIO, TRIAC_FIRE_SM, true);
+    pio_sm_set_enabled(TRIAC_PIO, TRIAC_ZERO_CROSS_SM, true);
+    u64_origin_us = time_us_64();
+}
+
+// delay of the next half cycle in us after the edge, 0 to not fire
+static uint32_t triac_next_delay_us(void) {
+    uint32_t u32_power = u32_triac_power;
+    uint32_t u32_half_us = status.b_mains_ok ? status.u32_half_period_us : TRIAC_NOMINAL_HALF_PERIOD_US;
+    uint32_t u32_delay_us = 0;
+    if( u32_power > TRIAC_POWER_ONE ) {
+        u32_power = TRIAC_POWER_ONE;
+    }
+
+    switch( triac_mode ) {
+        case TRIAC_MODE_PHASE:
+            if( u32_power > 0 ) {
+                // linear interpolation between table points
+                uint32_t u32_index = u32_power >> 10;
+                uint32_t u32_angle = triac_phase_table[u32_index];
+                if( u32_index < 64 ) {
+                    u32_angle -= ((u32_angle - triac_phase_table[u32_index + 1]) * (u32_power & 1023)) >> 10;
+                }
+                u32_delay_us = (u32_angle * u32_half_us) >> 16;
+                if( u32_delay_us < TRIAC_MIN_DELAY_US ) {
+                    u32_delay_us = TRIAC_MIN_DELAY_US;
+                } else if( u32_delay_us > (u32_half_us - TRIAC_MARGIN_US) ) {
+                    // too close to the next zero crossing
+                    u32_delay_us = 0;
+                }
+            }
+            break;
+        case TRIAC_MODE_CYCLE:
+            // decided on the first half of each cycle
+            if( (u32_half_index & 1) == 0 ) {
+                u32_sigma_delta += u32_power;
+                b_cycle_on = u32_sigma_delta >= TRIAC_POWER_ONE;
+                if( b_cycle_on ) {
+                    u32_sigma_delta -= TRIAC_POWER_ONE;
+                }
+            }
+            u32_delay_us = b_cycle_on ? TRIAC_MIN_DELAY_US : 0;
+            break;
+        default:
+            break;
+    }
+    u32_half_index++;
+    status.u32_delay_us = u32_delay_us;
+    return u32_delay_us;
+}
+
+// core1 : zero crossings from the PIO, firing delays to the PIO
+void triac_loop(void) {
+    uint64_t u64_now_us = time_us_64();
+
+    while( !pio_sm_is_rx_fifo_empty(TRIAC_PIO, TRIAC_ZERO_CROSS_SM) ) {
+        uint32_t u32_count = pio_sm_get(TRIAC_PIO, TRIAC_ZERO_CROSS_SM);
+        uint32_t u32_us = 2 * u32_count + triac_zero_cross_OVERHEAD_CYCLES;
+        u64_pio_us += u32_us;
+        if( (int64_t)(u64_now_us - (u64_origin_us + u64_pio_us)) > TRIAC_RX_STALL_US ) {
+            // core1 stalled longer than the FIFO and edges were lost : drop the
+            // old ones, the next edge gives the time base again
+            while( !pio_sm_is_rx_fifo_empty(TRIAC_PIO, TRIAC_ZERO_CROSS_SM) ) {
+                pio_sm_get(TRIAC_PIO, TRIAC_ZERO_CROSS_SM);
+            }
+            b_anchor = true;
+            b_resync = true;
+            break;
+        }
+        if( b_anchor ) {
+            b_anchor = false;
+            u64_origin_us = u64_now_us - u64_pio_us;
+        }
+        if( b_resync ) {
+            // the first interval is not a whole half period
+            b_resync = false;
+            u32_pending_us = 0;
+            u32_freq_sum_us = 0;
+            u32_freq_nb = 0;
+            status.u64_zero_cross_us = u64_origin_us + u64_pio_us;
+            continue;
+        }
+        u32_pending_us += u32_us;
+        if( u32_pending_us < TRIAC_MIN_HALF_PERIOD_US ) {
+            status.u32_glitch++;
+            continue;
+        }
+        status.u32_half_period_us = u32_pending_us;
+        status.u64_zero_cross_us = u64_origin_us + u64_pio_us;
+        status.u32_zero_cross++;
+        status.b_mains_ok = true;
+        u32_pending_us = 0;
+
+        u32_freq_sum_us += status.u32_half_period_us;
+        u32_freq_nb++;
+        if( u32_freq_nb == TRIAC_FREQ_NB_HALF ) {
+            // f = nb / (2 * sum)
+            status.u32_mains_mhz = (uint32_t)(((uint64_t)TRIAC_FREQ_NB_HALF * 500000000u) / u32_freq_sum_us);
+            u32_freq_sum_us = 0;
+            u32_freq_nb = 0;
+        }
+    }
+
+    if( status.b_mains_ok && ((int64_t)(u64_now_us - status.u64_zero_cross_us) > (TRIAC_LOST_HALF_PERIOD * TRIAC_NOMINAL_HALF_PERIOD_US)) ) {
+        status.b_mains_ok = false;
+        status.u32_lost++;
+        b_resync = true;
+    }
+
+    while( pio_sm_get_tx_fifo_level(TRIAC_PIO, TRIAC_FIRE_SM) < TRIAC_TX_AHEAD ) {
+        uint32_t u32_delay_us = triac_next_delay_us();
+        pio_sm_put(TRIAC_PIO, TRIAC_FIRE_SM, (u32_delay_us == 0) ? 0 : u32_delay_us - triac_fire_OVERHEAD_CYCLES);
+    }
+    sched_wake_in_us(SCHED_TASK_TRIAC, TRIAC_LOOP_PERIOD_US);
+}
+
+// any core, power is applied within TRIAC_TX_AHEAD half cycles
+void triac_set(enum triac_mode mode, uint32_t u32_power) {
+    u32_triac_power = u32_power;
+    triac_mode = mode;
+}
+
+// core0 : copy of core1 state, fields may be from different half cycles
+void triac_get_status(t_triac_status* p_status) {
+    *p_status = status;
+    p_status->mode = triac_mode;
+    p_status->u32_power = u32_triac_power;
+}
@@ -0,0 +1,39 @@
+#ifndef TRIAC_H__
+#define TRIAC_H__
+#include "pico/stdlib.h"
+
+#define TRIAC_PIO pio0
+#define TRIAC_ZERO_CROSS_SM 0
+#define TRIAC_FIRE_SM 1
+// zero-cross detector output, a pulse around each zero crossing
+#define TRIAC_ZERO_CROSS_GPIO 3
+#define TRIAC_GATE_GPIO 4
+// power scale, TRIAC_POWER_ONE is full power
+#define TRIAC_POWER_ONE 65536
+
+enum triac_mode {
+    TRIAC_MODE_OFF=0,
+    TRIAC_MODE_PHASE, // fire every half cycle at the angle giving the power
+    TRIAC_MODE_CYCLE  // full or no conduction per mains cycle
+};
+
+typedef struct
+{
+    enum triac_mode mode;
+    uint32_t u32_power;
+    uint32_t u32_delay_us;       // last firing delay, 0 if not fired
+    bool b_mains_ok;
+    uint32_t u32_zero_cross;
+    uint32_t u32_glitch;         // edges too close, merged with the next one
+    uint32_t u32_lost;           // mains lost events
+    uint32_t u32_half_period_us; // last half period
+    uint32_t u32_mains_mhz;      // over the last TRIAC_FREQ_NB_HALF half cycles
+    uint64_t u64_zero_cross_us;  // time of the last zero crossing, time_us_64() base
+}t_triac_status;
+
+void triac_init(void);
+void triac_loop(void);
+void triac_set(enum triac_mode mode, uint32_t u32_power);
+void triac_get_status(t_triac_status* p_status);
+
+#endif // TRIAC_H__